@@ -12,6 +12,8 @@
 #include "./CrawlFileTree.h"
 
 #include <dirent.h>
+#include <pthread.h>
+#include <atomic>
 #include <cstdlib>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -49,6 +51,37 @@ static void handle_dir(const string& dir_path, DIR *d,
 // Read and parse the specified file, then inject it into the MemIndex.
 static void handle_file(const string& fpath, WordIndex *index);
 
+// Read the specified file and split it into lower-case words, which are
+// returned through "words".
+static void read_words(const string& fpath, vector<string> *words);
+
+// The state shared by all the tasks of one parallel crawl.
+struct CrawlState {
+  ThreadPool *pool;
+  WordIndex *index;
+
+  // Guards index.
+  pthread_mutex_t index_lock;
+
+  // How many tasks haven't finished yet.  The one that brings this to
+  // zero sets "finished" and signals "done", under "done_lock".
+  std::atomic<int> pending;
+  bool finished;
+  pthread_mutex_t done_lock;
+  pthread_cond_t done;
+};
+
+// The functions that crawl one directory or index one file.
+typedef void (*crawl_fn)(CrawlState *state, const string &path);
+static void crawl_dir(CrawlState *state, const string &path);
+static void crawl_file(CrawlState *state, const string &path);
+
+// Posts a task running "f" on "path" to the crawl's pool.
+static void spawn_crawl_task(CrawlState *state, crawl_fn f, string path);
+
+// Marks one of the crawl's tasks as finished.
+static void finish_crawl_task(CrawlState *state);
+
 static bool isNotAlpha(char c) {return !isalpha(c);}
 
 //////////////////////////////////////////////////////////////////////////////
@@ -91,6 +124,44 @@ bool crawl_filetree(const string& root_dir, WordIndex *index) {
   return true;
 }
 
+bool crawl_filetree(const string& root_dir, WordIndex *index,
+                    ThreadPool *pool) {
+  struct stat root_stat;
+  if (index == nullptr || pool == nullptr ||
+      stat(root_dir.c_str(), &root_stat) == -1 ||
+      !S_ISDIR(root_stat.st_mode)) {
+    return false;
+  }
+  DIR *rd = opendir(root_dir.c_str());
+  if (rd == NULL) {
+    return false;
+  }
+  closedir(rd);
+
+  CrawlState state;
+  state.pool = pool;
+  state.index = index;
+  state.pending = 0;
+  state.finished = false;
+  pthread_mutex_init(&state.index_lock, nullptr);
+  pthread_mutex_init(&state.done_lock, nullptr);
+  pthread_cond_init(&state.done, nullptr);
+
+  // Start with the root directory, then wait for every task it leads
+  // to.
+  spawn_crawl_task(&state, &crawl_dir, root_dir);
+  pthread_mutex_lock(&state.done_lock);
+  while (!state.finished) {
+    pthread_cond_wait(&state.done, &state.done_lock);
+  }
+  pthread_mutex_unlock(&state.done_lock);
+
+  pthread_cond_destroy(&state.done);
+  pthread_mutex_destroy(&state.done_lock);
+  pthread_mutex_destroy(&state.index_lock);
+  return true;
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 // Internal helper functions
@@ -179,7 +250,19 @@ static void handle_dir(const string& dir_path, DIR *d, WordIndex *index) {
 
   // Your implementation should also be case in-sensitive and record every word in all lower-case
 static void handle_file(const string& fpath, WordIndex *index) {
+  std::vector<string> components;
+  read_words(fpath, &components);
 
+  // store in WordIndex
+  DocID doc_id = index->add_document(fpath);
+  for(string s: components){
+    if (s != "\0") {
+      index->record(s, doc_id);
+    }
+  }
+}
+
+static void read_words(const string& fpath, vector<string> *words) {
   string content;
   
   FILE *fs = fopen(fpath.c_str(), "r");
@@ -203,16 +286,69 @@ static void handle_file(const string& fpath, WordIndex *index) {
   delete[] buffer;
   boost::algorithm::trim(content);
   boost::to_lower(content);
-  std::vector<string> components;
-  
-  boost::split(components, content, isNotAlpha, boost::token_compress_on);
 
-  // store in WordIndex
-  for(string s: components){
-    if (s != "\0") {
-      index->record(s, fpath);
+  boost::split(*words, content, isNotAlpha, boost::token_compress_on);
+}
+
+static void spawn_crawl_task(CrawlState *state, crawl_fn f, string path) {
+  state->pending++;
+  state->pool->post([state, f, path = std::move(path)]() {
+    f(state, path);
+    finish_crawl_task(state);
+  });
+}
+
+static void finish_crawl_task(CrawlState *state) {
+  if (--state->pending == 0) {
+    pthread_mutex_lock(&state->done_lock);
+    state->finished = true;
+    pthread_cond_signal(&state->done);
+    pthread_mutex_unlock(&state->done_lock);
+  }
+}
+
+static void crawl_dir(CrawlState *state, const string &dir_path) {
+  DIR *d = opendir(dir_path.c_str());
+  if (d != NULL) {
+    // The same walk as handle_dir(), except that every entry becomes
+    // a task of its own.
+    struct dirent *dirent;
+    struct stat st;
+    while ((dirent = readdir(d)) != NULL) {
+      if ((strcmp(dirent->d_name, ".") == 0) ||
+          (strcmp(dirent->d_name, "..") == 0)) {
+        continue;
+      }
+      string path = dir_path;
+      if (path.back() != '/') {
+        path += '/';
+      }
+      path += dirent->d_name;
+      if (stat(path.c_str(), &st) != 0) {
+        continue;
+      }
+      if (S_ISREG(st.st_mode)) {
+        spawn_crawl_task(state, &crawl_file, path);
+      } else if (S_ISDIR(st.st_mode)) {
+        spawn_crawl_task(state, &crawl_dir, path);
+      }
+    }
+    closedir(d);
+  }
+}
+
+static void crawl_file(CrawlState *state, const string &path) {
+  vector<string> words;
+  read_words(path, &words);
+
+  pthread_mutex_lock(&state->index_lock);
+  DocID doc_id = state->index->add_document(path);
+  for (const string &word : words) {
+    if (!word.empty()) {
+      state->index->record(word, doc_id);
     }
   }
+  pthread_mutex_unlock(&state->index_lock);
 }
 
 }  // namespace searchserver
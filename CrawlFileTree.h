@@ -12,6 +12,7 @@
 #ifndef CRAWLFILETREE_H_
 #define CRAWLFILETREE_H_
 
+#include "./ThreadPool.h"
 #include "./WordIndex.h"
 
 #include <string>
@@ -35,6 +36,17 @@ namespace searchserver {
 // - Returns false on failure to scan the directory, true on success.
 bool crawl_filetree(const string& root_dir, WordIndex *index);
 
+// The same as above, but crawls in parallel on the worker threads of
+// "pool", which should be in work-stealing mode (see
+// ThreadPool::set_work_stealing()).  Every directory and every file
+// becomes a task; a directory's task dispatches the tasks for its
+// entries, which land on the crawling worker's own deque, so the
+// crawl fans out as idle workers steal them.  Files are read and
+// split into words in parallel, and only adding the words to "index"
+// is serialized.  Waits for the whole crawl to finish.
+bool crawl_filetree(const string& root_dir, WordIndex *index,
+                    ThreadPool *pool);
+
 
 }  // namespace searchserver
 
@@ -0,0 +1,164 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <arpa/inet.h>   // for IN6_IS_ADDR_V4MAPPED
+#include <netdb.h>       // for getaddrinfo(), getnameinfo()
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <cstring>       // for memset()
+
+#include "./DnsResolver.h"
+
+using std::string;
+
+namespace searchserver {
+
+// The most lookups we let pile up; a client arriving while the queue
+// is this long just gets logged by its IP address.
+static const size_t kMaxPendingLookups = 1024;
+
+bool reverse_dns(const string &addr, string *name) {
+  *name = addr;
+
+  // Turn the printable address back into a sockaddr.  This never
+  // touches DNS because of AI_NUMERICHOST.
+  struct addrinfo hints, *result;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_flags = AI_NUMERICHOST;
+  if (getaddrinfo(addr.c_str(), nullptr, &hints, &result) != 0) {
+    return false;
+  }
+
+  // Look IPv4 clients of an IPv6 socket up by their IPv4 address;
+  // the resolver won't consult /etc/hosts for the mapped form.
+  struct sockaddr_storage ss;
+  socklen_t ss_len = result->ai_addrlen;
+  memcpy(&ss, result->ai_addr, ss_len);
+  freeaddrinfo(result);
+  if (ss.ss_family == AF_INET6) {
+    struct sockaddr_in6 *sa6 = reinterpret_cast<struct sockaddr_in6 *>(&ss);
+    if (IN6_IS_ADDR_V4MAPPED(&sa6->sin6_addr)) {
+      struct sockaddr_in sa4;
+      memset(&sa4, 0, sizeof(sa4));
+      sa4.sin_family = AF_INET;
+      memcpy(&sa4.sin_addr, &sa6->sin6_addr.s6_addr[12], 4);
+      memcpy(&ss, &sa4, sizeof(sa4));
+      ss_len = sizeof(sa4);
+    }
+  }
+
+  char hname[NI_MAXHOST];
+  hname[0] = '\0';
+  int res = getnameinfo(reinterpret_cast<struct sockaddr *>(&ss), ss_len,
+                        hname, sizeof(hname), nullptr, 0, 0);
+  if (res != 0 || hname[0] == '\0') {
+    return false;
+  }
+  *name = hname;
+  return true;
+}
+
+DnsResolver::DnsResolver(size_t max_entries, uint32_t ttl_secs)
+  : max_entries_(max_entries), ttl_secs_(ttl_secs), stop_(false) {
+  pthread_mutex_init(&lock_, nullptr);
+  pthread_cond_init(&cond_, nullptr);
+  pthread_create(&thread_, nullptr, &DnsResolver::resolver_loop,
+                 static_cast<void *>(this));
+}
+
+DnsResolver::~DnsResolver() {
+  pthread_mutex_lock(&lock_);
+  stop_ = true;
+  pthread_cond_signal(&cond_);
+  pthread_mutex_unlock(&lock_);
+  pthread_join(thread_, nullptr);
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&lock_);
+}
+
+bool DnsResolver::lookup(const string &addr, string *name) {
+  time_t now = time(nullptr);
+  pthread_mutex_lock(&lock_);
+  auto it = cache_.find(addr);
+  if (it != cache_.end() && it->second.expires > now) {
+    *name = it->second.name;
+    pthread_mutex_unlock(&lock_);
+    return true;
+  }
+
+  // Missing or stale; have the lookup thread (re)fetch it.
+  if (in_flight_.count(addr) == 0 && pending_.size() < kMaxPendingLookups) {
+    in_flight_.insert(addr);
+    pending_.push_back(addr);
+    pthread_cond_signal(&cond_);
+  }
+  pthread_mutex_unlock(&lock_);
+  *name = addr;
+  return false;
+}
+
+size_t DnsResolver::size() {
+  pthread_mutex_lock(&lock_);
+  size_t size = cache_.size();
+  pthread_mutex_unlock(&lock_);
+  return size;
+}
+
+void *DnsResolver::resolver_loop(void *arg) {
+  DnsResolver *resolver = static_cast<DnsResolver *>(arg);
+
+  pthread_mutex_lock(&resolver->lock_);
+  while (!resolver->stop_) {
+    if (resolver->pending_.empty()) {
+      pthread_cond_wait(&resolver->cond_, &resolver->lock_);
+      continue;
+    }
+    string addr = resolver->pending_.front();
+    resolver->pending_.pop_front();
+
+    // Do the slow part with the lock released.  A failed lookup is
+    // cached as well, so that an address without a name doesn't
+    // send us back to DNS on every connection.
+    pthread_mutex_unlock(&resolver->lock_);
+    string name;
+    reverse_dns(addr, &name);
+    pthread_mutex_lock(&resolver->lock_);
+
+    resolver->insert(addr, name);
+    resolver->in_flight_.erase(addr);
+  }
+  pthread_mutex_unlock(&resolver->lock_);
+  return nullptr;
+}
+
+void DnsResolver::insert(const string &addr, const string &name) {
+  auto it = cache_.find(addr);
+  if (it != cache_.end()) {
+    insertion_order_.erase(it->second.order_it);
+    cache_.erase(it);
+  }
+  while (!cache_.empty() && cache_.size() >= max_entries_) {
+    cache_.erase(insertion_order_.front());
+    insertion_order_.pop_front();
+  }
+  if (max_entries_ == 0) {
+    return;
+  }
+
+  Entry entry;
+  entry.name = name;
+  entry.expires = time(nullptr) + ttl_secs_;
+  entry.order_it = insertion_order_.insert(insertion_order_.end(), addr);
+  cache_[addr] = entry;
+}
+
+}  // namespace searchserver
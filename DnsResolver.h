@@ -0,0 +1,105 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef DNSRESOLVER_H_
+#define DNSRESOLVER_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <time.h>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace searchserver {
+
+// Does a blocking reverse DNS lookup of the printable IP address
+// "addr" (as produced by inet_ntop()).  Returns true and the host
+// name through "name" on success; on failure, returns false and sets
+// "name" to "addr" itself.
+bool reverse_dns(const std::string &addr, std::string *name);
+
+// A DnsResolver does reverse DNS lookups in the background, so that
+// threads which would like a client's host name (e.g., for logging)
+// never have to wait on a slow DNS server.  Results are kept in a
+// cache that holds at most a fixed number of addresses, each for a
+// fixed amount of time.
+class DnsResolver {
+ public:
+  // Creates a resolver and starts its lookup thread.  Arguments:
+  //
+  //  - max_entries: the most addresses the cache holds at a time; when
+  //    it is full, the oldest entry is dropped to make room.
+  //
+  //  - ttl_secs: how long a cached name is used before it is looked
+  //    up again.
+  DnsResolver(size_t max_entries, uint32_t ttl_secs);
+
+  // Stops the lookup thread.  Lookups still queued are dropped.
+  virtual ~DnsResolver();
+
+  // Never blocks on DNS.  If a fresh name for "addr" is cached,
+  // returns true and the name through "name".  Otherwise queues a
+  // background lookup of "addr" (if there isn't one already), sets
+  // "name" to "addr" itself and returns false.
+  bool lookup(const std::string &addr, std::string *name);
+
+  // Returns the number of addresses currently cached.
+  size_t size();
+
+  DnsResolver(const DnsResolver& other) = delete;
+  DnsResolver& operator=(const DnsResolver& other) = delete;
+
+ private:
+  // A cached lookup result.
+  struct Entry {
+    std::string name;
+    time_t expires;
+
+    // Where this address sits in insertion_order_.
+    std::list<std::string>::iterator order_it;
+  };
+
+  // The start routine of the lookup thread.
+  static void *resolver_loop(void *arg);
+
+  // Caches "name" as the result for "addr".  Called with lock_ held.
+  void insert(const std::string &addr, const std::string &name);
+
+  size_t max_entries_;
+  uint32_t ttl_secs_;
+
+  // Guards everything below, and wakes up the lookup thread.
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_;
+
+  std::unordered_map<std::string, Entry> cache_;
+
+  // The cached addresses, oldest first.
+  std::list<std::string> insertion_order_;
+
+  // Addresses waiting to be looked up, and the set of addresses that
+  // are either waiting or being looked up right now.
+  std::deque<std::string> pending_;
+  std::unordered_set<std::string> in_flight_;
+
+  bool stop_;
+  pthread_t thread_;
+};
+
+}  // namespace searchserver
+
+#endif  // DNSRESOLVER_H_
@@ -9,7 +9,10 @@
  * author.
  */
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <string>
 #include <cstdlib>
 #include <iostream>
@@ -36,21 +39,43 @@ bool FileReader::read_file(string *str) {
     return false;
   }
 
-  fseek(fs, 0, SEEK_END); 
-  uint32_t size = ftell(fs);
+  // off_t rather than a 32-bit size, so files over 4GB work.
+  fseeko(fs, 0, SEEK_END);
+  off_t size = ftello(fs);
   rewind(fs);
 
-  char* buffer = new char[size];
-
   if(size > 0) {
-    fread(buffer, sizeof(char), size, fs);
-    // convert char array 
-    *str = string(buffer, size);
+    str->resize(size);
+    size_t got = fread(&(*str)[0], sizeof(char), size, fs);
+    str->resize(got);
     fclose(fs);
-    delete[] buffer;
     return true;
   }
+  fclose(fs);
   return false;
 }
 
+bool FileReader::open_file(int *fd, uint64_t *size) {
+  struct stat st;
+  if (!open_file(fd, &st)) {
+    return false;
+  }
+  *size = st.st_size;
+  return true;
+}
+
+bool FileReader::open_file(int *fd, struct stat *st) {
+  int file_fd = open(fname_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file_fd == -1) {
+    return false;
+  }
+
+  if (fstat(file_fd, st) == -1 || !S_ISREG(st->st_mode)) {
+    close(file_fd);
+    return false;
+  }
+  *fd = file_fd;
+  return true;
+}
+
 }  // namespace searchserver
@@ -12,6 +12,9 @@
 #ifndef FILEREADER_H_
 #define FILEREADER_H_
 
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <cstdint>
 #include <string>
 
 namespace searchserver {
@@ -31,6 +34,17 @@ class FileReader {
   // the file contents through "str".
   bool read_file(std::string *str);
 
+  // Opens the file for reading without reading it in, so that it can
+  // be sent with sendfile().  Returns false if the file is missing or
+  // isn't a regular file.  Otherwise returns true, the open file
+  // descriptor through "fd" and the file's size through "size"; the
+  // caller is responsible for close()'ing fd.
+  bool open_file(int *fd, uint64_t *size);
+
+  // The same as above, but returns everything fstat() says about the
+  // file through "st" instead of just its size.
+  bool open_file(int *fd, struct stat *st);
+
  private:
   std::string fname_;
 };
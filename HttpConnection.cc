@@ -9,9 +9,14 @@
  * author.
  */
 
+#include <cctype>
 #include <cstdint>
-#include <boost/algorithm/string.hpp>
-#include <boost/lexical_cast.hpp>
+#include <cstring>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 #include <map>
 #include <string>
 #include <vector>
@@ -29,8 +34,14 @@ using std::endl;
 
 namespace searchserver {
 
-static const char *kHeaderEnd = "\r\n\r\n";
-static const int kHeaderEndLen = 4;
+// static
+const size_t HttpConnection::kDefaultMaxHeaderBytes = 8192;
+
+static const size_t kHeaderEndLen = 4;
+static const int kReadChunkSize = 1024;
+
+// Returns the CLOCK_MONOTONIC time in milliseconds.
+static int64_t NowMs();
 
   // Use "wrapped_read" to read data into the buffer_
   // instance variable.  Keep reading data until either the
@@ -48,59 +59,320 @@ static const int kHeaderEndLen = 4;
   // TODO: implement
 
 bool HttpConnection::next_request(HttpRequest *request) {
-    
-  uint16_t index;
-  // check to see if anything exists in buffer. check if content is already loaded and if a full request exists
-  if(buffer_.find(kHeaderEnd) == string::npos) {
-    while (1) {
-      int res = wrapped_read(fd_,&buffer_);
-
-      if (res == 0) { // checking EOF
-        break; 
-      } else if (res < 0) { // checking error
-        return false;
-      } else { // if header is found
-        if(buffer_.find(kHeaderEnd) != string::npos) {
-          break;
-        }
-        continue;
-      }
+  // Keep reading until a whole request header is buffered.  Each pass
+  // only scans the bytes that just arrived for the "\r\n\r\n".
+  while (!find_request_end()) {
+    if (header_too_large_ || !prepare_read()) {
+      return false;
+    }
+    int res = wrapped_read(fd_, &buffer_);
+    if (res == 0) {  // checking EOF
+      break;
+    } else if (res < 0) {  // checking error
+      return false;
+    }
+  }
+  return next_buffered_request(request);
+}
+
+bool HttpConnection::next_buffered_request(HttpRequest *request) {
+  if (!find_request_end()) {
+    return false;
+  }
+  bool ok = parse_request(buffer_.data() + buffer_start_,
+                          header_end_ - buffer_start_, request);
+  buffer_start_ = header_end_ + kHeaderEndLen;
+  scan_pos_ = buffer_start_;
+  header_end_ = string::npos;
+  header_deadline_ms_ = 0;
+  num_requests_++;
+
+  // Drop the parsed requests once they're half of the buffer, so that
+  // each byte is moved at most once on average.
+  if (buffer_start_ == buffer_.size()) {
+    buffer_.clear();
+    buffer_start_ = scan_pos_ = 0;
+  } else if (buffer_start_ >= buffer_.size() / 2) {
+    buffer_.erase(0, buffer_start_);
+    buffer_start_ = scan_pos_ = 0;
+  }
+  return ok;
+}
+
+bool HttpConnection::find_request_end() {
+  if (header_end_ != string::npos) {
+    return true;
+  }
+  if (header_too_large_) {
+    return false;
+  }
+  header_end_ = find_header_end(buffer_.data(), buffer_.size(), scan_pos_);
+  if (header_end_ == string::npos) {
+    // Only the last three bytes could still start a terminator.
+    if (buffer_.size() > scan_pos_ + 3) {
+      scan_pos_ = buffer_.size() - 3;
     }
-  }  
-  index = buffer_.find(kHeaderEnd);
-  if (index == string::npos) {
+    header_too_large_ = buffer_.size() - buffer_start_ >= max_header_bytes_;
     return false;
   }
-  string temp = buffer_.substr(0,index);
-  parse_request(temp, request);
-  buffer_.erase(0,index + kHeaderEndLen);
+  if (header_end_ + kHeaderEndLen - buffer_start_ > max_header_bytes_) {
+    header_end_ = string::npos;
+    header_too_large_ = true;
+    return false;
+  }
+  return true;
+}
+
+bool HttpConnection::set_timeouts(int header_ms, int idle_ms,
+                                  int write_ms) {
+  header_timeout_ms_ = header_ms;
+  idle_timeout_ms_ = idle_ms;
+  write_timeout_ms_ = write_ms;
+  read_timeout_ms_ = idle_ms;
+  return set_socket_timeouts(fd_, read_timeout_ms_, write_timeout_ms_);
+}
+
+bool HttpConnection::prepare_read() {
+  int timeout_ms = idle_timeout_ms_;
+  if (buffer_.size() > buffer_start_ && header_timeout_ms_ > 0) {
+    // Part of a request is here; the rest has to follow in time.
+    int64_t now = NowMs();
+    if (header_deadline_ms_ == 0) {
+      header_deadline_ms_ = now + header_timeout_ms_;
+    }
+    if (now >= header_deadline_ms_) {
+      return false;
+    }
+    timeout_ms = static_cast<int>(header_deadline_ms_ - now);
+  }
+  if (timeout_ms == read_timeout_ms_) {
+    return true;
+  }
+  read_timeout_ms_ = timeout_ms;
+  return set_socket_timeouts(fd_, read_timeout_ms_, write_timeout_ms_);
+}
+
+bool HttpConnection::read_available() {
+  char buf[kReadChunkSize];
+  while (buffer_.size() - buffer_start_ < max_header_bytes_) {
+    ssize_t res = read(fd_, buf, kReadChunkSize);
+    if (res > 0) {
+      buffer_.append(buf, res);
+      continue;
+    }
+    if (res == 0) {  // the client closed its end
+      return false;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    // Nothing more to read right now is the only non-fatal error.
+    return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+  }
+  // The rest waits in the socket until the buffered requests have
+  // been answered; epoll reports fd_ as readable again then.
   return true;
 }
-      
 
 bool HttpConnection::write_response(const HttpResponse &response) {
-  // Implement so that the response is converted to a string
-  // and written out to the socket for this connection
-  // TODO: implement
-  string output = response.GenerateResponseString();
+  // Hand the status line, headers and body to writev() as separate
+  // pieces, so the body isn't copied in behind the header.
+  string status_line, headers;
+  struct iovec iov[HttpResponse::kMaxIovecs];
+  int iovcnt = response.GenerateIovecs(&status_line, &headers, iov);
+  int64_t len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+  if (wrapped_writev(fd_, iov, iovcnt) != len) {
+    return false;
+  }
+
+  if (!response.has_body_file()) {
+    return true;
+  }
+
+  // Have the kernel copy each window of the file straight from the
+  // page cache to the socket.
+  for (const BodyFilePart &part : response.body_file_parts()) {
+    if (!part.prefix.empty() &&
+        wrapped_write(fd_, part.prefix) !=
+        static_cast<int>(part.prefix.size())) {
+      return false;
+    }
+    if (part.length > 0 &&
+        wrapped_sendfile(fd_, response.body_file()->fd(), part.offset,
+                         part.length) != static_cast<int64_t>(part.length)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool HttpConnection::write_response_and_next_request(
+    const HttpResponse &response, HttpRequest *request) {
+  // There is no linked sendfile, so file bodies take the slow path.
+  if (response.has_body_file()) {
+    return write_response(response) && next_request(request);
+  }
+
+  // A pipelining client may have sent the next request already, in
+  // which case there is nothing to read.
+  if (find_request_end() || header_too_large_) {
+    return write_response(response) && next_buffered_request(request);
+  }
+
+  if (!prepare_read()) {
+    return false;
+  }
+  string status_line, headers;
+  struct iovec iov[HttpResponse::kMaxIovecs];
+  int iovcnt = response.GenerateIovecs(&status_line, &headers, iov);
+  int res = wrapped_writev_read(fd_, iov, iovcnt, &buffer_);
+  if (res < 0) {
+    return false;
+  }
+  if (res == 0) {  // the client hung up
+    return next_buffered_request(request);
+  }
+  return next_request(request);
+}
+
+bool HttpConnection::write_pending_and_next_request(HttpRequest *request) {
+  // With nothing but bytes to send and nothing buffered to parse, the
+  // write and the read after it can go out together.
+  struct iovec iov[kFlushIovecs];
+  int iovcnt = output_iovecs(iov);
+  if (iovcnt > 0 && static_cast<size_t>(iovcnt) == out_queue_.size() &&
+      !find_request_end() && !header_too_large_) {
+    if (!prepare_read()) {
+      return false;
+    }
+    int res = wrapped_writev_read(fd_, iov, iovcnt, &buffer_);
+    out_queue_.clear();
+    if (res < 0) {
+      return false;
+    }
+    if (res == 0) {  // the client hung up
+      return next_buffered_request(request);
+    }
+    return next_request(request);
+  }
 
-  if (output.length() == 0) {
+  // fd_ blocks, so flush_pending() only stops early on an error.
+  if (!flush_pending() || has_pending_output()) {
     return false;
   }
-  
-  while(1) {
-    int wres = wrapped_write(fd_, output);
+  return next_request(request);
+}
+
+void HttpConnection::queue_response(HttpResponse response) {
+  // The response may be gone by the time the bytes are sent, so the
+  // queue takes them over instead of pointing into the response.
+  if (response.serialized() != nullptr) {
+    PendingOutput out;
+    out.shared = response.serialized();
+    out.bytes_sent = 0;
+    out.file_offset = 0;
+    out.file_remaining = 0;
+    out_queue_.push_back(std::move(out));
+    return;
+  }
+  queue_bytes(response.GenerateHeaderString());
+  if (!response.has_body_file()) {
+    queue_bytes(response.TakeBody());
+    return;
+  }
+
+  for (const BodyFilePart &part : response.body_file_parts()) {
+    queue_bytes(part.prefix);
+    if (part.length > 0) {
+      PendingOutput out;
+      out.bytes_sent = 0;
+      out.file = response.body_file();
+      out.file_offset = part.offset;
+      out.file_remaining = part.length;
+      out_queue_.push_back(std::move(out));
+    }
+  }
+}
+
+void HttpConnection::queue_bytes(string bytes) {
+  if (bytes.empty()) {
+    return;
+  }
+  PendingOutput out;
+  out.bytes = std::move(bytes);
+  out.bytes_sent = 0;
+  out.file_offset = 0;
+  out.file_remaining = 0;
+  out_queue_.push_back(std::move(out));
+}
+
+int HttpConnection::output_iovecs(struct iovec *iov) const {
+  int iovcnt = 0;
+  for (const PendingOutput &out : out_queue_) {
+    if (out.file != nullptr || iovcnt == kFlushIovecs) {
+      break;
+    }
+    iov[iovcnt].iov_base = const_cast<char *>(out.data().data()) +
+                           out.bytes_sent;
+    iov[iovcnt++].iov_len = out.data().size() - out.bytes_sent;
+  }
+  return iovcnt;
+}
 
-      if(wres  == -1) {
-        if (errno == EINTR) {
-          continue;
+void HttpConnection::consume_output(size_t len) {
+  while (len > 0) {
+    PendingOutput &out = out_queue_.front();
+    size_t left = out.data().size() - out.bytes_sent;
+    if (len < left) {
+      out.bytes_sent += len;
+      return;
+    }
+    len -= left;
+    out_queue_.pop_front();
+  }
+}
+
+bool HttpConnection::flush_pending() {
+  while (!out_queue_.empty()) {
+    PendingOutput &out = out_queue_.front();
+    ssize_t res;
+    if (out.file != nullptr) {
+      res = sendfile(fd_, out.file->fd(), &out.file_offset,
+                     out.file_remaining);
+      if (res > 0) {
+        out.file_remaining -= res;
+        if (out.file_remaining == 0) {
+          out_queue_.pop_front();
         }
-          // close(fd_);
-          return false;
       }
+    } else {
+      // Hand the whole run of bytes up to the next file to writev().
+      struct iovec iov[kFlushIovecs];
+      int iovcnt = output_iovecs(iov);
+      res = writev(fd_, iov, iovcnt);
+      if (res > 0) {
+        consume_output(res);
+      }
+    }
+
+    if (res > 0) {
+      continue;
+    }
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1 && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      // The socket buffer is full; the rest goes out once the event
+      // loop reports fd_ as writable again.
       break;
+    }
+    // A zero-byte sendfile() means the file shrank; we can't make up
+    // the Content-length we promised, so give up on the connection.
+    return false;
   }
-
   return true;
 }
 
@@ -111,52 +383,97 @@ bool HttpConnection::write_response(const HttpResponse &response) {
   // at HttpRequest.h for details about the HTTP header format that
   // you need to parse.
   //
-  // You'll probably want to look up boost functions for (a) splitting
-  // a string into lines on a "\r\n" delimiter, (b) trimming
-  // whitespace from the end of a string, and (c) converting a string
-  // to lowercase.
-  //
   // If a request is malformed, return false, otherwise true and 
   // the parsed request is returned via *out
-  
-  // TODO: implement
+  //
+  // Rather than splitting the request into strings, we work in place
+  // on the request's own copy of the text and hand it the offsets of
+  // the pieces, so that parsing doesn't allocate.
+
+static int64_t NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool IsSpace(char c) {
+  return isspace(static_cast<unsigned char>(c)) != 0;
+}
+
+static bool IsLineEnd(char c) {
+  return c == '\r' || c == '\n';
+}
 
-bool HttpConnection::parse_request(const string &request, HttpRequest* out) {
-  HttpRequest req("/");  // by default, get "/". //setting parameter
-  
-  string requestCopy(request);
+// Returns the offset of the first line end in data[pos, len), or len.
+static size_t FindLineEnd(const char *data, size_t pos, size_t len) {
+  while (pos < len && !IsLineEnd(data[pos])) {
+    pos++;
+  }
+  return pos;
+}
 
-  if (request.length() == 0) {
+bool HttpConnection::parse_request(const char *data, size_t len,
+                                   HttpRequest *out) {
+  char *req = out->reset(data, len);
+
+  // Skip any whitespace in front of the request line, then pick the
+  // URI out of "GET [URI] [http_protocol]".
+  size_t pos = 0;
+  while (pos < len && IsSpace(req[pos])) {
+    pos++;
+  }
+  size_t line_end = FindLineEnd(req, pos, len);
+  while (pos < line_end && !IsSpace(req[pos])) {  // the method
+    pos++;
+  }
+  while (pos < line_end && IsSpace(req[pos])) {
+    pos++;
+  }
+  size_t uri_start = pos;
+  while (pos < line_end && !IsSpace(req[pos])) {
+    pos++;
+  }
+  if (pos == uri_start) {
     return false;
   }
+  out->set_uri_at(uri_start, pos - uri_start);
 
-  boost::algorithm::trim(requestCopy);
-  vector<string> reqComponents;
-  boost::split(reqComponents, requestCopy, boost::is_any_of("\r\n"), boost::token_compress_on);
-  
-  std::vector<string> URLComponents;
-  boost::split(URLComponents, reqComponents[0], boost::is_any_of(" "), boost::token_compress_on);
-  req.set_uri(URLComponents[1]);
-  std::vector<string> headerComponents;
-  
-  for(uint16_t i = 1; i < reqComponents.size(); i++) {
-    string currLine = reqComponents[i];
-    boost::to_lower(currLine);
-    uint16_t len = currLine.length();
-    size_t index = currLine.find(":");
-    if (index == std::string::npos) {
+  // Every other non-blank line with a ':' in it is a header.  Header
+  // lines are lowercased, so names and values can be compared without
+  // worrying about case.
+  for (pos = line_end; pos < len; pos = line_end) {
+    if (IsLineEnd(req[pos])) {
+      line_end = pos + 1;
       continue;
     }
-    if(currLine == "\r\n") {
-      break;
+    line_end = FindLineEnd(req, pos, len);
+    for (size_t i = pos; i < line_end; i++) {
+      req[i] = tolower(static_cast<unsigned char>(req[i]));
+    }
+    const char *colon =
+      static_cast<const char *>(memchr(req + pos, ':', line_end - pos));
+    if (colon == nullptr) {
+      continue;
+    }
+
+    // Trim the whitespace around the name and the value.
+    size_t name_start = pos, name_end = colon - req;
+    size_t value_start = name_end + 1, value_end = line_end;
+    while (name_start < name_end && IsSpace(req[name_start])) {
+      name_start++;
+    }
+    while (name_end > name_start && IsSpace(req[name_end - 1])) {
+      name_end--;
+    }
+    while (value_start < value_end && IsSpace(req[value_start])) {
+      value_start++;
+    }
+    while (value_end > value_start && IsSpace(req[value_end - 1])) {
+      value_end--;
     }
-    string key = currLine.substr(0, index);
-    string val = currLine.substr(index+1, (len - 4));
-    boost::algorithm::trim(key);
-    boost::algorithm::trim(val);
-    req.AddHeader(key, val);
+    out->AddHeaderAt(name_start, name_end - name_start,
+                     value_start, value_end - value_start);
   }
-  *out = req;
   return true;
 }
 
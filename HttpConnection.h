@@ -14,7 +14,9 @@
 
 #include <cstdint>
 #include <unistd.h>
+#include <deque>
 #include <map>
+#include <memory>
 #include <string>
 
 #include "./HttpRequest.h"
@@ -28,7 +30,12 @@ class HttpConnection {
  
   // Constructs a new HttpConnection to handle the
   // connection to a client on the represented file descriptor
-  explicit HttpConnection(int fd) : fd_(fd) { }
+  explicit HttpConnection(int fd)
+    : fd_(fd), buffer_start_(0), scan_pos_(0), header_end_(std::string::npos),
+      max_header_bytes_(kDefaultMaxHeaderBytes), header_too_large_(false),
+      header_timeout_ms_(0), idle_timeout_ms_(0), write_timeout_ms_(0),
+      read_timeout_ms_(0), header_deadline_ms_(0), max_requests_(0),
+      num_requests_(0) { }
   
   // closes the connection to the client if it is still open
   virtual ~HttpConnection() {
@@ -38,6 +45,43 @@ class HttpConnection {
     fd_ = -1;
   }
 
+  // The default for set_max_header_bytes().
+  static const size_t kDefaultMaxHeaderBytes;
+
+  // Sets how many bytes a request header, up to and including the
+  // blank line that ends it, may take up.  A client that sends a
+  // bigger one gets no request out of next_request() or
+  // next_buffered_request(), and header_too_large() becomes true.
+  // This also bounds how much of a request we buffer.
+  void set_max_header_bytes(size_t bytes) { max_header_bytes_ = bytes; }
+
+  // Returns true once the client has sent a request header bigger
+  // than the limit, in which case the caller should answer with a
+  // 431 and close the connection.
+  bool header_too_large() const { return header_too_large_; }
+
+  // Bounds how long the blocking calls below wait on the client, so
+  // that a slow or idle client can't hold a thread forever.  Once a
+  // request has started to arrive, all of its header must be in
+  // within "header_ms" milliseconds.  Between requests, the client
+  // may stay silent for at most "idle_ms".  A write that makes no
+  // progress for "write_ms" fails.  When a timeout expires, the call
+  // waiting on it returns false.  Zero means no timeout, which is the
+  // default for all three.  Returns false if the timeouts couldn't be
+  // put on the socket.
+  bool set_timeouts(int header_ms, int idle_ms, int write_ms);
+
+  // Sets how many requests next_request() and next_buffered_request()
+  // hand out before request_limit_reached() becomes true, after which
+  // the caller should close the connection once it has answered the
+  // last one.  Zero, the default, means no limit.
+  void set_max_requests(uint32_t max_requests) {
+    max_requests_ = max_requests;
+  }
+  bool request_limit_reached() const {
+    return max_requests_ > 0 && num_requests_ >= max_requests_;
+  }
+
   // Read and parse the next request from the file descriptor fd_,
   // storing the state in the output parameter "request."  Returns
   // true if a request could be read, false if the parsing failed
@@ -47,15 +91,99 @@ class HttpConnection {
 
   // Write the response to the file descriptor fd_.  Returns true
   // if the response was successfully written, false if the
-  // connection experiences an error and should be closed.
+  // connection experiences an error and should be closed.  The
+  // header and a string body go out together with writev(); a
+  // file-backed body is sent with sendfile() after the header.
   bool write_response(const HttpResponse &response);
 
+  // Write the response to fd_, then read and parse the client's next
+  // request into "request", just like write_response() followed by
+  // next_request().  Doing both in one call lets the io_uring backend
+  // submit the write and the read as a single linked pair.  Returns
+  // false if either half fails, in which case the caller should
+  // close the connection.
+  bool write_response_and_next_request(const HttpResponse &response,
+                                       HttpRequest *request);
+
+  // Write everything queued with queue_response() to fd_, blocking
+  // until it has all been sent, then read and parse the client's next
+  // request into "request" like next_request().  Lets a client that
+  // pipelines its requests have all of the responses to the requests
+  // it already sent go out in one write.  As with
+  // write_response_and_next_request(), the io_uring backend submits
+  // the write and the read as a linked pair when it can.  Returns
+  // false if either half fails, in which case the caller should close
+  // the connection.
+  bool write_pending_and_next_request(HttpRequest *request);
+
+  // The functions below let an event loop drive the connection as a
+  // resumable state machine instead of parking a thread inside
+  // next_request().  They assume fd_ has been put into non-blocking
+  // mode and never wait for the socket to become ready.
+
+  // Read whatever data is currently available on fd_ into buffer_,
+  // stopping once the read would block or buffer_ holds more than a
+  // request header may take up.  Returns false if the client
+  // closed the connection or the read failed, in which case any data
+  // that did arrive is still kept in buffer_.
+  bool read_available();
+
+  // If buffer_ already holds a complete request header, parse it into
+  // "request", remove it from buffer_ and return true.  Returns false
+  // without reading from fd_ if no complete request is buffered yet.
+  bool next_buffered_request(HttpRequest *request);
+
+  // Append the response to the output that is waiting to be sent.
+  // Nothing is copied: a prebuilt response is shared, a string body
+  // is moved out of "response", and a file body is sent with
+  // sendfile() when its turn comes.
+  void queue_response(HttpResponse response);
+
+  // Write as much of the queued output as fd_ accepts without
+  // blocking.  Returns false if the connection experienced an error
+  // and should be closed; use has_pending_output() to find out
+  // whether the caller needs to wait for fd_ to become writable.
+  bool flush_pending();
+
+  // Returns true if queued output is still waiting to be sent.
+  bool has_pending_output() const { return !out_queue_.empty(); }
+
  private:
-  // A helper function to parse the contents of data read from
-  // the HTTP connection. Returns true if the request was parsed
+  // A helper function to parse the "len" bytes of data read from the
+  // HTTP connection at "data". Returns true if the request was parsed
   // successfully and that request is returned through *request
   // and returns false if the Request is an invalid format
-  bool parse_request(const std::string &request, HttpRequest *out);
+  bool parse_request(const char *data, size_t len, HttpRequest *out);
+
+  // Looks for the end of the next request header in buffer_, picking
+  // up the search where the last one stopped, so that a header that
+  // trickles in is only scanned once.  Returns true if a complete
+  // header is buffered, in which case header_end_ is its "\r\n\r\n".
+  // Sets header_too_large_ if the header is, or is going to be, over
+  // the limit.
+  bool find_request_end();
+
+  // Gets the socket ready for a blocking read of the next request: its
+  // read timeout is set to the idle timeout if none of the request has
+  // arrived yet, and otherwise to what is left of the header timeout.
+  // Returns false if the header timeout has already run out.
+  bool prepare_read();
+
+  // Appends "bytes" to the end of the queued output, unless it is
+  // empty.
+  void queue_bytes(std::string bytes);
+
+  // The most pieces of queued output that go out in a single writev().
+  static const int kFlushIovecs = 16;
+
+  // Points "iov", which has room for kFlushIovecs iovecs, at the
+  // unsent bytes at the front of the queue, up to the first file.
+  // Returns the number of iovecs filled in.
+  int output_iovecs(struct iovec *iov) const;
+
+  // Drops the first "len" bytes of queued output, which writev() has
+  // sent.
+  void consume_output(size_t len);
 
   // The file descriptor associated with the client.
   int fd_;
@@ -64,6 +192,55 @@ class HttpConnection {
   // Used for the case where we read more data than we need to process a request
   // store the excess data read into the buffer so that next time we read, we can parse from here
   std::string buffer_;
+
+  // Where the unparsed data in buffer_ starts.  Parsed requests are
+  // only dropped from the front of buffer_ once they make up half of
+  // it, so that pipelined requests aren't shifted down one at a time.
+  size_t buffer_start_;
+
+  // How far into buffer_ find_request_end() has already looked for a
+  // terminator, and where it found one (or std::string::npos).
+  size_t scan_pos_;
+  size_t header_end_;
+
+  size_t max_header_bytes_;
+  bool header_too_large_;
+
+  // The timeouts from set_timeouts(), the read timeout currently set
+  // on the socket, and the CLOCK_MONOTONIC time (in milliseconds) by
+  // which the request being read has to be in, or 0 if none of it
+  // has arrived yet.
+  int header_timeout_ms_;
+  int idle_timeout_ms_;
+  int write_timeout_ms_;
+  int read_timeout_ms_;
+  int64_t header_deadline_ms_;
+
+  uint32_t max_requests_;
+  uint32_t num_requests_;
+
+  // A piece of queued output: either some bytes, of which the first
+  // "bytes_sent" have already been written, or a range of a
+  // response's body file that still has to be sent with sendfile().
+  // The bytes are held in "bytes", or shared through "shared" when
+  // they are a prebuilt response.
+  struct PendingOutput {
+    std::string bytes;
+    std::shared_ptr<const std::string> shared;
+    size_t bytes_sent;
+    std::shared_ptr<ResponseFile> file;
+    off_t file_offset;
+    uint64_t file_remaining;
+
+    const std::string &data() const {
+      return (shared != nullptr) ? *shared : bytes;
+    }
+  };
+
+  // Responses queued by queue_response() that have not been written
+  // to the client yet, in order.  Runs of bytes go out together in a
+  // single writev().
+  std::deque<PendingOutput> out_queue_;
 };
 
 }  // namespace searchserver
@@ -12,10 +12,12 @@
 #ifndef HTTPREQUEST_H_
 #define HTTPREQUEST_H_
 
+#include <strings.h>  // for strncasecmp()
 #include <cstdint>
 
-#include <map>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace searchserver {
 
@@ -37,47 +39,146 @@ namespace searchserver {
 //
 class HttpRequest {
  public:
-  HttpRequest() { }
-  explicit HttpRequest(const std::string &uri)
-    : uri_(uri) { }
+  HttpRequest() : num_headers_(0) { }
+  explicit HttpRequest(const std::string &uri) : num_headers_(0) {
+    set_uri(uri);
+  }
   virtual ~HttpRequest() { }
 
-  const std::string& uri() const { return uri_; }
-  void set_uri(const std::string& uri) { uri_ = uri; }
+  // The URI, and header names and values, are views into raw_, so
+  // they stay valid until the request is next changed.
+  std::string_view uri() const { return view(uri_); }
+  void set_uri(std::string_view uri) { uri_ = append(uri); }
 
   // Returns the value associated with the passed-in header name, or empty
-  // string if it does not exist in the header map.  The passed-in name must
-  // be entirely lowercase to comply with our implementation of RFC 2616:4.2.
-  std::string GetHeaderValue(const std::string &name) const {
-    std::map<std::string, std::string>::const_iterator it = headers_.find(name);
-    if (it == headers_.end()) {
-      return "";
-    } else {
-      return it->second;
-    }
+  // string if it does not exist in the header map.  Header names are
+  // case-insensitive (RFC 2616:4.2).
+  std::string_view GetHeaderValue(std::string_view name) const {
+    const Header *h = find_header(name);
+    return (h == nullptr) ? std::string_view() : view(h->value);
   }
 
   // Adds a name -> value mapping to the header map, over-writing any existing
   // previous mapping for name.
-  void AddHeader(const std::string &name, const std::string &value) {
-    headers_[name] = value;
+  void AddHeader(std::string_view name, std::string_view value) {
+    Slice n = append(name), v = append(value);
+    add_header(n, v);
   }
 
   // Returns the number of headers this HttpRequest contains
-  int GetHeaderCount() {
-    return headers_.size();
+  int GetHeaderCount() const {
+    return num_headers_;
+  }
+
+  // The methods below let a parser build a request without copying
+  // each piece out of the raw request text.
+
+  // Empties the request and copies "len" bytes of raw request text
+  // into it, returning a pointer to the copy.  The parser may modify
+  // the copy in place (e.g., to lowercase header names), and then
+  // picks pieces out of it with set_uri_at() and AddHeaderAt().  A
+  // request that is reused keeps its storage, so parsing into it
+  // doesn't allocate once the storage is big enough.
+  char *reset(const char *data, size_t len) {
+    raw_.assign(data, len);
+    uri_ = Slice();
+    num_headers_ = 0;
+    more_headers_.clear();
+    return &raw_[0];
+  }
+
+  // Makes the URI the "len" bytes of the raw text at "offset".
+  void set_uri_at(size_t offset, size_t len) {
+    uri_ = Slice(offset, len);
+  }
+
+  // Like AddHeader(), but the name and value are pieces of the raw
+  // text.
+  void AddHeaderAt(size_t name_offset, size_t name_len,
+                   size_t value_offset, size_t value_len) {
+    add_header(Slice(name_offset, name_len), Slice(value_offset, value_len));
   }
 
  private:
+  // A piece of raw_.  Offsets rather than pointers, so that copies of
+  // a request don't point into the original's storage.
+  struct Slice {
+    Slice() : offset(0), len(0) { }
+    Slice(size_t o, size_t l)
+      : offset(static_cast<uint32_t>(o)), len(static_cast<uint32_t>(l)) { }
+    uint32_t offset;
+    uint32_t len;
+  };
+
+  struct Header {
+    Slice name;
+    Slice value;
+  };
+
+  // How many headers are stored inline; any more go in more_headers_.
+  static const int kInlineHeaders = 16;
+
+  std::string_view view(Slice s) const {
+    return std::string_view(raw_.data() + s.offset, s.len);
+  }
+
+  // Copies "str" onto the end of raw_ and returns where it went.
+  Slice append(std::string_view str) {
+    Slice s(raw_.size(), str.size());
+    raw_.append(str.data(), str.size());
+    return s;
+  }
+
+  Header *header(int i) {
+    return (i < kInlineHeaders) ? &headers_[i] :
+                                  &more_headers_[i - kInlineHeaders];
+  }
+  const Header *header(int i) const {
+    return (i < kInlineHeaders) ? &headers_[i] :
+                                  &more_headers_[i - kInlineHeaders];
+  }
+
+  const Header *find_header(std::string_view name) const {
+    for (int i = 0; i < num_headers_; i++) {
+      const Header *h = header(i);
+      if (h->name.len == name.size() &&
+          strncasecmp(raw_.data() + h->name.offset, name.data(),
+                      name.size()) == 0) {
+        return h;
+      }
+    }
+    return nullptr;
+  }
+
+  void add_header(Slice name, Slice value) {
+    Header *h = const_cast<Header *>(find_header(view(name)));
+    if (h != nullptr) {
+      h->value = value;
+      return;
+    }
+    if (num_headers_ < kInlineHeaders) {
+      h = &headers_[num_headers_];
+    } else {
+      more_headers_.push_back(Header());
+      h = &more_headers_.back();
+    }
+    h->name = name;
+    h->value = value;
+    num_headers_++;
+  }
+
+  // The request text that the URI and headers point into.
+  std::string raw_;
+
   // Which URI did the client request?
-  std::string uri_;
-
-  // A map from header name to header value, representing
-  // all of the headers that the client supplied to us.  The
-  // header names are converted to all lower case since RFC
-  // 2616:4.2 states that header names are case-insensitive;
-  // the header values are retained verbatim.
-  std::map<std::string, std::string> headers_;
+  Slice uri_;
+
+  // All of the headers that the client supplied to us, in a flat
+  // array: the first kInlineHeaders in headers_, the rest in
+  // more_headers_.
+  Header headers_[kInlineHeaders];
+  std::vector<Header> more_headers_;
+  int num_headers_;
 };
 
 }  // namespace searchserver
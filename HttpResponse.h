@@ -12,11 +12,18 @@
 #ifndef HTTPRESPONSE_H_
 #define HTTPRESPONSE_H_
 
+#include <errno.h>
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include <map>
+#include <memory>
 #include <string>
 #include <sstream>
+#include <utility>
+#include <vector>
 
 namespace searchserver {
 
@@ -41,6 +48,40 @@ namespace searchserver {
 // Content-length: 10\r\n
 // \r\n
 // Hi there!!
+//
+// Instead of a string, the body can be one or more ranges of an open
+// file (see set_body_file() and set_body_file_parts()).  Customers
+// that can should then write out GenerateHeaderString() and send the
+// file with sendfile(), as HttpConnection does, so that the file is
+// never copied into memory.
+// Likewise, GenerateIovecs() lets a string body be written out with
+// writev() instead of being copied in behind the header.
+
+// An open file descriptor that is closed when the last response
+// referring to it goes away.
+class ResponseFile {
+ public:
+  explicit ResponseFile(int fd) : fd_(fd) { }
+  virtual ~ResponseFile() { close(fd_); }
+
+  int fd() const { return fd_; }
+
+  ResponseFile(const ResponseFile& other) = delete;
+  ResponseFile& operator=(const ResponseFile& other) = delete;
+
+ private:
+  int fd_;
+};
+
+// One piece of a file-backed body: the bytes in "prefix", followed by
+// "length" bytes of the file starting at "offset".  Several of these
+// make up a multipart/byteranges body, with each part's headers in
+// its prefix.
+struct BodyFilePart {
+  std::string prefix;
+  off_t offset;
+  uint64_t length;
+};
 
 class HttpResponse {
  public:
@@ -52,28 +93,183 @@ class HttpResponse {
   void set_message(const std::string &msg) { message_ = msg; }
   void set_content_type(const std::string &type) { content_type_ = type; }
 
+  // Adds a "name: value" header line.  The headers are sent in the
+  // order they were added, after Content-type and before
+  // Content-length.
+  void AddHeader(const std::string &name, const std::string &value) {
+    headers_.push_back(std::make_pair(name, value));
+  }
+
   void AppendToBody(const std::string &body_fragment) {
     body_ += body_fragment;
   }
 
-  // A method to generate a std::string of the HTTP response, suitable
-  // for writing back to the client.  We automatically generate the
-  // "Content-length:" header, and make that be the last header
-  // in the block.  The value of the Content-length header is the
-  // size of the response body (in bytes).
-  std::string GenerateResponseString() const {
-    std::stringstream resp;
+  // Makes the body "length" bytes of the open file "fd", starting at
+  // "offset", in place of anything appended with AppendToBody().  The
+  // response takes ownership of fd; it is closed once the response
+  // and all its copies are gone.
+  void set_body_file(int fd, off_t offset, uint64_t length) {
+    BodyFilePart part;
+    part.offset = offset;
+    part.length = length;
+    set_body_file_parts(fd, std::vector<BodyFilePart>(1, part));
+  }
+
+  // Like set_body_file(), but the body is made up of "parts", one
+  // after the other.
+  void set_body_file_parts(int fd, const std::vector<BodyFilePart> &parts) {
+    body_file_ = std::make_shared<ResponseFile>(fd);
+    body_file_parts_ = parts;
+  }
+
+  // Returns true if the body comes from a file, in which case
+  // body_file() and body_file_parts() say which bytes of which file.
+  bool has_body_file() const { return body_file_ != nullptr; }
+  const std::shared_ptr<ResponseFile> &body_file() const {
+    return body_file_;
+  }
+  const std::vector<BodyFilePart> &body_file_parts() const {
+    return body_file_parts_;
+  }
+
+  // Makes the response exactly the bytes in "serialized", a response
+  // that was already generated (e.g., one kept by StaticFileCache).
+  // Everything else set on the response is then ignored, and a body
+  // file is let go of, so that it isn't sent again after the bytes.
+  void set_serialized(std::shared_ptr<const std::string> serialized) {
+    serialized_ = serialized;
+    body_file_ = nullptr;
+    body_file_parts_.clear();
+  }
+
+  // Returns the bytes given to set_serialized(), or nullptr.
+  const std::shared_ptr<const std::string> &serialized() const {
+    return serialized_;
+  }
 
+  // Hands over the string body, leaving the response without one.
+  // The header has to be generated first, since Content-length is
+  // worked out from the body.
+  std::string TakeBody() {
+    std::string body;
+    body.swap(body_);
+    return body;
+  }
+
+  // Returns the size of the response body in bytes.
+  uint64_t body_length() const {
+    if (!has_body_file()) {
+      return body_.size();
+    }
+    uint64_t length = 0;
+    for (const BodyFilePart &part : body_file_parts_) {
+      length += part.prefix.size() + part.length;
+    }
+    return length;
+  }
+
+  // Generates the status line, e.g. "HTTP/1.1 200 OK\r\n".
+  std::string GenerateStatusLine() const {
+    std::stringstream resp;
     resp << protocol_ << " " << response_code_ << " " << message_ << "\r\n";
+    return resp.str();
+  }
+
+  // Generates the header lines and the blank line that ends them.  We
+  // automatically generate the "Content-length:" header, and make
+  // that be the last header in the block.  The value of the
+  // Content-length header is the size of the response body (in bytes).
+  // A 304 never has a body, and would have to give the length of the
+  // full response instead, so it gets no Content-length at all.
+  std::string GenerateHeaderLines() const {
+    std::stringstream resp;
+
     if (!content_type_.empty()) {
       resp << "Content-type: " << content_type_ << "\r\n";
     }
-    resp << "Content-length: " << body_.size() << "\r\n";
+    for (const auto &header : headers_) {
+      resp << header.first << ": " << header.second << "\r\n";
+    }
+    if (response_code_ != 304) {
+      resp << "Content-length: " << body_length() << "\r\n";
+    }
     resp << "\r\n";
-    resp << body_;
     return resp.str();
   }
 
+  // Generates everything in the response that comes before the body.
+  std::string GenerateHeaderString() const {
+    return GenerateStatusLine() + GenerateHeaderLines();
+  }
+
+  // The most iovecs that GenerateIovecs() fills in.
+  static const int kMaxIovecs = 3;
+
+  // Lays the response out for writev() without copying the body: the
+  // status line and the header lines are generated into "status_line"
+  // and "headers", and "iov" is pointed at those and then at the
+  // body.  An empty or file-backed body gets no iovec.  Returns the
+  // number of iovecs filled in.  The iovecs are only valid as long as
+  // both strings and the response itself are.
+  int GenerateIovecs(std::string *status_line, std::string *headers,
+                     struct iovec *iov) const {
+    if (serialized_ != nullptr) {
+      status_line->clear();
+      headers->clear();
+      iov[0].iov_base = const_cast<char *>(serialized_->data());
+      iov[0].iov_len = serialized_->size();
+      return 1;
+    }
+    *status_line = GenerateStatusLine();
+    *headers = GenerateHeaderLines();
+    int iovcnt = 0;
+    iov[iovcnt].iov_base = const_cast<char *>(status_line->data());
+    iov[iovcnt++].iov_len = status_line->size();
+    iov[iovcnt].iov_base = const_cast<char *>(headers->data());
+    iov[iovcnt++].iov_len = headers->size();
+    if (!has_body_file() && !body_.empty()) {
+      iov[iovcnt].iov_base = const_cast<char *>(body_.data());
+      iov[iovcnt++].iov_len = body_.size();
+    }
+    return iovcnt;
+  }
+
+  // A method to generate a std::string of the HTTP response, suitable
+  // for writing back to the client.  A file-backed body is read into
+  // the string, so this costs a copy of the file.
+  std::string GenerateResponseString() const {
+    if (serialized_ != nullptr) {
+      return *serialized_;
+    }
+    std::string resp = GenerateHeaderString();
+    if (!has_body_file()) {
+      return resp + body_;
+    }
+
+    for (const BodyFilePart &part : body_file_parts_) {
+      resp += part.prefix;
+      size_t start = resp.size();
+      resp.resize(start + part.length);
+      uint64_t got = 0;
+      while (got < part.length) {
+        ssize_t res = pread(body_file_->fd(), &resp[start + got],
+                            part.length - got, part.offset + got);
+        if (res < 0 && errno == EINTR) {
+          continue;
+        }
+        if (res <= 0) {
+          break;
+        }
+        got += res;
+      }
+      if (got < part.length) {  // the file got shorter under us
+        resp.resize(start + got);
+        break;
+      }
+    }
+    return resp;
+  }
+
  private:
   // The HTTP protocol string to pass back in the header.
   std::string protocol_;
@@ -87,8 +283,18 @@ class HttpResponse {
   // The HTTP content type string to pass back in the header.  Optional .
   std::string content_type_;
 
+  // Any other headers to pass back, in order.
+  std::vector<std::pair<std::string, std::string>> headers_;
+
   // The body of the response.
   std::string body_;
+
+  // The file the body comes from instead, if there is one.
+  std::shared_ptr<ResponseFile> body_file_;
+  std::vector<BodyFilePart> body_file_parts_;
+
+  // The whole response, if it was generated ahead of time.
+  std::shared_ptr<const std::string> serialized_;
 };
 
 }  // namespace searchserver
@@ -10,6 +10,13 @@
  */
 
 #include <boost/algorithm/string.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -31,6 +38,7 @@ using std::list;
 using std::map;
 using std::string;
 using std::stringstream;
+using std::shared_ptr;
 using std::unique_ptr;
 using std::vector;
 
@@ -59,68 +67,463 @@ static const char *kFivegleStr =
   "</center><p>\n";
 
 // static
-const int HttpServer::kNumThreads = 100;
+const int HttpServer::kNumEventThreads = 8;
+
+// static
+const size_t HttpServer::kDnsCacheEntries = 4096;
+
+// static
+const uint32_t HttpServer::kDnsCacheTtlSecs = 300;
+
+// static
+const size_t HttpServer::kDefaultStaticCacheBytes = 64 * 1024 * 1024;
+
+// static
+const size_t HttpServer::kMaxCachedResponseBytes = 1024 * 1024;
+
+// static
+const int HttpServer::kDefaultHeaderTimeoutMs = 10 * 1000;
+
+// static
+const int HttpServer::kDefaultIdleTimeoutMs = 15 * 1000;
+
+// static
+const int HttpServer::kDefaultWriteTimeoutMs = 30 * 1000;
+
+// static
+const uint32_t HttpServer::kDefaultMaxRequests = 1000;
+
+// static
+const uint32_t HttpServer::kDefaultQueueTargetMs = 50;
+
+// static
+const uint32_t HttpServer::kDefaultQueueIntervalMs = 500;
+
+// static
+const uint32_t HttpServer::kDefaultMinThreads = 8;
+
+// static
+const uint32_t HttpServer::kDefaultMaxThreads = 100;
+
+// static
+const uint32_t HttpServer::kDefaultThreadIdleMs = 30 * 1000;
+
+// static
+SocketOptions HttpServer::DefaultSocketOptions() {
+  SocketOptions options;
+  options.no_delay = true;
+  return options;
+}
+
+// Separates the parts of a multipart/byteranges response.
+static const char *kByteRangesBoundary = "595gle_byteranges_boundary";
+
+// What a client that is turned away by admission control gets.
+static const char kOverloadedResponse[] =
+  "HTTP/1.1 503 Service Unavailable\r\n"
+  "Retry-After: 1\r\n"
+  "Connection: close\r\n"
+  "Content-length: 0\r\n"
+  "\r\n";
+
+// The most epoll events handled per call to epoll_wait().
+static const int kMaxEpollEvents = 256;
+
+// The event loop's ThreadPool lanes.  Reading from and writing to
+// clients, and answering file requests, happens in kFileLane; a
+// connection moves to kQueryLane while it answers a search query.
+static const uint32_t kFileLane = 0;
+static const uint32_t kQueryLane = 1;
+
+// When both lanes have work waiting, how many file lane tasks run for
+// each query.  The query lane also leaves one worker free for files.
+static const uint32_t kFileLaneWeight = 4;
+
+// How many search results go on one page.
+static const size_t kResultsPerPage = 20;
 
 // This is the function that threads are dispatched into
 // in order to process new client connections.
-static void HttpServer_ThrFn(ThreadPool::Task *t);
+static void ServeConnection(const ConnectionConfig &config, int client_fd,
+                            const string &c_addr, uint16_t c_port);
+
+// This is the function that threads are dispatched into when
+// an event loop connection becomes readable or writable.
+static void HttpServer_EventFn(ThreadPool::Task *t);
+
+// Hands an event loop connection back to epoll, waiting for it to
+// become writable if it still has output queued and readable
+// otherwise.  Returns false if the connection could not be re-armed.
+static bool RearmEventConnection(EventConnectionTask *ect);
+
+// Sends kOverloadedResponse to a newly accepted client and closes the
+// connection, without ever blocking the accept loop.
+static void ShedConnection(int client_fd);
+
+// Logs that a client connected, by host name if "resolver" already
+// knows it and by IP address otherwise.
+static void LogClient(DnsResolver *resolver, const string &c_addr,
+                      uint16_t c_port);
+
+// Returns true if "req" asks for a static file rather than a query.
+static bool IsFileRequest(const HttpRequest &req);
 
 // Given a request, produce a response.
 static HttpResponse ProcessRequest(const HttpRequest &req,
                             const string &base_dir,
-                            WordIndex *indices);
+                            WordIndex *indices,
+                            StaticFileCache *cache);
+
+// Process a file request.  "cache" may be nullptr.
+static HttpResponse ProcessFileRequest(const HttpRequest &req,
+                                const string &base_dir,
+                                StaticFileCache *cache);
+
+// Builds the response to a file request with a "Range:" header that
+// parse_range_header() turned into "result" and "ranges".  Takes
+// ownership of the open file "file_fd"; "st" is what fstat() said
+// about it.
+static HttpResponse ProcessRangeRequest(int file_fd, const struct stat &st,
+                                        const string &content_type,
+                                        RangeResult result,
+                                        const vector<ByteRange> &ranges);
 
-// Process a file request.
-static HttpResponse ProcessFileRequest(const string &uri,
-                                const string &base_dir);
+// Returns true if the If-none-match or If-modified-since header in
+// "req" says the client's copy of a file, whose current validators
+// are "etag" and "last_modified", is still good.
+static bool NotModified(const HttpRequest &req, const string &etag,
+                        time_t last_modified);
+
+// Adds the ETag and Last-modified headers to "ret".
+static void AddValidators(HttpResponse *ret, const string &etag,
+                          time_t last_modified);
+
+// Builds a bodyless 304 response for a file with the given validators.
+static HttpResponse NotModifiedResponse(const string &etag,
+                                        time_t last_modified);
+
+// Builds the 431 sent to a client whose request header is over the
+// limit, just before we close the connection.
+static HttpResponse HeaderTooLargeResponse();
 
 // Process a query request.
 static HttpResponse ProcessQueryRequest(const string &uri,
                                  WordIndex *index);
 
+// Returns a link, reading "text", to page "page" of the results for
+// "terms".
+static string QueryPageLink(const string &terms, size_t page,
+                            const string &text);
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // HttpServer
 ///////////////////////////////////////////////////////////////////////////////
+struct HttpServer::Listener {
+  HttpServer *server;
+  ServerSocket *socket;
+  int listen_fd;
+  pthread_t thread;
+  bool ok;
+};
+
 bool HttpServer::run(void) {
-  // Create the server listening socket.
+  if (reverse_dns_ && resolver_ == nullptr) {
+    resolver_ = new DnsResolver(kDnsCacheEntries, kDnsCacheTtlSecs);
+  }
+  if (static_cache_bytes_ > 0 && static_cache_ == nullptr) {
+    static_cache_ = new StaticFileCache(static_cache_bytes_,
+                                        kMaxCachedResponseBytes);
+  }
+
   int listen_fd;
-  cout << "  creating and binding the listening socket..." << endl;
-  if (!socket_.bind_and_listen(AF_INET6, &listen_fd)) {
-    cerr << endl << "Couldn't bind to the listening socket." << endl;
-    return false;
+  if (num_listeners_ == 1) {
+    // Create the server listening socket.
+    cout << "  creating and binding the listening socket..." << endl;
+    if (!socket_.bind_and_listen(AF_INET6, &listen_fd)) {
+      cerr << endl << "Couldn't bind to the listening socket." << endl;
+      return false;
+    }
+    return serve(&socket_, listen_fd);
+  }
+
+  // Create one SO_REUSEPORT listening socket per listener.  The first
+  // one is our own socket_.
+  cout << "  creating and binding " << num_listeners_
+       << " listening sockets..." << endl;
+  vector<Listener> listeners(num_listeners_);
+  bool ok = true;
+  for (uint32_t i = 0; i < num_listeners_; i++) {
+    listeners[i].server = this;
+    listeners[i].socket =
+      (i == 0) ? &socket_ : new ServerSocket(socket_.port());
+    listeners[i].socket->set_reuse_port(true);
+    listeners[i].socket->set_socket_options(socket_.socket_options());
+    if (ok && !listeners[i].socket->bind_and_listen(AF_INET6,
+                                                    &listeners[i].listen_fd)) {
+      cerr << endl << "Couldn't bind to listening socket " << i << "." << endl;
+      ok = false;
+    }
+  }
+
+  // Give every listener its own thread, then wait for all of them.
+  if (ok) {
+    for (uint32_t i = 0; i < num_listeners_; i++) {
+      pthread_create(&listeners[i].thread, nullptr,
+                     &HttpServer::listener_thread, &listeners[i]);
+    }
+    for (uint32_t i = 0; i < num_listeners_; i++) {
+      pthread_join(listeners[i].thread, nullptr);
+      ok = ok && listeners[i].ok;
+    }
   }
+  for (uint32_t i = 1; i < num_listeners_; i++) {
+    delete listeners[i].socket;
+  }
+  return ok;
+}
+
+void *HttpServer::listener_thread(void *arg) {
+  Listener *l = static_cast<Listener *>(arg);
+  l->ok = l->server->serve(l->socket, l->listen_fd);
+  return nullptr;
+}
+
+uint32_t HttpServer::threads_per_listener(uint32_t total) const {
+  return (total + num_listeners_ - 1) / num_listeners_;
+}
 
+bool HttpServer::serve(ServerSocket *ss, int listen_fd) {
+  if (mode_ == kEventLoop) {
+    return run_event_loop(ss, listen_fd);
+  }
+  return run_accept_loop(ss);
+}
+
+bool HttpServer::run_accept_loop(ServerSocket *ss) {
   // Spin, accepting connections and dispatching them.  Use a
   // threadpool to dispatch connections into their own thread.
   cout << "  accepting connections..." << endl << endl;
-  ThreadPool tp(kNumThreads);
+  ConnectionConfig config;
+  config.resolver = resolver_;
+  config.base_dir = static_file_dir_path_;
+  config.index = index_;
+  config.cache = static_cache_;
+  config.max_header_bytes = max_header_bytes_;
+  config.header_timeout_ms = header_timeout_ms_;
+  config.idle_timeout_ms = idle_timeout_ms_;
+  config.write_timeout_ms = write_timeout_ms_;
+  config.max_requests = max_requests_;
+  ThreadPool tp(threads_per_listener(min_threads_),
+                threads_per_listener(max_threads_), thread_idle_ms_);
+  tp.set_admission_control(queue_target_ms_, queue_interval_ms_);
+  if (worker_placement_ != ThreadPool::kUnpinned &&
+      !tp.set_cpu_affinity({}, worker_placement_)) {
+    cerr << "  couldn't pin the worker threads" << endl;
+  }
   while (1) {
-    HttpServerTask *hst = new HttpServerTask(HttpServer_ThrFn);
-    hst->base_dir = static_file_dir_path_;
-    hst->index = index_;
-    if (!socket_.accept_client(&hst->client_fd,
-                    &hst->c_addr,
-                    &hst->c_port,
-                    &hst->c_dns,
-                    &hst->s_addr,
-                    &hst->s_dns)) {
+    int client_fd;
+    uint16_t c_port;
+    string c_addr, s_addr;
+    if (!ss->accept_client(&client_fd, &c_addr, &c_port, &s_addr)) {
       // The accept failed for some reason, so quit out of the server.
       // (Will happen when kill command is used to shut down the server.)
       break;
     }
-    // The accept succeeded; dispatch it.
-    tp.dispatch(hst);
+    if (tp.overloaded()) {
+      // The workers are falling behind; turn the client away now
+      // rather than have it wait in a queue that isn't draining.
+      ShedConnection(client_fd);
+      continue;
+    }
+    // The accept succeeded; dispatch it.  The task is small enough to
+    // be stored inline, so this doesn't allocate.
+    tp.post([&config, client_fd, c_port, c_addr = std::move(c_addr)]() {
+      ServeConnection(config, client_fd, c_addr, c_port);
+    });
+  }
+  return true;
+}
+
+bool HttpServer::run_event_loop(ServerSocket *ss, int listen_fd) {
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    perror("epoll_create1() failed");
+    return false;
+  }
+
+  // The listening socket stays level-triggered and is marked with a
+  // null data pointer so that we can tell it apart from clients.
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = nullptr;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+    perror("epoll_ctl() failed");
+    close(epoll_fd);
+    return false;
+  }
+
+  // Spin waiting for sockets to become ready.  New clients are
+  // accepted right here; ready clients are dispatched to a worker.
+  cout << "  accepting connections (event loop)..." << endl << endl;
+  uint32_t num_threads = threads_per_listener(kNumEventThreads);
+  ThreadPool tp(num_threads);
+  tp.set_admission_control(queue_target_ms_, queue_interval_ms_);
+  ThreadPool::LaneOptions file_lane, query_lane;
+  file_lane.weight = kFileLaneWeight;
+  query_lane.max_workers = (num_threads > 1) ? num_threads - 1 : 1;
+  tp.set_lanes({file_lane, query_lane});
+  if (worker_placement_ != ThreadPool::kUnpinned &&
+      !tp.set_cpu_affinity({}, worker_placement_)) {
+    cerr << "  couldn't pin the worker threads" << endl;
+  }
+  struct epoll_event events[kMaxEpollEvents];
+  bool running = true;
+  while (running) {
+    int num_events = epoll_wait(epoll_fd, events, kMaxEpollEvents, -1);
+    if (num_events == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    for (int i = 0; i < num_events; i++) {
+      EventConnectionTask *ect =
+        static_cast<EventConnectionTask *>(events[i].data.ptr);
+      if (ect != nullptr) {
+        ect->ready_events = events[i].events;
+        tp.dispatch(ect);
+        continue;
+      }
+
+      int client_fd;
+      uint16_t c_port;
+      string c_addr, s_addr;
+      if (!ss->accept_client(&client_fd, &c_addr, &c_port, &s_addr)) {
+        // Same as the thread-per-connection loop: a failed accept
+        // means the server is being shut down.
+        running = false;
+        break;
+      }
+      if (tp.overloaded()) {
+        ShedConnection(client_fd);
+        continue;
+      }
+      LogClient(resolver_, c_addr, c_port);
+
+      int flags = fcntl(client_fd, F_GETFL, 0);
+      fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
+
+      ect = new EventConnectionTask(HttpServer_EventFn, client_fd);
+      ect->pool = &tp;
+      ect->epoll_fd = epoll_fd;
+      ect->c_port = c_port;
+      ect->c_addr = c_addr;
+      ect->base_dir = static_file_dir_path_;
+      ect->index = index_;
+      ect->cache = static_cache_;
+      ect->hc.set_max_header_bytes(max_header_bytes_);
+      ect->hc.set_max_requests(max_requests_);
+
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+      ev.data.ptr = ect;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+        delete ect;
+      }
+    }
   }
+  close(epoll_fd);
   return true;
 }
 
-static void HttpServer_ThrFn(ThreadPool::Task *t) {
-  // Cast back our HttpServerTask structure with all of our new
-  // client's information in it.
-  unique_ptr<HttpServerTask> hst(static_cast<HttpServerTask *>(t));
-  cout << "  client " << hst->c_dns << ":" << hst->c_port << " "
-       << "(IP address " << hst->c_addr << ")" << " connected." << endl;
+static void HttpServer_EventFn(ThreadPool::Task *t) {
+  EventConnectionTask *ect = static_cast<EventConnectionTask *>(t);
+  HttpConnection &hc = ect->hc;
+
+  // Pull in everything the client has sent so far.  A client that
+  // hung up may still have complete requests sitting in the buffer,
+  // so keep going and answer those before closing.
+  bool peer_gone = ect->peer_gone;
+  if (ect->ready_events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+    peer_gone = !hc.read_available();
+  }
+
+  // Answer every complete request that is already buffered, starting
+  // with the query we were handed to the query lane for, if that's
+  // why we're here.  A partial request just waits in the buffer for
+  // the next event.
+  HttpRequest request;
+  bool have_request = ect->has_deferred;
+  if (have_request) {
+    request = ect->deferred;
+    ect->has_deferred = false;
+  } else {
+    have_request = !ect->closing && hc.next_buffered_request(&request);
+  }
+  while (have_request) {
+    if (ect->lane_ != kQueryLane && !IsFileRequest(request)) {
+      // Queries can take a while, so hand the connection over to the
+      // query lane rather than hold up file requests behind it.  The
+      // socket stays disarmed in epoll until we're done with it.
+      ect->deferred = request;
+      ect->has_deferred = true;
+      ect->peer_gone = peer_gone;
+      ect->ready_events = 0;
+      ect->lane_ = kQueryLane;
+      ect->pool->dispatch(ect);
+      return;
+    }
+    hc.queue_response(ProcessRequest(request, ect->base_dir, ect->index,
+                                     ect->cache));
+    if (request.GetHeaderValue("connection") == "close" ||
+        hc.request_limit_reached()) {
+      ect->closing = true;
+    }
+    have_request = !ect->closing && hc.next_buffered_request(&request);
+  }
+  ect->lane_ = kFileLane;
+  if (!ect->closing && hc.header_too_large()) {
+    hc.queue_response(HeaderTooLargeResponse());
+    ect->closing = true;
+  }
+  if (peer_gone) {
+    ect->closing = true;
+  }
+
+  if (!hc.flush_pending()) {
+    delete ect;
+    return;
+  }
+  if (ect->closing && !hc.has_pending_output()) {
+    delete ect;
+    return;
+  }
+
+  // Once re-armed, another worker may pick the connection up at any
+  // moment, so we must not touch ect afterwards.
+  if (!RearmEventConnection(ect)) {
+    delete ect;
+  }
+}
+
+static bool RearmEventConnection(EventConnectionTask *ect) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  if (ect->hc.has_pending_output()) {
+    ev.events = EPOLLOUT | EPOLLONESHOT;
+  } else {
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  }
+  ev.data.ptr = ect;
+  return epoll_ctl(ect->epoll_fd, EPOLL_CTL_MOD, ect->client_fd, &ev) == 0;
+}
+
+static void ServeConnection(const ConnectionConfig &config, int client_fd,
+                            const string &c_addr, uint16_t c_port) {
+  LogClient(config.resolver, c_addr, c_port);
 
   // Use the HttpConnection class to read and process the next
   // request from our current client, then write out our response.  If
@@ -132,49 +535,114 @@ static void HttpServer_ThrFn(ThreadPool::Task *t) {
   // creating/destroying the same connection repeatedly.
 
   // TODO: Implement
-  HttpConnection hc(hst->client_fd) ;
-  bool done = false;
-  while (!done) {
-    // Read in the next request, process it, write the response.
+  HttpConnection hc(client_fd) ;
+  hc.set_max_header_bytes(config.max_header_bytes);
+  hc.set_max_requests(config.max_requests);
+  if (!hc.set_timeouts(config.header_timeout_ms, config.idle_timeout_ms,
+                       config.write_timeout_ms)) {
+    return;
+  }
   HttpRequest request;
- 
-    if(!hc.next_request(&request)) {
-      // close(hst->client_fd);
-      done = true;
-      break;
-    }
+  bool have_request = hc.next_request(&request);
+  while (have_request) {
+    // Process this request and every other one the client has already
+    // pipelined behind it, queueing up the responses.
+    bool closing = false;
+    do {
+      hc.queue_response(ProcessRequest(request, config.base_dir,
+                                       config.index, config.cache));
+      if (request.GetHeaderValue("connection") == "close" ||
+          hc.request_limit_reached()) {
+        // That was the last request we serve on this connection, but
+        // it still gets its answer.
+        closing = true;
+        break;
+      }
+    } while (hc.next_buffered_request(&request));
 
-    if(request.GetHeaderValue("connection") == "close") {
-      // close(hst->client_fd);
-      done = true;
+    if (closing) {
+      hc.flush_pending();
       break;
     }
-
-    HttpResponse response = ProcessRequest(request, hst->base_dir, hst->index);
-    if(!hc.write_response(response)) {
-      done = true;
+    if (hc.header_too_large()) {
       break;
     }
+
+    // Write all of the responses at once, then read in the next
+    // request, together so the I/O backend can batch them.
+    have_request = hc.write_pending_and_next_request(&request);
+  }
+
+  // A client whose request header is too big is told so, after the
+  // answers to whatever it sent before that.
+  if (hc.header_too_large()) {
+    hc.queue_response(HeaderTooLargeResponse());
+    hc.flush_pending();
+  }
+}
+
+static void ShedConnection(int client_fd) {
+  send(client_fd, kOverloadedResponse, sizeof(kOverloadedResponse) - 1,
+       MSG_DONTWAIT | MSG_NOSIGNAL);
+
+  // Closing a socket with unread data resets the connection, which
+  // can throw away the 503 before the client sees it, so drain what
+  // the client has sent so far first.
+  shutdown(client_fd, SHUT_WR);
+  char buf[1024];
+  while (recv(client_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) { }
+  close(client_fd);
+}
+
+static void LogClient(DnsResolver *resolver, const string &c_addr,
+                      uint16_t c_port) {
+  string c_dns = c_addr;
+  if (resolver != nullptr) {
+    resolver->lookup(c_addr, &c_dns);
   }
+  cout << "  client " << c_dns << ":" << c_port << " "
+       << "(IP address " << c_addr << ")" << " connected." << endl;
+}
+
+static bool IsFileRequest(const HttpRequest &req) {
+  return req.uri().substr(0, 8) == "/static/";
 }
 
 static HttpResponse ProcessRequest(const HttpRequest &req,
                             const string &base_dir,
-                            WordIndex *index) {
+                            WordIndex *index,
+                            StaticFileCache *cache) {
   // Is the user asking for a static file?
-  if (req.uri().substr(0, 8) == "/static/") {
-    return ProcessFileRequest(req.uri(), base_dir);
+  if (IsFileRequest(req)) {
+    return ProcessFileRequest(req, base_dir, cache);
   }
 
   // The user must be asking for a query.
-  return ProcessQueryRequest(req.uri(), index);
+  return ProcessQueryRequest(string(req.uri()), index);
 }
 
-static HttpResponse ProcessFileRequest(const string &uri,
-                                const string &base_dir) {
+static HttpResponse ProcessFileRequest(const HttpRequest &req,
+                                const string &base_dir,
+                                StaticFileCache *cache) {
   // TODO: Implement
   // The response we'll build up.
   HttpResponse ret;
+  string uri(req.uri());
+  string range(req.GetHeaderValue("range"));
+
+  // A file we've served recently comes straight out of the cache,
+  // already turned into a response, or, if the client already has
+  // it, turns into a 304.  The cache only has whole files, so
+  // requests for part of one skip it.
+  string path = uri.substr(0, uri.find('?'));
+  StaticFileCache::CachedFile cached;
+  if (cache != nullptr && range.empty() && cache->lookup(path, &cached)) {
+    if (NotModified(req, cached.etag, cached.last_modified)) {
+      return NotModifiedResponse(cached.etag, cached.last_modified);
+    }
+    ret.set_serialized(cached.response);
+    return ret;
+  }
 
   // Steps to follow:
   //  - use the URLParser class to figure out what filename
@@ -201,11 +669,24 @@ static HttpResponse ProcessFileRequest(const string &uri,
       return ret;
   }
   
-  //  - use the FileReader class to read the file into memory
+  //  - use the FileReader class to open the file; the body is sent
+  //    straight from the file with sendfile() rather than read into
+  //    memory
   FileReader fs(file_name);
-  string str;
- 
-  if (fs.read_file(&str)) {
+  int file_fd;
+  struct stat st;
+
+  if (fs.open_file(&file_fd, &st)) {
+      uint64_t file_size = st.st_size;
+
+      //  - if the client's copy is still good, don't send it again
+      string etag = make_etag(st);
+      if (NotModified(req, etag, st.st_mtime)) {
+        close(file_fd);
+        return NotModifiedResponse(etag, st.st_mtime);
+      }
+
+
     //  - depending on the file name suffix, set the response
       //    Content-type header as appropriate, e.g.,:
       //      --> for ".html" or ".htm", set to "text/html"
@@ -220,39 +701,155 @@ static HttpResponse ProcessFileRequest(const string &uri,
       // be sure to set the response code, protocol, and message
       // in the HttpResponse as well.
       
-      ret.set_protocol("HTTP/1.1");
-      ret.set_response_code(200);
-      ret.set_message("OK");
-      //  - copy the file content into the ret.body
-      ret.AppendToBody(str);
-    
       uint16_t found = file_name.find_last_of('.');
       string suffix = file_name.substr(found+1);
+      string content_type;
       
       if(suffix == "html" || suffix == "htm") {
-        ret.set_content_type("text/html");
+        content_type = "text/html";
       } else if (suffix == "jpeg" || suffix == "jpg") {
-        ret.set_content_type("image/jpeg");
+        content_type = "image/jpeg";
       } else if (suffix == "png") {
-        ret.set_content_type("image/png");
+        content_type = "image/png";
       } else if (suffix == "txt") {
-        ret.set_content_type("text/plain");
+        content_type = "text/plain";
       } else if (suffix == "js") {
-        ret.set_content_type("text/javascript");
+        content_type = "text/javascript";
       } else if (suffix == "css") {
-        ret.set_content_type("text/css");
+        content_type = "text/css";
       } else if (suffix == "xml") {
-        ret.set_content_type("text/xml");
+        content_type = "text/xml";
       } else if (suffix == "gif") {
-        ret.set_content_type("image/gif");
+        content_type = "image/gif";
       } else {
-        ret.set_content_type("text/plain");
+        content_type = "text/plain";
+      }
+
+      //  - if the client only wants some of the file, send just those
+      //    bytes
+      if (!range.empty()) {
+        vector<ByteRange> ranges;
+        RangeResult result = parse_range_header(range, file_size, &ranges);
+        if (result != kRangeIgnored) {
+          return ProcessRangeRequest(file_fd, st, content_type, result,
+                                     ranges);
+        }
+      }
+
+      ret.set_protocol("HTTP/1.1");
+      ret.set_response_code(200);
+      ret.set_message("OK");
+      ret.set_content_type(content_type);
+      ret.AddHeader("Accept-ranges", "bytes");
+      AddValidators(&ret, etag, st.st_mtime);
+      //  - hand the open file over to ret as its body
+      ret.set_body_file(file_fd, 0, file_size);
+
+      //  - keep small files around in the cache for next time
+      if (cache != nullptr) {
+        shared_ptr<const string> bytes =
+          cache->insert(path, file_name, st, ret);
+        if (bytes != nullptr) {
+          ret.set_serialized(bytes);
+        }
       }
   }
   
   return ret;
 }
 
+static HttpResponse ProcessRangeRequest(int file_fd, const struct stat &st,
+                                        const string &content_type,
+                                        RangeResult result,
+                                        const vector<ByteRange> &ranges) {
+  HttpResponse ret;
+  ret.set_protocol("HTTP/1.1");
+  string total = "/" + std::to_string(st.st_size);
+
+  if (result == kRangeUnsatisfiable) {
+    close(file_fd);
+    ret.set_response_code(416);
+    ret.set_message("Range Not Satisfiable");
+    ret.AddHeader("Content-range", "bytes *" + total);
+    return ret;
+  }
+
+  ret.set_response_code(206);
+  ret.set_message("Partial Content");
+  AddValidators(&ret, make_etag(st), st.st_mtime);
+  if (ranges.size() == 1) {
+    const ByteRange &r = ranges[0];
+    ret.set_content_type(content_type);
+    ret.AddHeader("Content-range", "bytes " + std::to_string(r.first) + "-" +
+                  std::to_string(r.last) + total);
+    ret.set_body_file(file_fd, r.first, r.last - r.first + 1);
+    return ret;
+  }
+
+  // Several ranges go out as a multipart/byteranges body, each with
+  // its own little header in front of it.
+  ret.set_content_type(string("multipart/byteranges; boundary=") +
+                       kByteRangesBoundary);
+  vector<BodyFilePart> parts;
+  for (const ByteRange &r : ranges) {
+    BodyFilePart part;
+    part.prefix = string(parts.empty() ? "" : "\r\n") + "--" +
+                  kByteRangesBoundary + "\r\n" +
+                  "Content-type: " + content_type + "\r\n" +
+                  "Content-range: bytes " + std::to_string(r.first) + "-" +
+                  std::to_string(r.last) + total + "\r\n\r\n";
+    part.offset = r.first;
+    part.length = r.last - r.first + 1;
+    parts.push_back(part);
+  }
+  BodyFilePart end;
+  end.prefix = string("\r\n--") + kByteRangesBoundary + "--\r\n";
+  end.offset = 0;
+  end.length = 0;
+  parts.push_back(end);
+  ret.set_body_file_parts(file_fd, parts);
+  return ret;
+}
+
+static bool NotModified(const HttpRequest &req, const string &etag,
+                        time_t last_modified) {
+  // If-none-match wins when the client sends both.
+  string if_none_match(req.GetHeaderValue("if-none-match"));
+  if (!if_none_match.empty()) {
+    return etag_matches(if_none_match, etag);
+  }
+  time_t since;
+  string if_modified_since(req.GetHeaderValue("if-modified-since"));
+  return !if_modified_since.empty() &&
+         parse_http_date(if_modified_since, &since) &&
+         last_modified <= since;
+}
+
+static void AddValidators(HttpResponse *ret, const string &etag,
+                          time_t last_modified) {
+  ret->AddHeader("ETag", etag);
+  ret->AddHeader("Last-modified", format_http_date(last_modified));
+}
+
+static HttpResponse NotModifiedResponse(const string &etag,
+                                        time_t last_modified) {
+  HttpResponse ret;
+  ret.set_protocol("HTTP/1.1");
+  ret.set_response_code(304);
+  ret.set_message("Not Modified");
+  AddValidators(&ret, etag, last_modified);
+  return ret;
+}
+
+static HttpResponse HeaderTooLargeResponse() {
+  HttpResponse ret;
+  ret.set_protocol("HTTP/1.1");
+  ret.set_response_code(431);
+  ret.set_message("Request Header Fields Too Large");
+  ret.AddHeader("Connection", "close");
+  return ret;
+}
+
   // Your job here is to figure out how to present the user with
   // the same query interface as our solution_binaries/httpd server.
   // A couple of notes:
@@ -300,8 +897,30 @@ static HttpResponse ProcessQueryRequest(const string &uri,
       fullQuery += (s + " ") ;
     }
 
-    list<Result> result;
-    result = index->lookup_query(query);
+    // Which page of results to show, counting from 1.
+    size_t page = 1;
+    if (res.find("page") != res.end()) {
+      page = strtoul(res.at("page").c_str(), nullptr, 10);
+      if (page == 0) {
+        page = 1;
+      }
+    }
+    size_t offset = (page - 1 > SIZE_MAX / kResultsPerPage) ?
+                    SIZE_MAX : (page - 1) * kResultsPerPage;
+
+    // Only rank as many results as it takes to fill this page.  A page
+    // past the last one shows the last one instead.
+    vector<Result> result;
+    size_t total = index->lookup_query(query, offset, kResultsPerPage,
+                                       &result);
+    size_t num_pages = (total + kResultsPerPage - 1) / kResultsPerPage;
+    if (page > std::max<size_t>(num_pages, 1)) {
+      page = std::max<size_t>(num_pages, 1);
+      offset = (page - 1) * kResultsPerPage;
+      if (total > 0) {
+        total = index->lookup_query(query, offset, kResultsPerPage, &result);
+      }
+    }
 
     if (index->num_words() == 0) {
       ret.AppendToBody("<p><br>\r\n"); 
@@ -311,31 +930,54 @@ static HttpResponse ProcessQueryRequest(const string &uri,
       ret.AppendToBody("<p>\r\n\r\n");
     } else {
       ret.AppendToBody("<p><br>\r\n" 
-                        + std::to_string(result.size()) 
+                        + std::to_string(total) 
                         + " result");
-      if(result.size() > 1) {
+      if(total > 1) {
         ret.AppendToBody("s");
       }
       ret.AppendToBody(" found for <b>" 
                         + escape_html(fullQuery)
                         + "</b>\r\n");
+      if (!result.empty() && total > result.size()) {
+        ret.AppendToBody("(showing " + std::to_string(offset + 1) + "-"
+                         + std::to_string(offset + result.size())
+                         + ")\r\n");
+      }
       ret.AppendToBody("<p>\r\n\r\n");
 
       // Display results
       ret.AppendToBody("<ul>\r\n");
       for (Result r :result) {
+        const string &doc_name = index->doc_name(r.doc_id);
         ret.AppendToBody("<li> <a href=\"");
-          if (r.doc_name.substr(0, 7) != "http://") {
+          if (doc_name.substr(0, 7) != "http://") {
             ret.AppendToBody("/static/");
           } 
-        ret.AppendToBody(r.doc_name 
+        ret.AppendToBody(doc_name 
                           +"\">"
-                          + escape_html(r.doc_name)
+                          + escape_html(doc_name)
                           + "</a> [" 
                           + std::to_string(r.rank) 
                           + "]<br>\r\n");
       }
       ret.AppendToBody("</ul>\r\n");
+
+      // Links to the pages on either side of this one.
+      if (num_pages > 1) {
+        string terms = boost::join(query, " ");
+        ret.AppendToBody("<p>\r\n");
+        if (page > 1) {
+          ret.AppendToBody(QueryPageLink(terms, page - 1, "&lt; Previous")
+                           + "\r\n");
+        }
+        ret.AppendToBody("Page " + std::to_string(page) + " of "
+                         + std::to_string(num_pages) + "\r\n");
+        if (page < num_pages) {
+          ret.AppendToBody(QueryPageLink(terms, page + 1, "Next &gt;")
+                           + "\r\n");
+        }
+        ret.AppendToBody("<p>\r\n");
+      }
     } 
   }
   
@@ -348,4 +990,10 @@ static HttpResponse ProcessQueryRequest(const string &uri,
   return ret;
 }
 
+static string QueryPageLink(const string &terms, size_t page,
+                            const string &text) {
+  return "<a href=\"/query?terms=" + encode_URI(terms) + "&amp;page="
+         + std::to_string(page) + "\">" + text + "</a>";
+}
+
 }  // namespace searchserver
@@ -16,8 +16,11 @@
 #include <string>
 #include <list>
 
+#include "./DnsResolver.h"
+#include "./HttpConnection.h"
 #include "./ThreadPool.h"
 #include "./ServerSocket.h"
+#include "./StaticFileCache.h"
 #include "./WordIndex.h"
 
 namespace searchserver {
@@ -25,6 +28,18 @@ namespace searchserver {
 // The HttpServer class contains the main logic for the web server.
 class HttpServer {
  public:
+  // The ways in which run() can serve accepted client connections.
+  enum ServingMode {
+    // Each connection is dispatched to a ThreadPool worker, which
+    // blocks on it until the client goes away.
+    kThreadPerConnection,
+
+    // Client sockets are made non-blocking and multiplexed with epoll.
+    // A small set of workers only runs when a socket is readable or
+    // writable, so idle keep-alive clients don't hold a thread.
+    kEventLoop
+  };
+
   // Creates a new HttpServer object for port "port" and serving
   // files out of path "staticfile_dirpath".  The index for
   // query processing is loaded already and ownership of
@@ -33,11 +48,28 @@ class HttpServer {
                       const std::string &static_file_dir_path,
                       WordIndex* index)
     : socket_(port), static_file_dir_path_(static_file_dir_path),
-      index_(index) { }
+      index_(index), mode_(kThreadPerConnection), num_listeners_(1),
+      reverse_dns_(true), resolver_(nullptr),
+      static_cache_bytes_(kDefaultStaticCacheBytes), static_cache_(nullptr),
+      max_header_bytes_(HttpConnection::kDefaultMaxHeaderBytes),
+      header_timeout_ms_(kDefaultHeaderTimeoutMs),
+      idle_timeout_ms_(kDefaultIdleTimeoutMs),
+      write_timeout_ms_(kDefaultWriteTimeoutMs),
+      max_requests_(kDefaultMaxRequests),
+      queue_target_ms_(kDefaultQueueTargetMs),
+      queue_interval_ms_(kDefaultQueueIntervalMs),
+      min_threads_(kDefaultMinThreads), max_threads_(kDefaultMaxThreads),
+      thread_idle_ms_(kDefaultThreadIdleMs),
+      worker_placement_(ThreadPool::kUnpinned) {
+    socket_.set_socket_options(DefaultSocketOptions());
+  }
 
   // The destructor closes the listening socket if it is open and
   // also kills off any threads in the threadpool.
-  virtual ~HttpServer() { }
+  virtual ~HttpServer() {
+    delete resolver_;
+    delete static_cache_;
+  }
 
   // Creates a listening socket for the server and launches it, accepting
   // connections and dispatching them to worker threads.  Returns
@@ -47,27 +79,229 @@ class HttpServer {
   // doesn't really return.
   bool run();
 
+  // Selects how run() serves connections.  Defaults to
+  // kThreadPerConnection; must be called before run().
+  void set_serving_mode(ServingMode mode) { mode_ = mode; }
+
+  // Sets how many listening sockets run() opens.  With more than one,
+  // every listener binds the port with SO_REUSEPORT and gets its own
+  // accept thread and its own share of the worker threads, so the
+  // kernel spreads connections across listeners and no lock is
+  // shared between them.  Typically set to the number of cores.
+  // Defaults to 1; must be called before run().
+  void set_num_listeners(uint32_t num_listeners) {
+    num_listeners_ = (num_listeners > 0) ? num_listeners : 1;
+  }
+
+  // Sets the tuning for the listening sockets and the client sockets
+  // they accept (see SocketOptions).  Defaults to
+  // DefaultSocketOptions(); must be called before run().
+  void set_socket_options(const SocketOptions &options) {
+    socket_.set_socket_options(options);
+  }
+
+  // Sets whether clients are logged by host name.  Names are looked
+  // up in the background by a DnsResolver and cached, so accepting a
+  // client never waits on DNS; a client whose name isn't known yet is
+  // logged by its IP address.  With reverse DNS off, every client is.
+  // Defaults to true; must be called before run().
+  void set_reverse_dns(bool reverse_dns) { reverse_dns_ = reverse_dns; }
+
+  // Sets how many bytes of prebuilt static file responses are kept in
+  // memory by a StaticFileCache; zero turns the cache off.  Defaults
+  // to kDefaultStaticCacheBytes; must be called before run().
+  void set_static_cache_bytes(size_t bytes) { static_cache_bytes_ = bytes; }
+
+  // Sets how many bytes a client's request header may take up; a
+  // client that sends a bigger one gets a 431 and is disconnected.
+  // Defaults to HttpConnection::kDefaultMaxHeaderBytes; must be called
+  // before run().
+  void set_max_header_bytes(size_t bytes) { max_header_bytes_ = bytes; }
+
+  // Sets how long a client may take to send a request header, stay
+  // idle between requests, and leave a response unread before it is
+  // disconnected, in milliseconds (see HttpConnection::set_timeouts());
+  // zero means no limit.  These keep slow and idle clients from tying
+  // up worker threads in kThreadPerConnection mode.  Default to the
+  // kDefault*TimeoutMs constants; must be called before run().
+  void set_timeouts(int header_ms, int idle_ms, int write_ms) {
+    header_timeout_ms_ = header_ms;
+    idle_timeout_ms_ = idle_ms;
+    write_timeout_ms_ = write_ms;
+  }
+
+  // Sets how many requests a client may make on one connection before
+  // we close it; zero means no limit.  Defaults to kDefaultMaxRequests;
+  // must be called before run().
+  void set_max_requests(uint32_t max_requests) {
+    max_requests_ = max_requests;
+  }
+
+  // Sets the admission control on the worker threads' queue (see
+  // ThreadPool::set_admission_control()).  While the pool is
+  // overloaded, new connections are answered with a canned 503 right
+  // away instead of being queued behind work that isn't draining.
+  // A target of 0 turns this off.  Default to kDefaultQueueTargetMs
+  // and kDefaultQueueIntervalMs; must be called before run().
+  void set_admission_control(uint32_t target_ms, uint32_t interval_ms) {
+    queue_target_ms_ = target_ms;
+    queue_interval_ms_ = interval_ms;
+  }
+
+  // Sets how many worker threads serve connections in
+  // kThreadPerConnection mode.  "min_threads" start up front; while
+  // every worker is busy, new connections get new workers, up to
+  // "max_threads", and workers beyond the minimum exit once they have
+  // been idle for "idle_ms" (see ThreadPool).  With several
+  // listeners, each gets its share of both.  Default to
+  // kDefaultMinThreads, kDefaultMaxThreads and kDefaultThreadIdleMs;
+  // must be called before run().
+  void set_worker_threads(uint32_t min_threads, uint32_t max_threads,
+                          uint32_t idle_ms) {
+    min_threads_ = min_threads;
+    max_threads_ = (max_threads > 0) ? max_threads : 1;
+    thread_idle_ms_ = idle_ms;
+  }
+
+  // Sets how the worker threads are pinned to CPUs (see
+  // ThreadPool::set_cpu_affinity()).  With kPinToNode, on a NUMA
+  // machine each worker stays on one node, and its task deque is
+  // allocated there.  Defaults to ThreadPool::kUnpinned; must be called
+  // before run().
+  void set_worker_placement(ThreadPool::Placement placement) {
+    worker_placement_ = placement;
+  }
+
+  // The SocketOptions a new HttpServer starts out with: the kernel's
+  // defaults, plus TCP_NODELAY.  A file response is a header write
+  // followed by a sendfile(), and without TCP_NODELAY Nagle's algorithm
+  // holds a small body back until the client's delayed ACK of the
+  // header arrives, about 40ms later.
+  static SocketOptions DefaultSocketOptions();
+
+  static const size_t kDefaultStaticCacheBytes;
+  static const int kDefaultHeaderTimeoutMs;
+  static const int kDefaultIdleTimeoutMs;
+  static const int kDefaultWriteTimeoutMs;
+  static const uint32_t kDefaultMaxRequests;
+  static const uint32_t kDefaultQueueTargetMs;
+  static const uint32_t kDefaultQueueIntervalMs;
+  static const uint32_t kDefaultMinThreads;
+  static const uint32_t kDefaultMaxThreads;
+  static const uint32_t kDefaultThreadIdleMs;
+
  private:
+  // The state of one listener, and the thread running it, when
+  // num_listeners_ > 1.
+  struct Listener;
+
+  // Accepts and services clients on the bound socket "ss" using the
+  // current serving mode, until accepting fails.  The listener gets
+  // 1/num_listeners_ of the worker threads.
+  bool serve(ServerSocket *ss, int listen_fd);
+
+  // The kThreadPerConnection half of serve().
+  bool run_accept_loop(ServerSocket *ss);
+
+  // The kEventLoop half of serve(): services clients from an epoll
+  // loop until epoll itself fails.
+  bool run_event_loop(ServerSocket *ss, int listen_fd);
+
+  // The start routine for each Listener's thread.
+  static void *listener_thread(void *arg);
+
+  // Returns this listener's share of "total" worker threads.
+  uint32_t threads_per_listener(uint32_t total) const;
+
   ServerSocket socket_;
   std::string static_file_dir_path_;
   WordIndex* index_;
-  static const int kNumThreads;
+  ServingMode mode_;
+  uint32_t num_listeners_;
+  bool reverse_dns_;
+
+  // Shared by every listener; nullptr if reverse_dns_ is false.
+  DnsResolver *resolver_;
+
+  // Shared by every listener; nullptr if static_cache_bytes_ is zero.
+  size_t static_cache_bytes_;
+  StaticFileCache *static_cache_;
+
+  size_t max_header_bytes_;
+  int header_timeout_ms_;
+  int idle_timeout_ms_;
+  int write_timeout_ms_;
+  uint32_t max_requests_;
+  uint32_t queue_target_ms_;
+  uint32_t queue_interval_ms_;
+  uint32_t min_threads_;
+  uint32_t max_threads_;
+  uint32_t thread_idle_ms_;
+  ThreadPool::Placement worker_placement_;
+
+  static const int kNumEventThreads;
+  static const size_t kDnsCacheEntries;
+  static const uint32_t kDnsCacheTtlSecs;
+  static const size_t kMaxCachedResponseBytes;
 };
 
-// A task for the ThreadPool
-// When the server accepts a new connection, it must
-// initialize one of these tasks to that the thread has
-// the information it needs to handle the client
-class HttpServerTask : public ThreadPool::Task {
+// What a worker needs to serve a connection in kThreadPerConnection
+// mode, other than the client itself.  This is the same for every
+// connection, so the accept loop sets it up once and hands each
+// connection's task a pointer to it.
+struct ConnectionConfig {
+  DnsResolver *resolver;
+  std::string base_dir;
+  WordIndex *index;
+  StaticFileCache *cache;
+  size_t max_header_bytes;
+  int header_timeout_ms;
+  int idle_timeout_ms;
+  int write_timeout_ms;
+  uint32_t max_requests;
+};
+
+// The per-connection state used by the kEventLoop serving mode.  The
+// task is dispatched to the ThreadPool each time epoll reports its
+// socket as ready, and handed back to epoll afterwards; since the
+// socket is registered with EPOLLONESHOT, at most one worker thread
+// touches the connection at a time.  A connection with a search query
+// to answer is dispatched again, to the pool's query lane, before it
+// goes back to epoll.
+class EventConnectionTask : public ThreadPool::Task {
  public:
-  explicit HttpServerTask(ThreadPool::thread_task_fn f)
-    : ThreadPool::Task(f) { }
+  EventConnectionTask(ThreadPool::thread_task_fn f, int fd)
+    : ThreadPool::Task(f), client_fd(fd), hc(fd), pool(nullptr),
+      epoll_fd(-1), ready_events(0), closing(false), peer_gone(false),
+      has_deferred(false) { }
 
   int client_fd;
+  HttpConnection hc;
+  ThreadPool *pool;
+  int epoll_fd;
+
+  // The epoll events that caused this dispatch, or 0 if the
+  // connection was dispatched to the query lane.
+  uint32_t ready_events;
+
+  // Set once the connection should be closed as soon as its queued
+  // output has been written.
+  bool closing;
+
+  // Set if the client had hung up when the connection was dispatched
+  // to the query lane.
+  bool peer_gone;
+
+  // The query the connection was dispatched to the query lane to
+  // answer, if has_deferred is set.
+  HttpRequest deferred;
+  bool has_deferred;
+
   uint16_t c_port;
-  std::string c_addr, c_dns, s_addr, s_dns;
+  std::string c_addr;
   std::string base_dir;
   WordIndex *index;
+  StaticFileCache *cache;
 };
 
 }  // namespace searchserver
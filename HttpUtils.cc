@@ -22,13 +22,23 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
+#include <atomic>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include "./HttpUtils.h"
+#include "./IoUring.h"
 
 using boost::algorithm::replace_all;
 using std::cerr;
@@ -38,9 +48,92 @@ using std::pair;
 using std::string;
 using std::vector;
 using std::cout;
+using std::unique_ptr;
 
 namespace searchserver {
 
+// The backend selected through set_io_backend().
+static std::atomic<IoBackend> g_io_backend(kBlockingIo);
+
+// The most ranges we serve from one "Range:" header; asking for more
+// gets the whole file instead.
+static const size_t kMaxByteRanges = 16;
+
+// How many iovecs wrapped_writev() copies out of the caller's array
+// at a time, so that it can trim them as partial writes go out
+// without allocating.  A response takes HttpResponse::kMaxIovecs.
+static const int kWritevWindow = 8;
+
+// The size of each thread's io_uring, and of the buffer it registers
+// for reads.
+static const unsigned kIoUringEntries = 64;
+static const size_t kIoUringBufferSize = 16384;
+
+// user_data tags for telling linked completions apart.
+static const uint64_t kWriteTag = 1;
+static const uint64_t kReadTag = 2;
+static const uint64_t kWriteTimeoutTag = 3;
+static const uint64_t kReadTimeoutTag = 4;
+
+// The timeouts that set_socket_timeouts() last put on a socket from
+// this thread.  io_uring ignores SO_RCVTIMEO and SO_SNDTIMEO, so the
+// io_uring versions of the wrapped_* calls enforce these with linked
+// timeouts instead.  Zero means no timeout.
+struct SocketTimeouts {
+  int fd;
+  int read_ms;
+  int write_ms;
+};
+static thread_local SocketTimeouts t_socket_timeouts = {-1, 0, 0};
+
+// Returns true if a "\r\n\r\n" ends at the '\n' at offset "pos" of
+// "data" and starts no earlier than "from".
+static bool header_end_at(const char *data, size_t pos, size_t from);
+
+// Returns the calling thread's io_uring, creating it on first use.
+// Returns nullptr if the blocking backend is selected, or if the
+// ring couldn't be created, in which case this thread keeps using
+// plain system calls.
+static IoUring *thread_ring();
+
+// Returns the read or write timeout set on "fd" from this thread with
+// set_socket_timeouts(), in milliseconds, or 0 if there is none.
+static int thread_timeout_ms(int fd, bool read);
+
+// Fills in "ts" with "ms" milliseconds.
+static void ms_to_timespec(int ms, struct __kernel_timespec *ts);
+
+// Submits "sqe", which has been filled in, along with a linked
+// timeout of "timeout_ms" milliseconds (tagged "timeout_tag") unless
+// that is 0, and waits for it to complete.  Returns the operation's
+// result, or -EAGAIN if it timed out, like a socket read or write
+// does when SO_RCVTIMEO or SO_SNDTIMEO expires.
+static int uring_run(IoUring *ring, struct io_uring_sqe *sqe,
+                     int timeout_ms, uint64_t timeout_tag);
+
+// The io_uring versions of wrapped_read(), wrapped_write() and
+// wrapped_writev().  uring_writev() trims the iovecs at "iov" in
+// place as they go out.
+static int uring_read(IoUring *ring, int fd, string *buf);
+static int uring_write(IoUring *ring, int fd, const char *buf, size_t len);
+static int64_t uring_writev(IoUring *ring, int fd, struct iovec *iov,
+                            int iovcnt);
+
+// Writes out the "iovcnt" iovecs at "iov", which may be trimmed in
+// place, with writev() or through "ring" if it isn't nullptr.
+// Returns the number of bytes written.
+static int64_t writev_window(IoUring *ring, int fd, struct iovec *iov,
+                             int iovcnt);
+
+// Drops the first "n" bytes from the front of the "*iovcnt" iovecs at
+// "*iov", skipping past any that are used up and trimming the first
+// one left in place.
+static void consume_iovecs(struct iovec **iov, int *iovcnt, size_t n);
+
+// Returns the total number of bytes the "iovcnt" iovecs at "iov"
+// point at.
+static size_t iovecs_size(const struct iovec *iov, int iovcnt);
+
 bool is_path_safe(const string &root_dir, const string &test_file) {
   // rootdir is a directory path. testfile is a path to a file.
   // return whether or not testfile is within rootdir.
@@ -187,6 +280,185 @@ string decode_URI(const string &from) {
   return retstr;
 }
 
+string encode_URI(const string &from) {
+  static const char kHexDigits[] = "0123456789ABCDEF";
+  string retstr;
+  for (unsigned char c : from) {
+    if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      retstr.append(1, c);
+    } else if (c == ' ') {
+      retstr.append(1, '+');
+    } else {
+      retstr.append(1, '%');
+      retstr.append(1, kHexDigits[c >> 4]);
+      retstr.append(1, kHexDigits[c & 0xF]);
+    }
+  }
+  return retstr;
+}
+
+// Parses "str" as an unsigned decimal number into "num".  Returns
+// false if str is empty, has anything but digits in it or overflows.
+static bool parse_uint64(const string &str, uint64_t *num) {
+  if (str.empty() || str.size() > 19) {
+    return false;
+  }
+  uint64_t n = 0;
+  for (char c : str) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    n = n * 10 + (c - '0');
+  }
+  *num = n;
+  return true;
+}
+
+RangeResult parse_range_header(const string &value, uint64_t file_size,
+                               vector<ByteRange> *ranges) {
+  ranges->clear();
+  string spec = value;
+  boost::algorithm::trim(spec);
+  if (!boost::algorithm::istarts_with(spec, "bytes=")) {
+    return kRangeIgnored;
+  }
+
+  vector<string> specs;
+  boost::split(specs, spec.substr(6), boost::is_any_of(","));
+  if (specs.size() > kMaxByteRanges) {
+    return kRangeIgnored;
+  }
+  for (string &s : specs) {
+    boost::algorithm::trim(s);
+    size_t dash = s.find('-');
+    if (dash == string::npos) {
+      return kRangeIgnored;
+    }
+    string first_str = s.substr(0, dash), last_str = s.substr(dash + 1);
+    uint64_t first, last;
+
+    if (first_str.empty()) {
+      // "-N" is the last N bytes of the file.
+      uint64_t suffix;
+      if (!parse_uint64(last_str, &suffix)) {
+        return kRangeIgnored;
+      }
+      if (suffix == 0 || file_size == 0) {
+        continue;
+      }
+      first = (suffix < file_size) ? file_size - suffix : 0;
+      last = file_size - 1;
+    } else {
+      // "N-" runs to the end of the file, "N-M" is bytes N to M.
+      if (!parse_uint64(first_str, &first)) {
+        return kRangeIgnored;
+      }
+      last = file_size - 1;
+      if (!last_str.empty()) {
+        if (!parse_uint64(last_str, &last) || last < first) {
+          return kRangeIgnored;
+        }
+      }
+      if (first >= file_size) {
+        continue;
+      }
+      if (last >= file_size) {
+        last = file_size - 1;
+      }
+    }
+
+    ByteRange range;
+    range.first = first;
+    range.last = last;
+    ranges->push_back(range);
+  }
+  return ranges->empty() ? kRangeUnsatisfiable : kRangeSatisfiable;
+}
+
+string make_etag(const struct stat &st) {
+  char etag[128];
+  snprintf(etag, sizeof(etag), "\"%llx-%llx-%llx.%lx\"",
+           static_cast<unsigned long long>(st.st_ino),
+           static_cast<unsigned long long>(st.st_size),
+           static_cast<unsigned long long>(st.st_mtim.tv_sec),
+           static_cast<long>(st.st_mtim.tv_nsec));
+  return etag;
+}
+
+string format_http_date(time_t t) {
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  char date[64];
+  strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return date;
+}
+
+bool parse_http_date(const string &date, time_t *t) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  const char *rest = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S", &tm);
+  if (rest == nullptr) {
+    return false;
+  }
+  string zone(rest);
+  boost::algorithm::trim(zone);
+  if (!boost::algorithm::iequals(zone, "gmt")) {
+    return false;
+  }
+  *t = timegm(&tm);
+  return true;
+}
+
+bool etag_matches(const string &if_none_match, const string &etag) {
+  vector<string> tags;
+  boost::split(tags, if_none_match, boost::is_any_of(","));
+  for (string &tag : tags) {
+    boost::algorithm::trim(tag);
+    if (boost::algorithm::istarts_with(tag, "w/")) {
+      tag = tag.substr(2);
+    }
+    if (tag == "*" || tag == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t find_header_end(const char *data, size_t len, size_t from) {
+  // Every terminator ends in a '\n', and a header has one of those per
+  // line, so look for '\n's and check the three bytes in front of
+  // each.
+  size_t pos = from + 3;
+#ifdef __SSE2__
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; pos + 16 <= len; pos += 16) {
+    __m128i chunk =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+    while (mask != 0) {
+      size_t at = pos + __builtin_ctz(mask);
+      if (header_end_at(data, at, from)) {
+        return at - 3;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+  while (pos < len) {
+    const char *nl =
+      static_cast<const char *>(memchr(data + pos, '\n', len - pos));
+    if (nl == nullptr) {
+      break;
+    }
+    pos = nl - data;
+    if (header_end_at(data, pos, from)) {
+      return pos - 3;
+    }
+    pos++;
+  }
+  return string::npos;
+}
+
 void URLParser::parse(const string &url) {
   url_ = url;
 
@@ -219,29 +491,71 @@ void URLParser::parse(const string &url) {
   }
 }
 
+IoBackend set_io_backend(IoBackend backend) {
+  if (backend == kIoUringIo && !IoUring::supported()) {
+    backend = kBlockingIo;
+  }
+  g_io_backend = backend;
+  return backend;
+}
+
+IoBackend io_backend() {
+  return g_io_backend;
+}
+
+bool set_socket_timeouts(int fd, int read_timeout_ms, int write_timeout_ms) {
+  struct timeval rtv, wtv;
+  rtv.tv_sec = read_timeout_ms / 1000;
+  rtv.tv_usec = (read_timeout_ms % 1000) * 1000;
+  wtv.tv_sec = write_timeout_ms / 1000;
+  wtv.tv_usec = (write_timeout_ms % 1000) * 1000;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &rtv, sizeof(rtv)) != 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &wtv, sizeof(wtv)) != 0) {
+    return false;
+  }
+  t_socket_timeouts.fd = fd;
+  t_socket_timeouts.read_ms = read_timeout_ms;
+  t_socket_timeouts.write_ms = write_timeout_ms;
+  return true;
+}
+
 int wrapped_read(int fd, string *buf) {
+  IoUring *ring = thread_ring();
+  if (ring != nullptr) {
+    return uring_read(ring, fd, buf);
+  }
+
   int res;
   char buffer[1024];
   while (1) {
     res = read(fd, buffer, 1024);
     if (res == -1) {
-      if ((errno == EAGAIN) || (errno == EINTR))
+      // EAGAIN means the socket's receive timeout expired.
+      if (errno == EINTR)
         continue;
     }
     break;
   }
-  *buf += string(buffer, res);
+  if (res > 0) {
+    buf->append(buffer, res);
+  }
   return res;
 }
 
 int wrapped_write(int fd, const string& buf)  {
+  IoUring *ring = thread_ring();
+  if (ring != nullptr) {
+    return uring_write(ring, fd, buf.c_str(), buf.size());
+  }
+
   int res;
   size_t written_so_far = 0;
 
   while (written_so_far < buf.size()) {
     res = write(fd, buf.c_str() + written_so_far, buf.size() - written_so_far);
     if (res == -1) {
-      if ((errno == EAGAIN) || (errno == EINTR))
+      // EAGAIN means the socket's send timeout expired.
+      if (errno == EINTR)
         continue;
       break;
     }
@@ -252,6 +566,339 @@ int wrapped_write(int fd, const string& buf)  {
   return written_so_far;
 }
 
+int64_t wrapped_writev(int fd, const struct iovec *iov, int iovcnt) {
+  // Copy the iovecs onto the stack a window at a time, since partial
+  // writes trim them and the caller's are const.
+  IoUring *ring = thread_ring();
+  struct iovec window[kWritevWindow];
+  int64_t written_so_far = 0;
+  while (iovcnt > 0) {
+    int n = (iovcnt < kWritevWindow) ? iovcnt : kWritevWindow;
+    memcpy(window, iov, n * sizeof(struct iovec));
+    size_t len = iovecs_size(window, n);
+    int64_t res = writev_window(ring, fd, window, n);
+    written_so_far += res;
+    if (res != static_cast<int64_t>(len)) {
+      break;
+    }
+    iov += n;
+    iovcnt -= n;
+  }
+  return written_so_far;
+}
+
+int64_t wrapped_sendfile(int out_fd, int in_fd, off_t offset, size_t count) {
+  size_t sent_so_far = 0;
+  while (sent_so_far < count) {
+    ssize_t res = sendfile(out_fd, in_fd, &offset, count - sent_so_far);
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (res == 0)  // the file got shorter under us
+      break;
+    sent_so_far += res;
+  }
+  return sent_so_far;
+}
+
+int wrapped_write_read(int fd, const string &buf, string *out) {
+  struct iovec iov;
+  iov.iov_base = const_cast<char *>(buf.data());
+  iov.iov_len = buf.size();
+  return wrapped_writev_read(fd, &iov, 1, out);
+}
+
+int wrapped_writev_read(int fd, const struct iovec *iov, int iovcnt,
+                        string *out) {
+  size_t total = iovecs_size(iov, iovcnt);
+  IoUring *ring = thread_ring();
+  if (ring == nullptr || iovcnt > kWritevWindow) {
+    if (wrapped_writev(fd, iov, iovcnt) != static_cast<int64_t>(total)) {
+      return -1;
+    }
+    return wrapped_read(fd, out);
+  }
+
+  // Submit the write with the read linked behind it, so the kernel
+  // starts the read as soon as the write completes.  The iovecs have
+  // to stay put until then, and be trimmed if the write comes up
+  // short, so they are copied onto the stack.  Each of them gets
+  // a linked timeout of its own if the socket has one.
+  int write_timeout_ms = thread_timeout_ms(fd, false);
+  int read_timeout_ms = thread_timeout_ms(fd, true);
+  struct __kernel_timespec write_ts, read_ts;
+  struct iovec rest[kWritevWindow];
+  memcpy(rest, iov, iovcnt * sizeof(struct iovec));
+  struct iovec *pending = rest;
+  unsigned num_sqes = 0;
+  struct io_uring_sqe *wsqe = ring->get_sqe();
+  struct io_uring_sqe *wtsqe =
+    (write_timeout_ms > 0) ? ring->get_sqe() : nullptr;
+  struct io_uring_sqe *rsqe = ring->get_sqe();
+  struct io_uring_sqe *rtsqe =
+    (read_timeout_ms > 0) ? ring->get_sqe() : nullptr;
+  if (wsqe == nullptr || rsqe == nullptr ||
+      (write_timeout_ms > 0 && wtsqe == nullptr) ||
+      (read_timeout_ms > 0 && rtsqe == nullptr)) {
+    return -1;
+  }
+  IoUring::prep_writev(wsqe, fd, rest, iovcnt, kWriteTag);
+  wsqe->flags |= IOSQE_IO_LINK;
+  num_sqes++;
+  if (wtsqe != nullptr) {
+    ms_to_timespec(write_timeout_ms, &write_ts);
+    IoUring::prep_link_timeout(wtsqe, &write_ts, kWriteTimeoutTag);
+    wtsqe->flags |= IOSQE_IO_LINK;
+    num_sqes++;
+  }
+  if (ring->has_fixed_buffer()) {
+    ring->prep_read_fixed(rsqe, fd, ring->fixed_buffer_size(), kReadTag);
+  } else {
+    IoUring::prep_read(rsqe, fd, ring->fixed_buffer(),
+                       ring->fixed_buffer_size(), kReadTag);
+  }
+  num_sqes++;
+  if (rtsqe != nullptr) {
+    rsqe->flags |= IOSQE_IO_LINK;
+    ms_to_timespec(read_timeout_ms, &read_ts);
+    IoUring::prep_link_timeout(rtsqe, &read_ts, kReadTimeoutTag);
+    num_sqes++;
+  }
+  if (ring->submit(num_sqes) < 0) {
+    return -1;
+  }
+
+  int write_res = 0, read_res = 0;
+  bool write_timed_out = false, read_timed_out = false;
+  for (unsigned i = 0; i < num_sqes; i++) {
+    struct io_uring_cqe cqe;
+    if (!ring->wait_cqe(&cqe)) {
+      return -1;
+    }
+    if (cqe.user_data == kWriteTag) {
+      write_res = cqe.res;
+    } else if (cqe.user_data == kReadTag) {
+      read_res = cqe.res;
+    } else if (cqe.user_data == kWriteTimeoutTag) {
+      write_timed_out = (cqe.res == -ETIME);
+    } else {
+      read_timed_out = (cqe.res == -ETIME);
+    }
+  }
+  if ((write_timed_out && write_res < 0) ||
+      (read_timed_out && read_res < 0)) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  // A short or interrupted write cancels the linked read, so finish
+  // the write and then do the read on its own.
+  if (write_res < 0 && write_res != -EINTR) {
+    errno = -write_res;
+    return -1;
+  }
+  size_t written = (write_res > 0) ? write_res : 0;
+  if (written < total) {
+    consume_iovecs(&pending, &iovcnt, written);
+    if (uring_writev(ring, fd, pending, iovcnt) !=
+        static_cast<int64_t>(total - written)) {
+      return -1;
+    }
+  }
+  if (read_res == -ECANCELED || read_res == -EINTR) {
+    return uring_read(ring, fd, out);
+  }
+  if (read_res < 0) {
+    errno = -read_res;
+    return -1;
+  }
+  out->append(ring->fixed_buffer(), read_res);
+  return read_res;
+}
+
+static IoUring *thread_ring() {
+  if (g_io_backend != kIoUringIo) {
+    return nullptr;
+  }
+  static thread_local unique_ptr<IoUring> ring;
+  static thread_local bool tried = false;
+  if (!tried) {
+    tried = true;
+    unique_ptr<IoUring> r(new IoUring());
+    if (r->init(kIoUringEntries, kIoUringBufferSize)) {
+      ring = std::move(r);
+    }
+  }
+  return ring.get();
+}
+
+static bool header_end_at(const char *data, size_t pos, size_t from) {
+  return pos >= from + 3 && data[pos - 1] == '\r' &&
+         data[pos - 2] == '\n' && data[pos - 3] == '\r';
+}
+
+static int thread_timeout_ms(int fd, bool read) {
+  if (t_socket_timeouts.fd != fd) {
+    return 0;
+  }
+  return read ? t_socket_timeouts.read_ms : t_socket_timeouts.write_ms;
+}
+
+static void ms_to_timespec(int ms, struct __kernel_timespec *ts) {
+  ts->tv_sec = ms / 1000;
+  ts->tv_nsec = (ms % 1000) * 1000000LL;
+}
+
+static int uring_run(IoUring *ring, struct io_uring_sqe *sqe,
+                     int timeout_ms, uint64_t timeout_tag) {
+  struct __kernel_timespec ts;
+  unsigned num_sqes = 1;
+  if (timeout_ms > 0) {
+    struct io_uring_sqe *tsqe = ring->get_sqe();
+    if (tsqe != nullptr) {
+      sqe->flags |= IOSQE_IO_LINK;
+      ms_to_timespec(timeout_ms, &ts);
+      IoUring::prep_link_timeout(tsqe, &ts, timeout_tag);
+      num_sqes++;
+    }
+  }
+  if (ring->submit(num_sqes) < 0) {
+    return -EIO;
+  }
+
+  int res = -EIO;
+  bool timed_out = false;
+  for (unsigned i = 0; i < num_sqes; i++) {
+    struct io_uring_cqe cqe;
+    if (!ring->wait_cqe(&cqe)) {
+      return -EIO;
+    }
+    if (cqe.user_data == timeout_tag) {
+      timed_out = (cqe.res == -ETIME);
+    } else {
+      res = cqe.res;
+    }
+  }
+  return (timed_out && res < 0) ? -EAGAIN : res;
+}
+
+static int uring_read(IoUring *ring, int fd, string *buf) {
+  while (1) {
+    struct io_uring_sqe *sqe = ring->get_sqe();
+    if (sqe == nullptr) {
+      return -1;
+    }
+    if (ring->has_fixed_buffer()) {
+      ring->prep_read_fixed(sqe, fd, ring->fixed_buffer_size(), kReadTag);
+    } else {
+      IoUring::prep_read(sqe, fd, ring->fixed_buffer(),
+                         ring->fixed_buffer_size(), kReadTag);
+    }
+    int res = uring_run(ring, sqe, thread_timeout_ms(fd, true),
+                        kReadTimeoutTag);
+    if (res == -EINTR) {
+      continue;
+    }
+    if (res < 0) {
+      errno = -res;
+      return -1;
+    }
+    buf->append(ring->fixed_buffer(), res);
+    return res;
+  }
+}
+
+static int uring_write(IoUring *ring, int fd, const char *buf, size_t len) {
+  size_t written_so_far = 0;
+  while (written_so_far < len) {
+    struct io_uring_sqe *sqe = ring->get_sqe();
+    if (sqe == nullptr) {
+      break;
+    }
+    IoUring::prep_write(sqe, fd, buf + written_so_far,
+                        len - written_so_far, kWriteTag);
+    int res = uring_run(ring, sqe, thread_timeout_ms(fd, false),
+                        kWriteTimeoutTag);
+    if (res == -EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      errno = -res;
+      break;
+    }
+    written_so_far += res;
+  }
+  return written_so_far;
+}
+
+static int64_t uring_writev(IoUring *ring, int fd, struct iovec *iov,
+                            int iovcnt) {
+  int64_t written_so_far = 0;
+  while (iovcnt > 0) {
+    struct io_uring_sqe *sqe = ring->get_sqe();
+    if (sqe == nullptr) {
+      break;
+    }
+    IoUring::prep_writev(sqe, fd, iov, iovcnt, kWriteTag);
+    int res = uring_run(ring, sqe, thread_timeout_ms(fd, false),
+                        kWriteTimeoutTag);
+    if (res == -EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      errno = -res;
+      break;
+    }
+    written_so_far += res;
+    consume_iovecs(&iov, &iovcnt, res);
+  }
+  return written_so_far;
+}
+
+static int64_t writev_window(IoUring *ring, int fd, struct iovec *iov,
+                             int iovcnt) {
+  if (ring != nullptr) {
+    return uring_writev(ring, fd, iov, iovcnt);
+  }
+
+  int64_t written_so_far = 0;
+  while (iovcnt > 0) {
+    ssize_t res = writev(fd, iov, iovcnt);
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (res == 0)
+      break;
+    written_so_far += res;
+    consume_iovecs(&iov, &iovcnt, res);
+  }
+  return written_so_far;
+}
+
+static void consume_iovecs(struct iovec **iov, int *iovcnt, size_t n) {
+  while (*iovcnt > 0 && n >= (*iov)[0].iov_len) {
+    n -= (*iov)[0].iov_len;
+    (*iov)++;
+    (*iovcnt)--;
+  }
+  if (*iovcnt > 0) {
+    (*iov)[0].iov_base = static_cast<char *>((*iov)[0].iov_base) + n;
+    (*iov)[0].iov_len -= n;
+  }
+}
+
+static size_t iovecs_size(const struct iovec *iov, int iovcnt) {
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
 bool connect_to_server(const string &host_name, uint16_t port_num,
                      int *client_fd) {
   struct addrinfo hints, *results, *r;
@@ -15,9 +15,14 @@
 #ifndef HTTPUTILS_H_
 #define HTTPUTILS_H_
 
+#include <sys/stat.h>   // for struct stat
+#include <sys/types.h>  // for off_t
+#include <time.h>
+#include <sys/uio.h>    // for struct iovec
 #include <cstdint>
 
 #include <string>
+#include <vector>
 #include <utility>
 #include <map>
 
@@ -59,6 +64,11 @@ std::string escape_html(const std::string &from);
 //
 std::string decode_URI(const std::string &from);
 
+// The reverse of decode_URI(), for putting a value into a query
+// string: spaces become "+", and everything but letters, digits and
+// "-_.~" is %-escaped.
+std::string encode_URI(const std::string &from);
+
 // A URL that's part of a web request has the following structure:
 //
 //   /foo/bar/baz?field=value&field2=value2
@@ -88,6 +98,97 @@ class URLParser {
   std::map<std::string, std::string> args_;
 };
 
+// One byte range asked for in a "Range:" request header, as the
+// offsets of its first and last bytes (inclusive).
+struct ByteRange {
+  uint64_t first;
+  uint64_t last;
+};
+
+// What parse_range_header() made of a "Range:" header.
+enum RangeResult {
+  // There was no header, or it was malformed or asked for more
+  // ranges than we serve, so it should be ignored and the whole
+  // file sent.
+  kRangeIgnored,
+
+  // At least one range overlaps the file; send those ranges.
+  kRangeSatisfiable,
+
+  // None of the ranges overlap the file.
+  kRangeUnsatisfiable
+};
+
+// Parses the value of a "Range:" request header (RFC 7233), e.g.
+// "bytes=0-499,-500", for a file that is "file_size" bytes long.
+// Ranges that reach past the end of the file are cut short, and ranges
+// that start past it are dropped.  If the result is kRangeSatisfiable,
+// the remaining ranges are returned through "ranges" in the order
+// they were asked for.
+RangeResult parse_range_header(const std::string &value, uint64_t file_size,
+                               std::vector<ByteRange> *ranges);
+
+// Returns a strong ETag for the file described by "st", made from its
+// inode number, size and modification time, e.g.
+// "\"1a2b-12c0-6351d0a4.3b9ac9ff\"".  The tag changes whenever the
+// file does.  It only uses lowercase characters, since HttpConnection
+// lowercases request headers.
+std::string make_etag(const struct stat &st);
+
+// Formats "t" as an HTTP-date (RFC 7231), e.g.
+// "Sun, 06 Nov 1994 08:49:37 GMT", for Last-modified headers.
+std::string format_http_date(time_t t);
+
+// Parses an HTTP-date, as found in an If-modified-since header, into
+// "t".  Case doesn't matter.  Returns false if "date" isn't one.
+bool parse_http_date(const std::string &date, time_t *t);
+
+// Returns true if the value of an "If-none-match:" header lists
+// "etag", or is "*".  Weak tags match their strong equivalents, as
+// RFC 7232 asks for on GET requests.
+bool etag_matches(const std::string &if_none_match, const std::string &etag);
+
+// Returns the offset of the first "\r\n\r\n", which ends a request
+// header, that starts at or after offset "from" in the "len" bytes at
+// "data", or std::string::npos if there is none.  A caller that gets
+// more data can resume the search at len - 3 instead of starting
+// over, since only the last three bytes can begin a terminator that
+// isn't complete yet.  Uses SSE2 to check 16 bytes at a time where
+// the compiler provides it.
+size_t find_header_end(const char *data, size_t len, size_t from);
+
+// The I/O engines that wrapped_read(), wrapped_write(),
+// wrapped_write_read() and ServerSocket::accept_client() can run on.
+enum IoBackend {
+  // Plain blocking read(), write() and accept() system calls.
+  kBlockingIo,
+
+  // A per-thread io_uring.  Reads land in a registered buffer, a write
+  // and the read that follows it are submitted together as linked
+  // SQEs, and listening sockets use multishot accept.
+  kIoUringIo
+};
+
+// Selects the I/O backend for the whole process; should be called
+// before any sockets are created.  If io_uring is requested but the
+// kernel doesn't support it, we fall back to kBlockingIo.  Returns
+// the backend that is now in effect.
+IoBackend set_io_backend(IoBackend backend);
+
+// Returns the I/O backend currently in effect.
+IoBackend io_backend();
+
+// Bounds how long the wrapped_* calls below wait on the socket "fd":
+// a read that gets no data for "read_timeout_ms" milliseconds, or a
+// write or sendfile that can't make progress for "write_timeout_ms",
+// gives up and fails with errno set to EAGAIN.  Zero means wait
+// forever.  The timeouts are set with SO_RCVTIMEO and SO_SNDTIMEO.
+// io_uring ignores those, so the calling thread also remembers them
+// (for the last socket it set them on) and adds a linked timeout to
+// every io_uring operation on "fd".  Returns false if the socket
+// options couldn't be set.
+bool set_socket_timeouts(int fd, int read_timeout_ms, int write_timeout_ms);
+
 // A wrapper around the write() system call that shields the caller
 // from dealing with the ugly issues of partial writes, EINTR, EAGAIN,
 // and so on.
@@ -99,6 +200,15 @@ class URLParser {
 // was encountered, like the connection being dropped.
 int wrapped_write(int fd, const std::string& buf);
 
+// Like wrapped_write(), but gathers the bytes to write from the
+// "iovcnt" buffers described by "iov" with writev(), so that pieces
+// kept in separate places (e.g. a response's header and its body)
+// go out together without first being copied into one string.
+// Partial writes are picked up where they left off.  Returns the
+// total number of bytes written, which is less than the sum of the
+// iov_len's only if a fatal error was encountered.
+int64_t wrapped_writev(int fd, const struct iovec *iov, int iovcnt);
+
 // A wrapper around the read() system call that shields the caller
 // from dealing with the ugly issues of partial reads, EINTR, EAGAIN,
 // and so on.
@@ -110,6 +220,29 @@ int wrapped_write(int fd, const std::string& buf);
 // than requested.
 int wrapped_read(int fd, std::string *out);
 
+// Writes all of "buf" to fd like wrapped_write(), then reads from fd
+// onto the end of "out" like wrapped_read().  Under kIoUringIo the
+// write and the read are submitted together as linked SQEs, so a
+// request/response round trip costs a single system call.
+//
+// Returns the number of bytes read, 0 on EOF, or -1 if either the
+// write or the read failed.
+int wrapped_write_read(int fd, const std::string &buf, std::string *out);
+
+// The same as wrapped_write_read(), but writes out the buffers
+// described by "iov" like wrapped_writev() does.
+int wrapped_writev_read(int fd, const struct iovec *iov, int iovcnt,
+                        std::string *out);
+
+// A wrapper around the sendfile() system call, in the same spirit as
+// wrapped_write(): sends "count" bytes of the file "in_fd", starting
+// at "offset", to the socket "out_fd".  The data goes straight from
+// the page cache to the socket without being copied into our address
+// space.  Blocks until everything has been sent or a fatal error
+// occurs, and returns the number of bytes sent.  (io_uring has no
+// sendfile operation, so this is the same under either backend.)
+int64_t wrapped_sendfile(int out_fd, int in_fd, off_t offset, size_t count);
+
 // Below is used to test server socket
 
 // A convenience routine to manufacture a (blocking) socket to the
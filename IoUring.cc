@@ -0,0 +1,264 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <errno.h>
+#include <sys/mman.h>     // for mmap(), munmap()
+#include <sys/syscall.h>  // for __NR_io_uring_setup, etc.
+#include <sys/uio.h>      // for struct iovec
+#include <unistd.h>       // for syscall(), close()
+#include <cstring>        // for memset()
+
+#include "./IoUring.h"
+
+namespace searchserver {
+
+// glibc has no wrappers for the io_uring system calls.
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                  min_complete, flags, nullptr, 0));
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode,
+                                 const void *arg, unsigned nr_args) {
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode,
+                                  arg, nr_args));
+}
+
+IoUring::IoUring()
+  : ring_fd_(-1), sq_ring_(MAP_FAILED), sq_ring_size_(0),
+    sq_head_(nullptr), sq_tail_(nullptr), sq_mask_(nullptr),
+    sq_array_(nullptr), sq_entries_(0), sqes_(nullptr), sqes_size_(0),
+    sqe_tail_(0), cq_ring_(MAP_FAILED), cq_ring_size_(0),
+    cq_head_(nullptr), cq_tail_(nullptr), cq_mask_(nullptr),
+    cqes_(nullptr), fixed_buffer_(nullptr), fixed_buffer_size_(0),
+    fixed_buffer_registered_(false) { }
+
+IoUring::~IoUring() {
+  teardown();
+  delete[] fixed_buffer_;
+}
+
+bool IoUring::supported() {
+  IoUring probe;
+  return probe.init(2, 0);
+}
+
+bool IoUring::init(unsigned entries, size_t fixed_buffer_size) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = sys_io_uring_setup(entries, &params);
+  if (ring_fd_ < 0) {
+    ring_fd_ = -1;
+    return false;
+  }
+
+  // Map in the submission and completion rings.  Newer kernels let
+  // both live in a single mapping.
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes +
+                  params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    if (cq_ring_size_ > sq_ring_size_) {
+      sq_ring_size_ = cq_ring_size_;
+    }
+    cq_ring_size_ = sq_ring_size_;
+  }
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    teardown();
+    return false;
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      teardown();
+      return false;
+    }
+  }
+
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    teardown();
+    return false;
+  }
+  sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(sq_ring_);
+  sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  sq_entries_ = params.sq_entries;
+  sqe_tail_ = *sq_tail_;
+
+  char *cq = static_cast<char *>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  // Register the fixed buffer, so that reads into it skip the
+  // per-request page pinning.  This can fail if we are over our
+  // locked memory limit, in which case the ring still works.
+  if (fixed_buffer_size > 0) {
+    fixed_buffer_ = new char[fixed_buffer_size];
+    fixed_buffer_size_ = fixed_buffer_size;
+    struct iovec iov;
+    iov.iov_base = fixed_buffer_;
+    iov.iov_len = fixed_buffer_size_;
+    fixed_buffer_registered_ =
+      (sys_io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS,
+                             &iov, 1) == 0);
+  }
+  return true;
+}
+
+struct io_uring_sqe *IoUring::get_sqe() {
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= sq_entries_) {
+    return nullptr;
+  }
+  unsigned idx = sqe_tail_ & *sq_mask_;
+  struct io_uring_sqe *sqe = &sqes_[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[idx] = idx;
+  sqe_tail_++;
+  return sqe;
+}
+
+int IoUring::submit(unsigned wait_nr) {
+  unsigned to_submit = sqe_tail_ - *sq_tail_;
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  unsigned flags = (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0;
+  while (1) {
+    int res = sys_io_uring_enter(ring_fd_, to_submit, wait_nr, flags);
+    if (res < 0) {
+      if (errno == EINTR) {
+        // Anything we handed over before being interrupted has
+        // already been consumed; just wait for the completions.
+        to_submit = 0;
+        continue;
+      }
+      return -errno;
+    }
+    return res;
+  }
+}
+
+bool IoUring::wait_cqe(struct io_uring_cqe *cqe) {
+  while (1) {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+      *cqe = cqes_[head & *cq_mask_];
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+      return true;
+    }
+    if (sys_io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+        errno != EINTR) {
+      return false;
+    }
+  }
+}
+
+void IoUring::prep_read(struct io_uring_sqe *sqe, int fd, void *buf,
+                        unsigned len, uint64_t user_data) {
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = len;
+  sqe->off = static_cast<uint64_t>(-1);  // use (and advance) the file offset
+  sqe->user_data = user_data;
+}
+
+void IoUring::prep_read_fixed(struct io_uring_sqe *sqe, int fd, unsigned len,
+                              uint64_t user_data) const {
+  prep_read(sqe, fd, fixed_buffer_, len, user_data);
+  sqe->opcode = IORING_OP_READ_FIXED;
+  sqe->buf_index = 0;
+}
+
+void IoUring::prep_write(struct io_uring_sqe *sqe, int fd, const void *buf,
+                         unsigned len, uint64_t user_data) {
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = len;
+  sqe->off = static_cast<uint64_t>(-1);
+  sqe->user_data = user_data;
+}
+
+void IoUring::prep_writev(struct io_uring_sqe *sqe, int fd,
+                          const struct iovec *iov, unsigned iovcnt,
+                          uint64_t user_data) {
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(iov);
+  sqe->len = iovcnt;
+  sqe->off = static_cast<uint64_t>(-1);
+  sqe->user_data = user_data;
+}
+
+void IoUring::prep_accept(struct io_uring_sqe *sqe, int listen_fd,
+                          int flags, bool multishot, uint64_t user_data) {
+  // We don't ask for the peer address here: with multishot accept
+  // every completion would share the same buffer.  Customers can
+  // use getpeername() on the accepted socket instead.  "flags" are
+  // the accept4() flags for the new socket.
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd;
+  sqe->ioprio = multishot ? IORING_ACCEPT_MULTISHOT : 0;
+  sqe->accept_flags = flags;
+  sqe->user_data = user_data;
+}
+
+void IoUring::prep_link_timeout(struct io_uring_sqe *sqe,
+                                const struct __kernel_timespec *ts,
+                                uint64_t user_data) {
+  sqe->opcode = IORING_OP_LINK_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<uint64_t>(ts);
+  sqe->len = 1;
+  sqe->user_data = user_data;
+}
+
+void IoUring::teardown() {
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqes_size_);
+    sqes_ = nullptr;
+  }
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  cq_ring_ = MAP_FAILED;
+  if (sq_ring_ != MAP_FAILED) {
+    munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = MAP_FAILED;
+  }
+  if (ring_fd_ != -1) {
+    close(ring_fd_);  // also unregisters the fixed buffer
+    ring_fd_ = -1;
+  }
+}
+
+}  // namespace searchserver
@@ -0,0 +1,129 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef IOURING_H_
+#define IOURING_H_
+
+#include <linux/io_uring.h>  // for io_uring_sqe, io_uring_cqe, etc.
+#include <linux/time_types.h>  // for __kernel_timespec
+#include <sys/types.h>
+#include <sys/uio.h>       // for struct iovec
+#include <cstdint>
+
+namespace searchserver {
+
+// An IoUring is a thin wrapper around a single Linux io_uring instance,
+// talking to the kernel directly through the io_uring_setup() and
+// io_uring_enter() system calls.  Customers grab submission queue
+// entries (SQEs) with get_sqe(), fill them in with one of the prep_*
+// helpers, submit them all at once with submit(), and then pick up
+// the completions (CQEs) with wait_cqe().
+//
+// An IoUring is not thread safe; each thread that wants to use
+// io_uring should create its own.
+class IoUring {
+ public:
+  IoUring();
+  virtual ~IoUring();
+
+  // Returns true if this kernel lets us create an io_uring at all.
+  static bool supported();
+
+  // Sets up the ring with room for "entries" SQEs.  If
+  // "fixed_buffer_size" is non-zero, a buffer of that size is also
+  // allocated and registered with the kernel so that it can be used
+  // with prep_read_fixed().  Returns false if the ring couldn't be
+  // created; failing to register the buffer is not fatal, and is
+  // reported by has_fixed_buffer().
+  bool init(unsigned entries, size_t fixed_buffer_size);
+
+  // Returns the next free SQE, zeroed out, or nullptr if the
+  // submission queue is full.  The SQE is handed to the kernel by
+  // the next call to submit().
+  struct io_uring_sqe *get_sqe();
+
+  // Submits every SQE handed out since the last submit(), and waits
+  // until at least "wait_nr" completions are available.  Returns the
+  // number of SQEs the kernel consumed, or -errno on failure.
+  int submit(unsigned wait_nr);
+
+  // Removes the next completion from the completion queue and copies
+  // it into "cqe", waiting for one to arrive if necessary.  Returns
+  // false if waiting failed.
+  bool wait_cqe(struct io_uring_cqe *cqe);
+
+  // The registered buffer, if there is one.
+  bool has_fixed_buffer() const { return fixed_buffer_registered_; }
+  char *fixed_buffer() const { return fixed_buffer_; }
+  size_t fixed_buffer_size() const { return fixed_buffer_size_; }
+
+  // Helpers that fill in an SQE for the corresponding operation.
+  // "user_data" is passed back untouched in the matching CQE.
+  static void prep_read(struct io_uring_sqe *sqe, int fd, void *buf,
+                        unsigned len, uint64_t user_data);
+  void prep_read_fixed(struct io_uring_sqe *sqe, int fd, unsigned len,
+                       uint64_t user_data) const;
+  static void prep_write(struct io_uring_sqe *sqe, int fd, const void *buf,
+                         unsigned len, uint64_t user_data);
+  static void prep_writev(struct io_uring_sqe *sqe, int fd,
+                          const struct iovec *iov, unsigned iovcnt,
+                          uint64_t user_data);
+  static void prep_accept(struct io_uring_sqe *sqe, int listen_fd,
+                          int flags, bool multishot, uint64_t user_data);
+
+  // Fills in a timeout for the SQE before this one, which must have
+  // IOSQE_IO_LINK set: if that operation hasn't completed after "ts",
+  // it is cancelled and completes with -ECANCELED, and this one
+  // completes with -ETIME.  "ts" must stay valid until submit().
+  static void prep_link_timeout(struct io_uring_sqe *sqe,
+                                const struct __kernel_timespec *ts,
+                                uint64_t user_data);
+
+  IoUring(const IoUring& other) = delete;
+  IoUring& operator=(const IoUring& other) = delete;
+
+ private:
+  // Unmaps the rings and closes ring_fd_.
+  void teardown();
+
+  int ring_fd_;
+
+  // The submission queue ring, shared with the kernel.
+  void *sq_ring_;
+  size_t sq_ring_size_;
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned *sq_mask_;
+  unsigned *sq_array_;
+  unsigned sq_entries_;
+  struct io_uring_sqe *sqes_;
+  size_t sqes_size_;
+
+  // The SQ tail as seen by us; published to the kernel in submit().
+  unsigned sqe_tail_;
+
+  // The completion queue ring, shared with the kernel.  Might be the
+  // same mapping as sq_ring_.
+  void *cq_ring_;
+  size_t cq_ring_size_;
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned *cq_mask_;
+  struct io_uring_cqe *cqes_;
+
+  char *fixed_buffer_;
+  size_t fixed_buffer_size_;
+  bool fixed_buffer_registered_;
+};
+
+}  // namespace searchserver
+
+#endif  // IOURING_H_
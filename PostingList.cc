@@ -0,0 +1,359 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "./PostingList.h"
+
+using std::vector;
+
+namespace searchserver {
+
+// A block is four lanes of this many values each.
+static const size_t kLaneLength = PostingList::kBlockSize / 4;
+
+// The SSE2 decoder stores a DocID and a count as one pair of lanes.
+static_assert(sizeof(Posting) == 2 * sizeof(uint32_t),
+              "Posting must be a packed (doc_id, count) pair");
+
+// Returns how many bits it takes to hold "value".
+static int BitsFor(uint32_t value);
+
+// Appends the kBlockSize "values", packed "bits" to a value, to "out".
+// Value i goes in lane i % 4, at bit (i / 4) * bits of that lane, and
+// word j of lane l is the (4 * j + l)'th 32-bit word written.
+static void PackBlock(const uint32_t *values, int bits, vector<uint8_t> *out);
+
+// Reverses PackBlock(), writing the DocIDs and counts of a full block
+// into "out".  The gaps are stored minus one, and the counts minus
+// one; "base" is the DocID before the block's first.
+static void UnpackBlock(const uint8_t *gaps, int gap_bits,
+                        const uint8_t *counts, int count_bits,
+                        DocID base, Posting *out);
+
+// Returns the first of the postings from "pos" to "end", which are
+// sorted by DocID, whose DocID is at least "doc_id", or "end".  It
+// gallops out from "pos" to bracket the answer, binary searches the
+// bracket down to a few postings, and compares those all at once.
+static const Posting *SkipTo(const Posting *pos, const Posting *end,
+                             DocID doc_id);
+
+// Appends "value" to "out" as a little-endian base-128 varint, or
+// reads one from "*in" and advances it.
+static void PutVarint(uint32_t value, vector<uint8_t> *out);
+static uint32_t GetVarint(const uint8_t **in);
+
+PostingList::PostingList() : size_(0) { }
+
+PostingList::PostingList(const vector<Posting>& postings)
+  : size_(postings.size()) {
+  // The DocID before the first is taken to be -1, so that every gap is
+  // at least one.
+  DocID prev = UINT32_MAX;
+  uint32_t gaps[kBlockSize];
+  uint32_t counts[kBlockSize];
+  for (size_t start = 0; start < postings.size(); start += kBlockSize) {
+    size_t n = postings.size() - start;
+    Block block;
+    block.offset = data_.size();
+    if (n >= kBlockSize) {
+      n = kBlockSize;
+      // OR-ing the values together gives something just as wide as
+      // the biggest of them.
+      uint32_t all_gaps = 0, all_counts = 0;
+      for (size_t i = 0; i < n; i++) {
+        const Posting& p = postings[start + i];
+        gaps[i] = p.doc_id - prev - 1;
+        counts[i] = p.count - 1;
+        all_gaps |= gaps[i];
+        all_counts |= counts[i];
+        prev = p.doc_id;
+      }
+      block.doc_bits = BitsFor(all_gaps);
+      block.count_bits = BitsFor(all_counts);
+      PackBlock(gaps, block.doc_bits, &data_);
+      PackBlock(counts, block.count_bits, &data_);
+    } else {
+      block.doc_bits = 0;
+      block.count_bits = 0;
+      for (size_t i = 0; i < n; i++) {
+        const Posting& p = postings[start + i];
+        PutVarint(p.doc_id - prev - 1, &data_);
+        PutVarint(p.count - 1, &data_);
+        prev = p.doc_id;
+      }
+    }
+    block.last_doc = prev;
+    blocks_.push_back(block);
+  }
+  data_.shrink_to_fit();
+  blocks_.shrink_to_fit();
+}
+
+size_t PostingList::find_block(DocID doc_id, size_t from) const {
+  size_t lo = from, step = 1;
+  while (lo < blocks_.size() && blocks_[lo].last_doc < doc_id) {
+    from = lo + 1;
+    lo += step;
+    step *= 2;
+  }
+  // The answer is in [from, lo], or is the end.
+  size_t hi = lo < blocks_.size() ? lo : blocks_.size();
+  while (from < hi) {
+    size_t mid = from + (hi - from) / 2;
+    if (blocks_[mid].last_doc < doc_id) {
+      from = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return from;
+}
+
+size_t PostingList::decode_block(size_t block, Posting *out) const {
+  const Block& b = blocks_[block];
+  DocID base = block == 0 ? UINT32_MAX : blocks_[block - 1].last_doc;
+  const uint8_t *in = data_.data() + b.offset;
+  size_t n = size_ - block * kBlockSize;
+  if (n >= kBlockSize) {
+    UnpackBlock(in, b.doc_bits, in + 16 * b.doc_bits, b.count_bits, base,
+                out);
+    return kBlockSize;
+  }
+  for (size_t i = 0; i < n; i++) {
+    base += GetVarint(&in) + 1;
+    out[i].doc_id = base;
+    out[i].count = GetVarint(&in) + 1;
+  }
+  return n;
+}
+
+void PostingList::decode(vector<Posting> *out) const {
+  out->resize(size_);
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    decode_block(i, out->data() + i * kBlockSize);
+  }
+}
+
+size_t PostingList::memory_bytes() const {
+  return blocks_.capacity() * sizeof(Block) + data_.capacity();
+}
+
+PostingCursor::PostingCursor(const vector<Posting>& postings)
+  : list_(nullptr), block_(0), size_(postings.size()),
+    pos_(postings.data()), end_(postings.data() + postings.size()) { }
+
+PostingCursor::PostingCursor(const PostingList& list)
+  : list_(&list), block_(0), size_(list.size()) {
+  load_block(0);
+}
+
+void PostingCursor::seek(DocID doc_id) {
+  if (done() || pos_->doc_id >= doc_id) {
+    return;
+  }
+  if (list_ != nullptr && end_[-1].doc_id < doc_id) {
+    // It isn't in this block; skip to the first one it could be in
+    // without decoding the ones in between.
+    load_block(list_->find_block(doc_id, block_ + 1));
+    if (done()) {
+      return;
+    }
+  }
+  pos_ = SkipTo(pos_, end_, doc_id);
+}
+
+void PostingCursor::load_block(size_t block) {
+  block_ = block;
+  size_t n = 0;
+  if (block < list_->num_blocks()) {
+    n = list_->decode_block(block, buf_);
+  }
+  pos_ = buf_;
+  end_ = buf_ + n;
+}
+
+static int BitsFor(uint32_t value) {
+  return value == 0 ? 0 : 32 - __builtin_clz(value);
+}
+
+static void PackBlock(const uint32_t *values, int bits, vector<uint8_t> *out) {
+  if (bits == 0) {
+    return;
+  }
+  size_t start = out->size();
+  out->resize(start + 16 * bits, 0);
+  uint8_t *words = out->data() + start;
+  for (size_t i = 0; i < PostingList::kBlockSize; i++) {
+    size_t lane = i % 4;
+    size_t bit = (i / 4) * bits;
+    size_t word = bit / 32;
+    int shift = bit % 32;
+    uint32_t w;
+    memcpy(&w, words + (4 * word + lane) * 4, 4);
+    w |= values[i] << shift;
+    memcpy(words + (4 * word + lane) * 4, &w, 4);
+    if (shift + bits > 32) {
+      memcpy(&w, words + (4 * (word + 1) + lane) * 4, 4);
+      w |= values[i] >> (32 - shift);
+      memcpy(words + (4 * (word + 1) + lane) * 4, &w, 4);
+    }
+  }
+}
+
+#ifdef __SSE2__
+// Returns the "k"th group of four values packed "bits" to a value at
+// "words", as PackBlock() lays them out.
+static inline __m128i UnpackLanes(const uint8_t *words, int bits, size_t k,
+                                  __m128i mask) {
+  if (bits == 0) {
+    // Nothing was stored, and "words" may be the end of the data.
+    return _mm_setzero_si128();
+  }
+  size_t bit = k * bits;
+  size_t word = bit / 32;
+  int shift = bit % 32;
+  const __m128i *w = reinterpret_cast<const __m128i *>(words) + word;
+  __m128i v = _mm_srl_epi32(_mm_loadu_si128(w), _mm_cvtsi32_si128(shift));
+  if (shift + bits > 32) {
+    v = _mm_or_si128(v, _mm_sll_epi32(_mm_loadu_si128(w + 1),
+                                      _mm_cvtsi32_si128(32 - shift)));
+  }
+  return _mm_and_si128(v, mask);
+}
+
+static void UnpackBlock(const uint8_t *gaps, int gap_bits,
+                        const uint8_t *counts, int count_bits,
+                        DocID base, Posting *out) {
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i gap_mask =
+    _mm_set1_epi32(gap_bits == 32 ? -1 : (1u << gap_bits) - 1);
+  const __m128i count_mask =
+    _mm_set1_epi32(count_bits == 32 ? -1 : (1u << count_bits) - 1);
+  __m128i prev = _mm_set1_epi32(base);
+  __m128i *dst = reinterpret_cast<__m128i *>(out);
+  for (size_t k = 0; k < kLaneLength; k++) {
+    // Turn four gaps into DocIDs with a running sum across the lanes,
+    // carried on from the last DocID of the previous four.
+    __m128i doc = UnpackLanes(gaps, gap_bits, k, gap_mask);
+    doc = _mm_add_epi32(doc, one);
+    doc = _mm_add_epi32(doc, _mm_slli_si128(doc, 4));
+    doc = _mm_add_epi32(doc, _mm_slli_si128(doc, 8));
+    doc = _mm_add_epi32(doc, _mm_shuffle_epi32(prev, 0xFF));
+    prev = doc;
+
+    __m128i count = UnpackLanes(counts, count_bits, k, count_mask);
+    count = _mm_add_epi32(count, one);
+
+    // Interleave them into four Postings.
+    _mm_storeu_si128(dst + 2 * k, _mm_unpacklo_epi32(doc, count));
+    _mm_storeu_si128(dst + 2 * k + 1, _mm_unpackhi_epi32(doc, count));
+  }
+}
+#else
+// Returns value "i" of the block packed "bits" to a value at "words",
+// as PackBlock() lays it out.
+static inline uint32_t UnpackValue(const uint8_t *words, int bits, size_t i) {
+  if (bits == 0) {
+    return 0;
+  }
+  size_t lane = i % 4;
+  size_t bit = (i / 4) * bits;
+  size_t word = bit / 32;
+  int shift = bit % 32;
+  uint32_t w;
+  memcpy(&w, words + (4 * word + lane) * 4, 4);
+  uint32_t v = w >> shift;
+  if (shift + bits > 32) {
+    memcpy(&w, words + (4 * (word + 1) + lane) * 4, 4);
+    v |= w << (32 - shift);
+  }
+  return bits == 32 ? v : v & ((1u << bits) - 1);
+}
+
+static void UnpackBlock(const uint8_t *gaps, int gap_bits,
+                        const uint8_t *counts, int count_bits,
+                        DocID base, Posting *out) {
+  for (size_t i = 0; i < PostingList::kBlockSize; i++) {
+    base += UnpackValue(gaps, gap_bits, i) + 1;
+    out[i].doc_id = base;
+    out[i].count = UnpackValue(counts, count_bits, i) + 1;
+  }
+}
+#endif  // __SSE2__
+
+// How many postings SkipTo() compares at once at the end.
+static const size_t kSkipWindow = 8;
+
+static const Posting *SkipTo(const Posting *pos, const Posting *end,
+                             DocID doc_id) {
+  // Gallop: look 1, 2, 4, ... postings ahead until one is far enough.
+  // The answer is then in [pos, pos + step).
+  size_t left = end - pos, step = 1;
+  while (step <= left && pos[step - 1].doc_id < doc_id) {
+    pos += step;
+    left -= step;
+    step *= 2;
+  }
+  size_t n = step < left ? step : left;
+  while (n > kSkipWindow) {
+    size_t half = n / 2;
+    if (pos[half - 1].doc_id < doc_id) {
+      pos += half;
+      n -= half;
+    } else {
+      n = half;
+    }
+  }
+  // Whatever is left, count the postings that come before "doc_id".
+  // They are sorted, so that count is how far to move.
+  size_t before = 0, i = 0;
+#ifdef __SSE2__
+  // Compare two postings a vector.  SSE2 only compares signed
+  // integers, so flip the top bits to compare DocIDs as unsigned.
+  const __m128i flip = _mm_set1_epi32(INT32_MIN);
+  const __m128i target = _mm_xor_si128(_mm_set1_epi32(doc_id), flip);
+  for (; i + 2 <= n; i += 2) {
+    __m128i pair = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos + i));
+    __m128i less = _mm_cmpgt_epi32(target, _mm_xor_si128(pair, flip));
+    // Lanes 0 and 2 hold the DocIDs.
+    before += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(less)) & 5);
+  }
+#endif
+  for (; i < n; i++) {
+    before += pos[i].doc_id < doc_id;
+  }
+  return pos + before;
+}
+
+static void PutVarint(uint32_t value, vector<uint8_t> *out) {
+  while (value >= 0x80) {
+    out->push_back((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out->push_back(value);
+}
+
+static uint32_t GetVarint(const uint8_t **in) {
+  uint32_t value = 0;
+  int shift = 0;
+  while (**in & 0x80) {
+    value |= static_cast<uint32_t>(*(*in)++ & 0x7F) << shift;
+    shift += 7;
+  }
+  value |= static_cast<uint32_t>(*(*in)++) << shift;
+  return value;
+}
+
+}  // namespace searchserver
@@ -0,0 +1,143 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef POSTINGLIST_H_
+#define POSTINGLIST_H_
+
+#include <cstddef>   // for size_t
+#include <cstdint>   // for uint32_t, etc.
+#include <vector>
+
+#include "./Result.h"
+
+namespace searchserver {
+
+// One document's count for a word in a WordIndex.
+struct Posting {
+  DocID doc_id;
+  uint32_t count;
+};
+
+// A PostingList is a read-only, compressed copy of a word's postings,
+// sorted by DocID.
+//
+// The postings are cut into blocks of kBlockSize.  In each full block,
+// the gaps between DocIDs and the counts are bit-packed, each with the
+// fewest bits that fit the block's biggest value, and laid out four
+// lanes wide so that a block decodes with SSE2.  A final, partial
+// block is stored as varints instead, since most words are only in a
+// few documents.  Every block's last DocID is kept uncompressed, so a
+// search can skip whole blocks without decoding them.
+class PostingList {
+ public:
+  static constexpr size_t kBlockSize = 128;
+
+  // Creates an empty list.
+  PostingList();
+
+  // Compresses "postings", which must be sorted by DocID, with no
+  // DocID appearing twice and no count of 0.
+  explicit PostingList(const std::vector<Posting>& postings);
+
+  // Returns how many postings the list holds.
+  size_t size() const { return size_; }
+
+  // Returns how many blocks the list is split into, and the last
+  // DocID in "block".
+  size_t num_blocks() const { return blocks_.size(); }
+  DocID block_last(size_t block) const { return blocks_[block].last_doc; }
+
+  // Returns the first block at or after "from" whose last DocID is at
+  // least "doc_id", or num_blocks() if there is none.  Galloping, so
+  // it takes time logarithmic in how far it moves.
+  size_t find_block(DocID doc_id, size_t from) const;
+
+  // Decodes "block" into "out", which must have room for kBlockSize
+  // postings, and returns how many postings it holds.
+  size_t decode_block(size_t block, Posting *out) const;
+
+  // Decodes the whole list into "out".
+  void decode(std::vector<Posting> *out) const;
+
+  // Returns how many bytes of memory the list uses, besides the
+  // object itself.
+  size_t memory_bytes() const;
+
+ private:
+  // Where a block is stored in data_ and how it is packed.  The gaps
+  // and counts of a full block take 16 * doc_bits and 16 * count_bits
+  // bytes, one after the other.
+  struct Block {
+    DocID last_doc;
+    uint32_t offset;
+    uint8_t doc_bits;
+    uint8_t count_bits;
+  };
+
+  uint32_t size_;
+  std::vector<Block> blocks_;
+  std::vector<uint8_t> data_;
+};
+
+// A PostingCursor walks one word's postings in DocID order, whether
+// they are still a plain vector or already a PostingList.  It only
+// decodes a PostingList block when it lands in it.
+class PostingCursor {
+ public:
+  explicit PostingCursor(const std::vector<Posting>& postings);
+  explicit PostingCursor(const PostingList& list);
+
+  // Returns how many postings there are in all.
+  size_t size() const { return size_; }
+
+  // Returns true once the cursor has moved past the last posting.
+  bool done() const { return pos_ == end_; }
+
+  // Returns the posting the cursor is at.  Must not be done().
+  const Posting& operator*() const { return *pos_; }
+  const Posting *operator->() const { return pos_; }
+
+  // Moves to the next posting.
+  void next() {
+    if (++pos_ == end_ && list_ != nullptr) {
+      load_block(block_ + 1);
+    }
+  }
+
+  // Moves forward to the first posting whose DocID is at least
+  // "doc_id", or past the end if there isn't one.  This gallops, so
+  // it takes time logarithmic in how far it moves, rather than linear.
+  void seek(DocID doc_id);
+
+  PostingCursor(const PostingCursor& other) = delete;
+  PostingCursor& operator=(const PostingCursor& other) = delete;
+
+ private:
+  // Decodes "block" of list_ into buf_ and moves to its start, or
+  // moves past the end if there is no such block.
+  void load_block(size_t block);
+
+  // The list being decoded, or nullptr when walking a vector.
+  const PostingList *list_;
+  size_t block_;
+  size_t size_;
+
+  // The postings of the current block (or the whole vector) that
+  // haven't been walked past yet.
+  const Posting *pos_;
+  const Posting *end_;
+
+  Posting buf_[PostingList::kBlockSize];
+};
+
+}  // namespace searchserver
+
+#endif  // POSTINGLIST_H_
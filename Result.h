@@ -1,23 +1,29 @@
 #ifndef RESULT_H_
 #define RESULT_H_
 
+#include <cstdint>
 #include <string>
 
 using std::string;
 
 namespace searchserver {
 
+// Documents in a WordIndex are numbered densely from 0, in the order
+// they were first recorded.  WordIndex::doc_name() turns an ID back
+// into the document's name.
+typedef uint32_t DocID;
+
 // This class represents a Result from looking up in the index
-// It contains a document name and a rank which is typically the
+// It contains a document ID and a rank which is typically the
 // number of times certain word(s) show up in the document
 struct Result {
  public:
-  string doc_name;
+  DocID doc_id;
   int rank;
 
-  Result() : doc_name(""), rank(0) { }
+  Result() : doc_id(0), rank(0) { }
 
-  Result(string doc_name, int rank) : doc_name(doc_name), rank(rank) { }
+  Result(DocID doc_id, int rank) : doc_id(doc_id), rank(rank) { }
 
   // Sort so that bibgger rank comes first
   bool operator<(const Result& other) const {
@@ -15,17 +15,35 @@
 #include <sys/socket.h>  // for socket(), getaddrinfo(), etc.
 #include <arpa/inet.h>   // for inet_ntop()
 #include <netdb.h>       // for getaddrinfo()
+#include <netinet/in.h>  // for IPPROTO_TCP
+#include <netinet/tcp.h>  // for TCP_NODELAY, etc.
 #include <errno.h>       // for errno, used by strerror()
 #include <cstring>      // for memset, strerror()
 #include <iostream>      // for std::cerr, etc.
 
+#include "./DnsResolver.h"
+#include "./HttpUtils.h"
+#include "./IoUring.h"
 #include "./ServerSocket.h"
 
 namespace searchserver {
 
+// The size of the io_uring used for accepting connections, and the
+// user_data tag for its completions.
+static const unsigned kAcceptRingEntries = 16;
+static const uint64_t kAcceptTag = 1;
+
+// Applies "options" to the listening socket "fd", printing a warning
+// for any option the kernel refuses.
+static void TuneListenSocket(int fd, const SocketOptions &options);
+
 ServerSocket::ServerSocket(uint16_t port) {
   port_ = port;
   listen_sock_fd_ = -1;
+  reuse_port_ = false;
+  accept_ring_ = nullptr;
+  accept_armed_ = false;
+  accept_multishot_ = true;
 }
 
 ServerSocket::~ServerSocket() {
@@ -35,6 +53,10 @@ ServerSocket::~ServerSocket() {
   if (listen_sock_fd_ != -1)
     close(listen_sock_fd_);
   listen_sock_fd_ = -1;
+
+  // Destroying the ring also cancels any outstanding accept.
+  delete accept_ring_;
+  accept_ring_ = nullptr;
 }
 // Use "getaddrinfo," "socket," "bind," and "listen" to
   // create a listening socket on port port_.  Return the
@@ -73,7 +95,8 @@ bool ServerSocket::bind_and_listen(int ai_family, int *listen_fd) {
   // loop through returned addr struct until we can create a socket and bind to one
   *listen_fd = -1;
   for(struct addrinfo *rp = result; rp != nullptr; rp = rp->ai_next) {
-    *listen_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+    *listen_fd = socket(rp->ai_family, rp->ai_socktype | SOCK_CLOEXEC,
+                        rp->ai_protocol);
 
     if(*listen_fd == -1) {
       listen_fd = 0;
@@ -82,6 +105,14 @@ bool ServerSocket::bind_and_listen(int ai_family, int *listen_fd) {
     // configure socket
     int optval = 1;
     setsockopt(*listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    if (reuse_port_ &&
+        setsockopt(*listen_fd, SOL_SOCKET, SO_REUSEPORT,
+                   &optval, sizeof(optval)) != 0) {
+      perror("setsockopt(SO_REUSEPORT) failed");
+      close(*listen_fd);
+      *listen_fd = -1;
+      continue;
+    }
 
     // try binding socket to addr and port num returned by getaddrinfo
     if(bind(*listen_fd, rp->ai_addr, rp->ai_addrlen) == 0) {
@@ -98,16 +129,27 @@ bool ServerSocket::bind_and_listen(int ai_family, int *listen_fd) {
 
   // check if binds to an addr
   if(*listen_fd == -1) {
-    return EXIT_FAILURE;
+    return false;
   }
 
   // tell OS this will be listening socket
-  if(listen(*listen_fd, SOMAXCONN) != 0) {
+  TuneListenSocket(*listen_fd, options_);
+  if(listen(*listen_fd, options_.backlog) != 0) {
     close(*listen_fd);
-    return EXIT_FAILURE;
+    return false;
   }
 
   listen_sock_fd_ = *listen_fd;
+
+  // Set up the accept ring if io_uring is in use; if that fails, we
+  // quietly stick with accept().
+  if (io_backend() == kIoUringIo && accept_ring_ == nullptr) {
+    accept_ring_ = new IoUring();
+    if (!accept_ring_->init(kAcceptRingEntries, 0)) {
+      delete accept_ring_;
+      accept_ring_ = nullptr;
+    }
+  }
   return true;
 }
 
@@ -117,6 +159,21 @@ bool ServerSocket::accept_client(int *accepted_fd,
                           std::string *client_dns_name,
                           std::string *server_addr,
                           std::string *server_dns_name) const {
+  if (!accept_client(accepted_fd, client_addr, client_port, server_addr)) {
+    return false;
+  }
+
+  // Get the dns names, or return the IP addresses as a substitute
+  // if the dns lookups fail.
+  reverse_dns(*client_addr, client_dns_name);
+  reverse_dns(*server_addr, server_dns_name);
+  return true;
+}
+
+bool ServerSocket::accept_client(int *accepted_fd,
+                          std::string *client_addr,
+                          uint16_t *client_port,
+                          std::string *server_addr) const {
   // Accept a new connection on the listening socket listen_sock_fd_.
   // (Block until a new connection arrives.)  Return the newly accepted
   // socket, as well as information about both ends of the new connection,
@@ -124,7 +181,7 @@ bool ServerSocket::accept_client(int *accepted_fd,
 
   if(listen_sock_fd_<= 0){
     perror("Failed to bind to addr");
-    return EXIT_FAILURE;
+    return false;
   }
   // std::cout << "Server socket: "<< listen_sock_fd_ << std::endl;
 
@@ -135,7 +192,18 @@ bool ServerSocket::accept_client(int *accepted_fd,
 
   while(1) {
     // accepting client depending whether it's ipv4 or ipv6
-    client_socket = accept(listen_sock_fd_, reinterpret_cast<struct sockaddr*>(&caddr), &caddr_len);
+    if (accept_ring_ != nullptr) {
+      // The ring doesn't hand back the peer's address, so ask for it.
+      client_socket = accept_from_ring();
+      if (client_socket >= 0) {
+        getpeername(client_socket,
+                    reinterpret_cast<struct sockaddr*>(&caddr), &caddr_len);
+      }
+    } else {
+      client_socket = accept4(listen_sock_fd_,
+                              reinterpret_cast<struct sockaddr*>(&caddr),
+                              &caddr_len, SOCK_CLOEXEC);
+    }
     *accepted_fd = client_socket;
     // std::cout << "Client socket: "<< client_socket << std::endl;
 
@@ -143,17 +211,8 @@ bool ServerSocket::accept_client(int *accepted_fd,
       if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
         continue;
       }
+      return false;
     }
-  
-
-  // either client name is inet_ntop should = dns ; else hname (first char to be null) getnameinfo fails then dns = hname
-  // create variable to hold client_dns_name : peer (sockaddr*)
-  // sockaddr* peer_addr;
-  // socklen_t peer_addrlen = sizeof(peer_addr);
-  // getnameinfo should be in each type of AF_INET sockaddr_in & sock_addr_in6
-  
-  char hname[1024];
-  hname[0] = '\0';
 
   // GET CLIENT ADDR 
   if (caddr.ss_family == AF_INET) {
@@ -163,12 +222,6 @@ bool ServerSocket::accept_client(int *accepted_fd,
       inet_ntop(AF_INET, &sa->sin_addr, addrbuf , INET_ADDRSTRLEN);
       *client_addr = addrbuf;
       *client_port = ntohs(sa->sin_port);
-
-      getnameinfo((const struct sockaddr *) sa, sizeof(*sa), hname, 1024, nullptr, 0, 0);
-          // getnameinfo failed
-          // reinterpret_cast on hname
-          *client_dns_name = std::string(hname);
-        
     } else {
       // IPV6 address and port
       struct sockaddr_in6* sa = (struct sockaddr_in6*) &caddr;
@@ -176,14 +229,8 @@ bool ServerSocket::accept_client(int *accepted_fd,
       inet_ntop(AF_INET6, &sa->sin6_addr, addrbuf, INET6_ADDRSTRLEN);
       *client_addr = addrbuf;
       *client_port = ntohs(sa->sin6_port);
-
-      getnameinfo((const struct sockaddr *) sa, sizeof(*sa), hname, 1024, nullptr, 0, 0);
-      *client_dns_name = std::string(hname);
     }
 
-    char hname1[1024];
-    hname1[0] = '\0';
-
   // GET SERVER ADDR
   if (sock_family_ == AF_INET) {
     struct sockaddr_in srvr;
@@ -193,13 +240,6 @@ bool ServerSocket::accept_client(int *accepted_fd,
     char addrbuf[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &srvr.sin_addr, addrbuf, INET_ADDRSTRLEN);
     *server_addr = addrbuf;
-   
-    // Get the server's dns name, or return it's IP address as
-    // a substitute if the dns lookup fails.
-    getnameinfo((const struct sockaddr *) &srvr,
-                srvrlen, hname1, 1024, nullptr, 0, 0);
-    *server_dns_name = std::string(hname1);
-    
   } else {
     // The server is using an IPv6 address.
     struct sockaddr_in6 srvr;
@@ -208,15 +248,79 @@ bool ServerSocket::accept_client(int *accepted_fd,
     getsockname(*accepted_fd, (struct sockaddr *) &srvr, &srvrlen);
     inet_ntop(AF_INET6, &srvr.sin6_addr, addrbuf, INET6_ADDRSTRLEN);
     *server_addr = addrbuf;
-    // Get the server's dns name, or return it's IP address as
-    // a substitute if the dns lookup fails.
-    getnameinfo((const struct sockaddr *) &srvr,
-                srvrlen, hname1, 1024, nullptr, 0, 0);
-    *server_dns_name = std::string(hname1);
   }
   break;
 }
   return true;
 }
 
+int ServerSocket::accept_from_ring() const {
+  while (1) {
+    if (!accept_armed_) {
+      struct io_uring_sqe *sqe = accept_ring_->get_sqe();
+      if (sqe == nullptr) {
+        errno = EBUSY;
+        return -1;
+      }
+      IoUring::prep_accept(sqe, listen_sock_fd_, SOCK_CLOEXEC,
+                           accept_multishot_, kAcceptTag);
+      int res = accept_ring_->submit(0);
+      if (res < 0) {
+        errno = -res;
+        return -1;
+      }
+      accept_armed_ = true;
+    }
+
+    struct io_uring_cqe cqe;
+    if (!accept_ring_->wait_cqe(&cqe)) {
+      return -1;
+    }
+
+    // A multishot accept stays armed for as long as the kernel keeps
+    // setting IORING_CQE_F_MORE; otherwise we have to submit again.
+    if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+      accept_armed_ = false;
+    }
+    if (cqe.res == -EINVAL && accept_multishot_) {
+      // This kernel predates multishot accept.
+      accept_multishot_ = false;
+      continue;
+    }
+    if (cqe.res < 0) {
+      errno = -cqe.res;
+      return -1;
+    }
+    return cqe.res;
+  }
+}
+
+static void TuneListenSocket(int fd, const SocketOptions &options) {
+  struct {
+    bool wanted;
+    int level, name, value;
+    const char *what;
+  } opts[] = {
+    {options.no_delay, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY"},
+    {options.defer_accept_secs > 0, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+     options.defer_accept_secs, "TCP_DEFER_ACCEPT"},
+    {options.fastopen_queue > 0, IPPROTO_TCP, TCP_FASTOPEN,
+     options.fastopen_queue, "TCP_FASTOPEN"},
+    {options.rcvbuf_bytes > 0, SOL_SOCKET, SO_RCVBUF,
+     options.rcvbuf_bytes, "SO_RCVBUF"},
+    {options.sndbuf_bytes > 0, SOL_SOCKET, SO_SNDBUF,
+     options.sndbuf_bytes, "SO_SNDBUF"},
+    {options.busy_poll_usecs > 0, SOL_SOCKET, SO_BUSY_POLL,
+     options.busy_poll_usecs, "SO_BUSY_POLL"},
+  };
+  for (const auto &opt : opts) {
+    if (opt.wanted &&
+        setsockopt(fd, opt.level, opt.name, &opt.value,
+                   sizeof(opt.value)) != 0) {
+      std::cerr << "setsockopt(" << opt.what << ") failed: "
+                << strerror(errno) << std::endl;
+    }
+  }
+}
+
 }  // namespace searchserver
@@ -20,6 +20,46 @@
 
 namespace searchserver {
 
+class IoUring;
+
+// Tuning for a ServerSocket's listening socket and the client sockets
+// it accepts.  A zero (or false) field leaves the kernel's default in
+// place.  Everything is set on the listening socket, and Linux copies
+// it to each accepted socket, so accepting costs no extra syscalls.
+struct SocketOptions {
+  SocketOptions()
+    : backlog(SOMAXCONN), no_delay(false), defer_accept_secs(0),
+      fastopen_queue(0), rcvbuf_bytes(0), sndbuf_bytes(0),
+      busy_poll_usecs(0) { }
+
+  // How many not-yet-accepted connections listen() may queue up; the
+  // kernel caps this at net.core.somaxconn.
+  int backlog;
+
+  // TCP_NODELAY on accepted sockets, so a small write that follows
+  // another one (a header and then a sendfile() body, say) goes out
+  // right away instead of waiting on the client's delayed ACK.
+  bool no_delay;
+
+  // TCP_DEFER_ACCEPT: don't wake accept() for a connection until the
+  // client has sent data, or this many seconds have passed.
+  int defer_accept_secs;
+
+  // TCP_FASTOPEN: how many pending Fast Open requests to queue, which
+  // lets repeat clients send their request in the SYN.
+  int fastopen_queue;
+
+  // SO_RCVBUF and SO_SNDBUF.  These are in place before the handshake,
+  // so the window scale offered to clients matches the buffer.
+  int rcvbuf_bytes;
+  int sndbuf_bytes;
+
+  // SO_BUSY_POLL on accepted sockets: how long a blocking read may
+  // spin on the device queue before sleeping.  Raising it above
+  // net.core.busy_read needs CAP_NET_ADMIN.
+  int busy_poll_usecs;
+};
+
 // A ServerSocket class abstracts away the messy details of creating a
 // TCP listening socket at a specific port and on a (hopefully)
 // externally visible IP address.  As well, a ServerSocket helps
@@ -56,6 +96,24 @@ class ServerSocket {
   //              which should be the same value as listen_fd_
   bool bind_and_listen(int ai_family, int *listen_fd);
 
+  // If "reuse_port" is true, bind_and_listen() sets SO_REUSEPORT on
+  // the listening socket, so that several ServerSockets can listen on
+  // the same port and the kernel spreads new connections across them.
+  // Must be called before bind_and_listen().
+  void set_reuse_port(bool reuse_port) { reuse_port_ = reuse_port; }
+
+  // Sets the tuning applied to the listening socket and to every
+  // accepted socket.  An option the kernel refuses is reported and
+  // skipped, since none of them are needed for correctness.  Must be
+  // called before bind_and_listen().
+  void set_socket_options(const SocketOptions &options) {
+    options_ = options;
+  }
+  const SocketOptions &socket_options() const { return options_; }
+
+  // Returns the port this ServerSocket listens on.
+  uint16_t port() const { return port_; }
+
   // This function causes the ServerSocket to attempt to accept
   // an incoming connection from a client.  On failure, returns false.
   // On success, it returns true, and also returns (via output
@@ -79,15 +137,48 @@ class ServerSocket {
   //
   // - server_dnsname: a C++ string object containing the DNS name
   //   of the server.
+  //
+  // The new socket has close-on-exec set, and carries the tuning from
+  // set_socket_options().
+  //
+  // The DNS names are looked up synchronously, which can stall the
+  // caller on a slow DNS server.  Servers should prefer the overload
+  // below and resolve names lazily, e.g. with a DnsResolver.
+  //
+  // If the io_uring backend was selected (see set_io_backend() in
+  // HttpUtils.h) before bind_and_listen(), connections are accepted
+  // through a multishot accept on an io_uring, so that one submission
+  // keeps delivering new clients.
   bool accept_client(int *accepted_fd,
                      std::string *client_addr, uint16_t *client_port,
                      std::string *client_dns_name, std::string *server_addr,
                      std::string *server_dns_name) const;
 
+  // The same as above, but doesn't look up any DNS names, so it never
+  // waits on anything but the accept itself.
+  bool accept_client(int *accepted_fd,
+                     std::string *client_addr, uint16_t *client_port,
+                     std::string *server_addr) const;
+
  private:
+  // Waits for the next connection from accept_ring_, (re-)arming the
+  // accept if needed.  Returns the new socket, or -1 with errno set.
+  int accept_from_ring() const;
+
   uint16_t port_;
   int listen_sock_fd_;
   int sock_family_;  // either AF_INET or AF_INET6 for ipv4 or ipv6/v4
+  bool reuse_port_;
+  SocketOptions options_;
+
+  // The io_uring used to accept connections, or nullptr if we are
+  // using plain accept().
+  IoUring *accept_ring_;
+
+  // Whether an accept is currently outstanding on accept_ring_, and
+  // whether the kernel supports the multishot flavor of it.
+  mutable bool accept_armed_;
+  mutable bool accept_multishot_;
 };
 
 }  // namespace searchserver
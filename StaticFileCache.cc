@@ -0,0 +1,140 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <sys/stat.h>
+
+#include "./HttpUtils.h"
+#include "./StaticFileCache.h"
+
+using std::shared_ptr;
+using std::string;
+
+namespace searchserver {
+
+// Returns true if the two timestamps are the same.
+static bool SameTime(const struct timespec &a, const struct timespec &b) {
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+StaticFileCache::StaticFileCache(size_t max_bytes, size_t max_entry_bytes)
+  : max_bytes_(max_bytes), max_entry_bytes_(max_entry_bytes), bytes_(0) {
+  pthread_mutex_init(&lock_, nullptr);
+}
+
+StaticFileCache::~StaticFileCache() {
+  pthread_mutex_destroy(&lock_);
+}
+
+bool StaticFileCache::lookup(const string &path, CachedFile *file) {
+  pthread_mutex_lock(&lock_);
+  auto it = cache_.find(path);
+  if (it == cache_.end()) {
+    pthread_mutex_unlock(&lock_);
+    return false;
+  }
+  CachedFile cached = it->second.file;
+  string file_name = it->second.file_name;
+  ino_t ino = it->second.ino;
+  struct timespec mtime = it->second.mtime;
+  off_t file_size = it->second.file_size;
+  pthread_mutex_unlock(&lock_);
+
+  // Check the file with the lock released.
+  struct stat st;
+  bool fresh = stat(file_name.c_str(), &st) == 0 && st.st_ino == ino &&
+               SameTime(st.st_mtim, mtime) && st.st_size == file_size;
+
+  pthread_mutex_lock(&lock_);
+  it = cache_.find(path);
+  if (it == cache_.end() || it->second.file.response != cached.response) {
+    // Someone replaced or dropped the entry while we were looking.
+    pthread_mutex_unlock(&lock_);
+    if (fresh) {
+      *file = cached;
+    }
+    return fresh;
+  }
+  if (!fresh) {
+    erase(it);
+    pthread_mutex_unlock(&lock_);
+    return false;
+  }
+  lru_order_.splice(lru_order_.end(), lru_order_, it->second.order_it);
+  pthread_mutex_unlock(&lock_);
+  *file = cached;
+  return true;
+}
+
+shared_ptr<const string> StaticFileCache::insert(
+    const string &path, const string &file_name, const struct stat &st,
+    const HttpResponse &response) {
+  if (!response.has_body_file() || max_bytes_ == 0) {
+    return nullptr;
+  }
+
+  // Check the size before reading anything in.
+  size_t size = response.GenerateHeaderString().size() +
+                response.body_length();
+  if (size > max_entry_bytes_ || size > max_bytes_) {
+    return nullptr;
+  }
+  shared_ptr<const string> bytes =
+    std::make_shared<const string>(response.GenerateResponseString());
+  if (bytes->size() != size) {
+    return nullptr;  // the file shrank while we were reading it
+  }
+
+  pthread_mutex_lock(&lock_);
+  auto it = cache_.find(path);
+  if (it != cache_.end()) {
+    erase(it);
+  }
+  while (!cache_.empty() && bytes_ + bytes->size() > max_bytes_) {
+    erase(cache_.find(lru_order_.front()));
+  }
+
+  Entry entry;
+  entry.file.response = bytes;
+  entry.file.etag = make_etag(st);
+  entry.file.last_modified = st.st_mtime;
+  entry.file_name = file_name;
+  entry.ino = st.st_ino;
+  entry.mtime = st.st_mtim;
+  entry.file_size = st.st_size;
+  entry.order_it = lru_order_.insert(lru_order_.end(), path);
+  cache_[path] = entry;
+  bytes_ += bytes->size();
+  pthread_mutex_unlock(&lock_);
+  return bytes;
+}
+
+size_t StaticFileCache::size() {
+  pthread_mutex_lock(&lock_);
+  size_t size = cache_.size();
+  pthread_mutex_unlock(&lock_);
+  return size;
+}
+
+size_t StaticFileCache::bytes() {
+  pthread_mutex_lock(&lock_);
+  size_t bytes = bytes_;
+  pthread_mutex_unlock(&lock_);
+  return bytes;
+}
+
+void StaticFileCache::erase(
+    std::unordered_map<string, Entry>::iterator it) {
+  bytes_ -= it->second.file.response->size();
+  lru_order_.erase(it->second.order_it);
+  cache_.erase(it);
+}
+
+}  // namespace searchserver
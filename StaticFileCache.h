@@ -0,0 +1,128 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef STATICFILECACHE_H_
+#define STATICFILECACHE_H_
+
+extern "C" {
+  #include <pthread.h>  // for the pthread mutex functions
+}
+
+#include <sys/stat.h>
+#include <time.h>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "./HttpResponse.h"
+
+namespace searchserver {
+
+// A StaticFileCache keeps fully serialized responses (header bytes and
+// body) for recently requested static files, keyed by request path,
+// so that a hit is served with one lookup and one write instead of
+// parsing the URI, checking the path, opening the file and building
+// the response all over again.
+//
+// The cache holds at most a fixed number of bytes; when it is full,
+// the least recently used responses are dropped to make room.  Every
+// hit checks that the file's modification time and size haven't
+// changed, and drops the entry if they have.  Entries also keep the
+// file's ETag and modification time, so that conditional requests can
+// be answered without going to the file at all.
+//
+// A StaticFileCache is thread safe.
+class StaticFileCache {
+ public:
+  // Creates an empty cache.  Arguments:
+  //
+  //  - max_bytes: the most bytes of responses the cache holds at a
+  //    time.  Zero turns the cache off.
+  //
+  //  - max_entry_bytes: responses bigger than this are never cached;
+  //    such files are better off sent with sendfile().
+  StaticFileCache(size_t max_bytes, size_t max_entry_bytes);
+
+  virtual ~StaticFileCache();
+
+  // What the cache knows about a file.
+  struct CachedFile {
+    // The serialized response.
+    std::shared_ptr<const std::string> response;
+
+    // The file's strong ETag (see make_etag()) and modification time,
+    // for answering conditional requests.
+    std::string etag;
+    time_t last_modified;
+  };
+
+  // If a response for the request path "path" is cached and its file
+  // hasn't changed on disk, returns true and what we know about the
+  // file through "file".  Otherwise returns false.
+  bool lookup(const std::string &path, CachedFile *file);
+
+  // Caches "response", which must have a file-backed body, as the
+  // response for "path"; "file_name" is the file the body came from,
+  // and "st" is what fstat() said about it when it was opened.
+  // Returns the serialized response if it was cached, or nullptr if it
+  // was too big or the file couldn't be read.
+  std::shared_ptr<const std::string> insert(const std::string &path,
+                                            const std::string &file_name,
+                                            const struct stat &st,
+                                            const HttpResponse &response);
+
+  // Returns the number of responses, and the number of bytes of
+  // responses, currently cached.
+  size_t size();
+  size_t bytes();
+
+  StaticFileCache(const StaticFileCache& other) = delete;
+  StaticFileCache& operator=(const StaticFileCache& other) = delete;
+
+ private:
+  // A cached response.
+  struct Entry {
+    CachedFile file;
+    std::string file_name;
+
+    // The file's identity, modification time and size when it was
+    // cached.
+    ino_t ino;
+    struct timespec mtime;
+    off_t file_size;
+
+    // Where this path sits in lru_order_.
+    std::list<std::string>::iterator order_it;
+  };
+
+  // Drops the entry "it" from the cache.  Called with lock_ held.
+  void erase(std::unordered_map<std::string, Entry>::iterator it);
+
+  size_t max_bytes_;
+  size_t max_entry_bytes_;
+
+  // Guards everything below.
+  pthread_mutex_t lock_;
+
+  std::unordered_map<std::string, Entry> cache_;
+
+  // The cached paths, least recently used first.
+  std::list<std::string> lru_order_;
+
+  // The total size of the cached responses.
+  size_t bytes_;
+};
+
+}  // namespace searchserver
+
+#endif  // STATICFILECACHE_H_
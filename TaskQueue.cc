@@ -0,0 +1,189 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include "./TaskQueue.h"
+
+namespace searchserver {
+
+TaskQueue::TaskQueue(uint32_t capacity) {
+  size_t size = 2;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  cells_ = new Cell[size];
+  mask_ = size - 1;
+  for (size_t i = 0; i < size; i++) {
+    cells_[i].seq.store(i, std::memory_order_relaxed);
+    cells_[i].item.store(nullptr, std::memory_order_relaxed);
+    cells_[i].pushed_ns.store(0, std::memory_order_relaxed);
+  }
+  tail_.store(0, std::memory_order_relaxed);
+  head_.store(0, std::memory_order_relaxed);
+}
+
+TaskQueue::~TaskQueue() {
+  delete[] cells_;
+}
+
+bool TaskQueue::push(void *item, int64_t now_ns) {
+  size_t pos = tail_.load(std::memory_order_relaxed);
+  Cell *cell;
+  while (1) {
+    cell = &cells_[pos & mask_];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if (dif == 0) {
+      // The slot is free on this lap; claim it.
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (dif < 0) {
+      // The slot still holds the item from the previous lap.
+      return false;
+    } else {
+      // Another producer got here first.
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+  cell->item.store(item, std::memory_order_relaxed);
+  cell->pushed_ns.store(now_ns, std::memory_order_relaxed);
+  cell->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+void *TaskQueue::pop(int64_t *pushed_ns) {
+  size_t pos = head_.load(std::memory_order_relaxed);
+  Cell *cell;
+  while (1) {
+    cell = &cells_[pos & mask_];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    intptr_t dif =
+      static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+    if (dif == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (dif < 0) {
+      // Nothing has been pushed at this position yet.
+      return nullptr;
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+  void *item = cell->item.load(std::memory_order_relaxed);
+  if (pushed_ns != nullptr) {
+    *pushed_ns = cell->pushed_ns.load(std::memory_order_relaxed);
+  }
+  // Hand the slot to the producer that pushes on the next lap.
+  cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+  return item;
+}
+
+int64_t TaskQueue::oldest_pushed_ns() const {
+  while (1) {
+    size_t pos = head_.load(std::memory_order_acquire);
+    const Cell &cell = cells_[pos & mask_];
+    if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+      // Either the queue is empty, or the head just moved on.
+      if (head_.load(std::memory_order_acquire) == pos) {
+        return -1;
+      }
+      continue;
+    }
+    int64_t ns = cell.pushed_ns.load(std::memory_order_relaxed);
+    // If the slot wasn't popped (and refilled) while we read it, the
+    // stamp belongs to the item at the head.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (cell.seq.load(std::memory_order_relaxed) == pos + 1) {
+      return ns;
+    }
+  }
+}
+
+TaskDeque::TaskDeque(uint32_t capacity) {
+  int64_t size = 2;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  items_ = new std::atomic<void *>[size];
+  mask_ = size - 1;
+  for (int64_t i = 0; i < size; i++) {
+    items_[i].store(nullptr, std::memory_order_relaxed);
+  }
+  top_.store(0, std::memory_order_relaxed);
+  bottom_.store(0, std::memory_order_relaxed);
+}
+
+TaskDeque::~TaskDeque() {
+  delete[] items_;
+}
+
+bool TaskDeque::push(void *item) {
+  int64_t b = bottom_.load(std::memory_order_relaxed);
+  int64_t t = top_.load(std::memory_order_acquire);
+  if (b - t > mask_) {
+    return false;
+  }
+  items_[b & mask_].store(item, std::memory_order_relaxed);
+  // Publish the item before the new bottom that makes it stealable.
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom_.store(b + 1, std::memory_order_relaxed);
+  return true;
+}
+
+void *TaskDeque::pop() {
+  // Claim the bottom item before looking at top_, so that a thief
+  // that hasn't seen the claim yet can only be after the same item.
+  int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+  bottom_.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = top_.load(std::memory_order_relaxed);
+  if (t > b) {
+    // It was empty.
+    bottom_.store(b + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  void *item = items_[b & mask_].load(std::memory_order_relaxed);
+  if (t == b) {
+    // This is the last item, so race the thieves for it.
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      item = nullptr;
+    }
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+  return item;
+}
+
+void *TaskDeque::steal() {
+  int64_t t = top_.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t b = bottom_.load(std::memory_order_acquire);
+  if (t >= b) {
+    return nullptr;
+  }
+  void *item = items_[t & mask_].load(std::memory_order_relaxed);
+  if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                    std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  return item;
+}
+
+bool TaskDeque::empty() const {
+  int64_t b = bottom_.load(std::memory_order_acquire);
+  int64_t t = top_.load(std::memory_order_acquire);
+  return t >= b;
+}
+
+}  // namespace searchserver
@@ -0,0 +1,123 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef TASKQUEUE_H_
+#define TASKQUEUE_H_
+
+#include <atomic>    // for std::atomic
+#include <cstddef>   // for size_t
+#include <cstdint>   // for int64_t, etc.
+
+namespace searchserver {
+
+// The lock-free queues that ThreadPool hands tasks out through.
+
+// A TaskQueue is a bounded, lock-free, multi-producer multi-consumer
+// FIFO of pointers, after Dmitry Vyukov's ring buffer queue.  Each
+// slot of the ring carries a sequence number that says whether it is
+// ready to be filled or emptied on the current lap around the ring,
+// so producers only contend on a compare-and-swap of the tail and
+// consumers on one of the head.  Nothing is allocated after the
+// queue is constructed.
+//
+// Every item is stamped with a time when it is pushed, which lets
+// customers see how long the oldest item has been waiting.
+class TaskQueue {
+ public:
+  // Creates an empty queue that holds up to "capacity" items, rounded
+  // up to a power of two.
+  explicit TaskQueue(uint32_t capacity);
+  virtual ~TaskQueue();
+
+  // Appends "item", stamped with "now_ns".  Returns false, and leaves
+  // the queue alone, if the queue is full.
+  bool push(void *item, int64_t now_ns);
+
+  // Removes and returns the oldest item, or returns nullptr if the
+  // queue is empty.  If "pushed_ns" isn't nullptr, the item's stamp
+  // is returned through it.
+  void *pop(int64_t *pushed_ns);
+
+  // Returns the stamp of the oldest item, or -1 if the queue is
+  // empty.  With other threads pushing and popping, this is only a
+  // snapshot, but it is always the stamp of an item that was at the
+  // head of the queue.
+  int64_t oldest_pushed_ns() const;
+
+  // Returns how many items the queue holds at most.
+  size_t capacity() const { return mask_ + 1; }
+
+  TaskQueue(const TaskQueue& other) = delete;
+  TaskQueue& operator=(const TaskQueue& other) = delete;
+
+ private:
+  // One slot of the ring.  "seq" equals the position the slot will
+  // next be pushed at when it is empty, and that position plus one
+  // once it holds an item.
+  struct Cell {
+    std::atomic<size_t> seq;
+    std::atomic<void *> item;
+    std::atomic<int64_t> pushed_ns;
+  };
+
+  Cell *cells_;
+  size_t mask_;
+
+  // The next positions to push at and pop from.  They live on their
+  // own cache lines so that producers and consumers don't share one.
+  alignas(64) std::atomic<size_t> tail_;
+  alignas(64) std::atomic<size_t> head_;
+};
+
+// A TaskDeque is a Chase-Lev work-stealing deque of pointers, with a
+// fixed capacity.  One thread, the owner, pushes and pops items at the
+// bottom, newest first, which keeps it working on what it touched
+// last.  Any other thread may steal the oldest item from the top.
+// The owner only has to synchronize with thieves when it is down to
+// its last item.
+class TaskDeque {
+ public:
+  // Creates an empty deque that holds up to "capacity" items, rounded
+  // up to a power of two.
+  explicit TaskDeque(uint32_t capacity);
+  virtual ~TaskDeque();
+
+  // Pushes "item" onto the bottom.  Returns false, and leaves the
+  // deque alone, if the deque is full.  Only the owner may call this.
+  bool push(void *item);
+
+  // Removes and returns the newest item, or returns nullptr if the
+  // deque is empty.  Only the owner may call this.
+  void *pop();
+
+  // Removes and returns the oldest item.  Returns nullptr if the
+  // deque is empty, or if another thread took that item first.  Any
+  // thread may call this.
+  void *steal();
+
+  // Returns true if the deque looks empty.  Only a snapshot.
+  bool empty() const;
+
+  TaskDeque(const TaskDeque& other) = delete;
+  TaskDeque& operator=(const TaskDeque& other) = delete;
+
+ private:
+  std::atomic<void *> *items_;
+  int64_t mask_;
+
+  // Thieves take from top_, the owner works at bottom_.
+  alignas(64) std::atomic<int64_t> top_;
+  alignas(64) std::atomic<int64_t> bottom_;
+};
+
+}  // namespace searchserver
+
+#endif  // TASKQUEUE_H_
@@ -9,127 +9,913 @@
  * author.
  */
 
+#include <dirent.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
 #include <iostream>
+#ifdef __SSE2__
+#include <emmintrin.h>  // for _mm_pause()
+#endif
 
 #include "./ThreadPool.h"
 
 namespace searchserver {
 
 // This is the thread start routine, i.e., the function that threads
-// are born into.
-void *thread_loop(void *t_pool);
+// are born into.  Its argument is the thread's ThreadPool::Worker.
+void *thread_loop(void *arg);
 
-ThreadPool::ThreadPool(uint32_t num_threads) {
-  // Initialize our member variables.
+// Returns the CLOCK_MONOTONIC time in nanoseconds.
+static int64_t NowNs();
+
+// Sleeps on the futex "word" for as long as it holds "expected", or
+// until "timeout_ns" have passed if that is positive.  Returns false
+// if the wait timed out.
+static bool FutexWait(std::atomic<uint32_t> *word, uint32_t expected,
+                      int64_t timeout_ns);
+
+// Wakes up to "count" threads sleeping on the futex "word".
+static void FutexWake(std::atomic<uint32_t> *word, int count);
+
+// Tells the CPU we're spinning, so it can give the other hyperthread
+// the core for a bit.
+static void CpuRelax();
+
+// Fills "node_cpus" with the CPUs on each NUMA node, as listed under
+// /sys/devices/system/node.  Returns false if the listing isn't there.
+static bool ReadNumaNodes(std::vector<std::vector<int>> *node_cpus);
+
+// Parses a sysfs CPU list, such as "0-3,8-11", into "cpus".
+static void ParseCpuList(const char *list, std::vector<int> *cpus);
+
+// The pool the current thread works for, if any, and its number in
+// that pool.
+static thread_local ThreadPool *t_pool = nullptr;
+static thread_local uint32_t t_worker = 0;
+
+// The state of the current thread's random number generator, which
+// picks the worker to steal from first.
+static thread_local uint32_t t_steal_seed = 0;
+
+// How many times an idle worker looks for a task before it goes to
+// sleep, on machines with more than one CPU.
+static const int kIdleSpins = 128;
+
+// How many free CallableTask blocks each thread keeps, and how many
+// more are kept for all threads to share.
+static const int kCallableTaskCacheSize = 64;
+static const uint32_t kSharedCallableTasks = 4096;
+
+// A thread's cache of free CallableTask blocks.  When the thread
+// exits, they go to the shared cache.
+struct CallableTaskCache {
+  ~CallableTaskCache();
+  void *blocks[kCallableTaskCacheSize];
+  int count = 0;
+};
+static thread_local CallableTaskCache t_callable_cache;
+
+// The shared cache of free CallableTask blocks.  It is never
+// destroyed, since threads may still be exiting, and returning blocks
+// to it, while static objects are.
+static TaskQueue *SharedCallableTasks();
+
+// static
+const uint32_t ThreadPool::kDefaultQueueCapacity = 4096;
+
+// static
+const uint32_t ThreadPool::kDequeCapacity = 1024;
+
+// static
+const uint32_t ThreadPool::kMaxLanes = 4;
+
+ThreadPool::ThreadPool(uint32_t num_threads, uint32_t queue_capacity)
+  : ThreadPool(num_threads, num_threads, 0, queue_capacity) { }
+
+ThreadPool::ThreadPool(uint32_t min_threads, uint32_t max_threads,
+                       uint32_t idle_timeout_ms, uint32_t queue_capacity)
+{
+  // Initialize our member variables, starting out with one lane.
   num_threads_running_ = 0;
   killthreads_ = false;
-  pthread_mutex_init(&q_lock_, nullptr);
-  pthread_cond_init(&q_cond_, nullptr);
-
-  // Allocate the array of pthread structures.
-  thread_array_ = new pthread_t[num_threads];
+  queue_capacity_ = queue_capacity;
+  lanes_.assign(kMaxLanes, nullptr);
+  lanes_[0] = new Lane(queue_capacity, LaneOptions());
+  num_lanes_ = 1;
+  total_weight_ = 1;
+  lane_tick_ = 0;
+  wake_seq_ = 0;
+  num_sleeping_ = 0;
+  wake_pending_ = false;
+  idle_spins_ = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? kIdleSpins : 0;
+  work_stealing_ = false;
+  min_threads_ = min_threads;
+  max_threads_ = (max_threads > min_threads) ? max_threads : min_threads;
+  idle_timeout_ns_ = static_cast<int64_t>(idle_timeout_ms) * 1000000;
+  num_started_ = 0;
+  num_idle_ = 0;
+  deques_pending_ = 0;
+  target_ns_ = 0;
+  interval_ns_ = 0;
+  above_target_since_ns_ = 0;
+  overload_ended_ns_ = 0;
+  overloaded_ = false;
+  pthread_mutex_init(&admission_lock_, nullptr);
+  pthread_mutex_init(&workers_lock_, nullptr);
 
-  // Spawn the threads one by one, passing them a pointer to self
-  // as the argument to the thread start routine.
-  pthread_mutex_lock(&q_lock_);
-  for (uint32_t i = 0; i < num_threads; i++) {
-    pthread_create(&(thread_array_[i]),
-                             nullptr,
-                             &thread_loop,
-                             static_cast<void *>(this));
+  // Allocate a slot for every worker the pool may have.  Each slot's
+  // deque is allocated by the first worker to run in it.
+  workers_ = new Worker[max_threads_];
+  num_deques_ = max_threads_;
+  deques_ = new std::atomic<TaskDeque *>[max_threads_];
+  for (uint32_t i = 0; i < max_threads_; i++) {
+    workers_[i].pool = this;
+    workers_[i].index = i;
+    workers_[i].state = kSlotFree;
+    workers_[i].replace_deque = false;
+    deques_[i] = nullptr;
   }
 
-  // Wait for all of the threads to be born and initialized.
-  while (num_threads_running_ != num_threads) {
-    pthread_mutex_unlock(&q_lock_);
-    sleep(1);  // give another thread the chance to acquire the lock
-    pthread_mutex_lock(&q_lock_);
+  // Spawn the initial threads, then wait for all of them to be born
+  // and initialized.  Each one bumps num_started_ and wakes us.
+  for (uint32_t i = 0; i < min_threads_; i++) {
+    add_worker();
+  }
+  uint32_t target = num_threads_running_;
+  uint32_t started;
+  while ((started = num_started_.load()) < target) {
+    FutexWait(&num_started_, started, 0);
   }
-  pthread_mutex_unlock(&q_lock_);
 
   // Done!  The thread pool is ready, and all of the worker threads
-  // are initialized and waiting on q_cond_ to be notified of available
-  // work.
+  // are initialized and waiting for work.
 }
 
 ThreadPool:: ~ThreadPool() {
-  pthread_mutex_lock(&q_lock_);
-  uint32_t num_threads = num_threads_running_;
-
-  // Tell all of the worker threads to kill themselves.
+  // Tell all of the worker threads to kill themselves, and wake up
+  // any that are asleep so they notice.  Setting killthreads_ under
+  // workers_lock_ means no worker gets added or retired after this.
+  pthread_mutex_lock(&workers_lock_);
   killthreads_ = true;
+  pthread_mutex_unlock(&workers_lock_);
+  wake_seq_++;
+  FutexWake(&wake_seq_, INT_MAX);
 
-  // Join with the running threads 1-by-1 until they have all died.
-  for (uint32_t i = 0; i < num_threads; i++) {
-    // Use a sledgehammer and broadcast every loop iteration, just to
-    // be extra-certain that worker threads wake up and see the "kill
-    // yourself" flag.
-    pthread_cond_broadcast(&q_cond_);
-    pthread_mutex_unlock(&q_lock_);
-    pthread_join(thread_array_[i], nullptr);
-    pthread_mutex_lock(&q_lock_);
+  // Join with the threads 1-by-1 until they have all died, including
+  // any that retired and haven't been joined yet.
+  for (uint32_t i = 0; i < max_threads_; i++) {
+    if (workers_[i].state != kSlotFree) {
+      pthread_join(workers_[i].thread, nullptr);
+    }
   }
 
   // All of the worker threads are dead, so clean up the thread
   // structures.
-  if (thread_array_ != nullptr) {
-    delete[] thread_array_;
-  }
-  thread_array_ = nullptr;
-  pthread_mutex_unlock(&q_lock_);
+  delete[] workers_;
+  workers_ = nullptr;
 
   // Empty the task queue, serially issuing any remaining work.
-  while (!work_queue_.empty()) {
-    Task *nextTask = work_queue_.front();
-    work_queue_.pop_front();
+  int64_t dispatch_ns;
+  Task *nextTask;
+  int counted_lane;
+  while ((nextTask = next_task(&dispatch_ns, &counted_lane)) != nullptr) {
     nextTask->func_(nextTask);
+    if (counted_lane >= 0) {
+      finish_task(counted_lane);
+    }
+  }
+  for (uint32_t i = 0; i < num_deques_; i++) {
+    delete deques_[i].load(std::memory_order_relaxed);
+  }
+  delete[] deques_;
+  for (Lane *lane : lanes_) {
+    delete lane;
   }
+  pthread_mutex_destroy(&admission_lock_);
+  pthread_mutex_destroy(&workers_lock_);
+}
+
+void ThreadPool::add_worker() {
+  pthread_mutex_lock(&workers_lock_);
+  if (!killthreads_ && num_threads_running_ < max_threads_) {
+    uint32_t i = 0;
+    while (workers_[i].state == kSlotRunning) {
+      i++;
+    }
+
+    // A slot whose thread retired still has to be joined before it
+    // can be reused.  The thread gave the slot up on its way out, so
+    // this doesn't wait long.
+    if (workers_[i].state == kSlotExited) {
+      pthread_join(workers_[i].thread, nullptr);
+      workers_[i].state = kSlotFree;
+    }
+
+    // Pass the new thread its slot, and through it a pointer to self.
+    // If workers are pinned, the thread starts out on its CPUs, so
+    // that even its stack is allocated there.
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (!slot_cpus_.empty()) {
+      pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &slot_cpus_[i]);
+    }
+    if (pthread_create(&workers_[i].thread, &attr, &thread_loop,
+                       static_cast<void *>(&workers_[i])) == 0) {
+      workers_[i].state = kSlotRunning;
+      num_threads_running_++;
+    } else {
+      perror("pthread_create() failed");
+    }
+    pthread_attr_destroy(&attr);
+  }
+  pthread_mutex_unlock(&workers_lock_);
+}
+
+bool ThreadPool::set_cpu_affinity(const std::vector<int> &cpus,
+                                  Placement placement) {
+  // Work out which of the CPUs asked for we may run on.
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return false;
+  }
+  cpu_set_t usable;
+  CPU_ZERO(&usable);
+  if (cpus.empty()) {
+    usable = allowed;
+  }
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+      CPU_SET(cpu, &usable);
+    }
+  }
+  if (CPU_COUNT(&usable) == 0) {
+    return false;
+  }
+
+  // Work out the CPUs for each slot.  Nodes are only the ones with
+  // usable CPUs; without a NUMA listing, all CPUs are one node.
+  std::vector<cpu_set_t> groups;
+  if (placement == kPinToCpu) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &usable)) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        groups.push_back(set);
+      }
+    }
+  } else if (placement == kPinToNode) {
+    std::vector<std::vector<int>> node_cpus;
+    if (ReadNumaNodes(&node_cpus)) {
+      for (const std::vector<int> &node : node_cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : node) {
+          if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &usable)) {
+            CPU_SET(cpu, &set);
+          }
+        }
+        if (CPU_COUNT(&set) > 0) {
+          groups.push_back(set);
+        }
+      }
+    }
+    if (groups.empty()) {
+      groups.push_back(usable);
+    }
+  }
+  std::vector<cpu_set_t> slot_cpus;
+  for (uint32_t i = 0; i < max_threads_ && !groups.empty(); i++) {
+    slot_cpus.push_back(groups[i % groups.size()]);
+  }
+
+  // Move the running workers.  If any of them can't be moved, put
+  // them all back.
+  pthread_mutex_lock(&workers_lock_);
+  bool ok = true;
+  for (uint32_t i = 0; i < max_threads_ && ok; i++) {
+    if (workers_[i].state == kSlotRunning) {
+      ok = pthread_setaffinity_np(workers_[i].thread, sizeof(cpu_set_t),
+                                  slot_cpus.empty() ? &allowed
+                                                    : &slot_cpus[i]) == 0;
+    }
+  }
+  if (!ok) {
+    slot_cpus.clear();
+    for (uint32_t i = 0; i < max_threads_; i++) {
+      if (workers_[i].state == kSlotRunning) {
+        pthread_setaffinity_np(workers_[i].thread, sizeof(cpu_set_t),
+                               &allowed);
+      }
+    }
+  }
+  slot_cpus_ = slot_cpus;
+
+  // The deques have to be rebuilt on their workers' nodes.  Freeing
+  // one and allocating another here would just get the same memory
+  // back, so each worker allocates its own, now that it runs on its
+  // node, and its first touch places the new pages there.  A slot
+  // with no worker gives up its deque to the next worker born into
+  // it, which starts out pinned.  Until work stealing is turned on,
+  // no one else looks at the deques.
+  bool rebuild = ok && placement == kPinToNode &&
+                 !work_stealing_.load(std::memory_order_relaxed);
+  if (rebuild) {
+    for (uint32_t i = 0; i < max_threads_; i++) {
+      if (workers_[i].state == kSlotRunning) {
+        deques_pending_++;
+        workers_[i].replace_deque = true;
+      } else {
+        delete deques_[i].exchange(nullptr, std::memory_order_acq_rel);
+      }
+    }
+  }
+  pthread_mutex_unlock(&workers_lock_);
+
+  // Wake the workers so they see that, and wait until they have.  A
+  // worker retiring in the meantime is counted off as it goes.
+  if (rebuild) {
+    wake_seq_++;
+    FutexWake(&wake_seq_, INT_MAX);
+    uint32_t pending;
+    while ((pending = deques_pending_.load()) > 0) {
+      FutexWait(&deques_pending_, pending, 0);
+    }
+  }
+  return ok;
+}
+
+void ThreadPool::place_deque() {
+  Worker *worker = &workers_[t_worker];
+  std::atomic<TaskDeque *> *deque = &deques_[t_worker];
+  if (deque->load(std::memory_order_acquire) == nullptr) {
+    deque->store(new TaskDeque(kDequeCapacity), std::memory_order_release);
+  }
+  if (worker->replace_deque.exchange(false, std::memory_order_acq_rel)) {
+    // Allocate the new deque before freeing the old one, so that it
+    // can't simply be given the old one's memory back.
+    TaskDeque *old = deque->exchange(new TaskDeque(kDequeCapacity),
+                                     std::memory_order_acq_rel);
+    delete old;
+    deques_pending_--;
+    FutexWake(&deques_pending_, 1);
+  }
+}
+
+bool ThreadPool::retire_worker() {
+  pthread_mutex_lock(&workers_lock_);
+  bool retire = !killthreads_ && num_threads_running_ > min_threads_;
+  if (retire) {
+    // Our wait may have timed out just as a task was dispatched, in
+    // which case the dispatch() saw us neither asleep, to wake us, nor
+    // busy, to add a worker.  So stop counting ourselves as running
+    // and idle before looking at the queue one last time; the fence
+    // pairs with the one in dispatch(), so either that sees us gone
+    // and adds a worker (once we've let go of workers_lock_), or we
+    // see its task here and stay.
+    num_threads_running_--;
+    num_idle_.fetch_sub(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (has_queued_tasks()) {
+      num_threads_running_++;
+      num_idle_.fetch_add(1, std::memory_order_relaxed);
+      retire = false;
+    }
+  }
+  if (retire) {
+    workers_[t_worker].state = kSlotExited;
+
+    // If set_cpu_affinity() is waiting for us to rebuild our deque,
+    // leave it to whoever takes the slot next instead.
+    if (workers_[t_worker].replace_deque.exchange(false)) {
+      delete deques_[t_worker].exchange(nullptr, std::memory_order_acq_rel);
+      deques_pending_--;
+      FutexWake(&deques_pending_, 1);
+    }
+  }
+  pthread_mutex_unlock(&workers_lock_);
+  return retire;
+}
+
+ThreadPool::Lane::Lane(uint32_t queue_capacity, const LaneOptions &options)
+  : queue(queue_capacity), overflow_size(0), options(options),
+    num_running(0) {
+  pthread_mutex_init(&overflow_lock, nullptr);
+}
+
+ThreadPool::Lane::~Lane() {
+  pthread_mutex_destroy(&overflow_lock);
+}
+
+// static
+void ThreadPool::RunCallable(Task *t) {
+  CallableTask *task = static_cast<CallableTask *>(t);
+  task->run_(task);
+  task->~CallableTask();
+  FreeCallableTask(task);
+}
+
+// static
+void *ThreadPool::AllocCallableTask() {
+  CallableTaskCache *cache = &t_callable_cache;
+  if (cache->count > 0) {
+    return cache->blocks[--cache->count];
+  }
+  int64_t pushed_ns;
+  void *block = SharedCallableTasks()->pop(&pushed_ns);
+  if (block != nullptr) {
+    return block;
+  }
+  return ::operator new(sizeof(CallableTask));
+}
+
+// static
+void ThreadPool::FreeCallableTask(void *block) {
+  CallableTaskCache *cache = &t_callable_cache;
+  if (cache->count < kCallableTaskCacheSize) {
+    cache->blocks[cache->count++] = block;
+  } else if (!SharedCallableTasks()->push(block, 0)) {
+    ::operator delete(block);
+  }
+}
+
+CallableTaskCache::~CallableTaskCache() {
+  while (count > 0) {
+    void *block = blocks[--count];
+    if (!SharedCallableTasks()->push(block, 0)) {
+      ::operator delete(block);
+    }
+  }
+}
+
+static TaskQueue *SharedCallableTasks() {
+  static TaskQueue *shared = new TaskQueue(kSharedCallableTasks);
+  return shared;
+}
+
+bool ThreadPool::set_lanes(const std::vector<LaneOptions> &lanes) {
+  if (lanes.empty() || lanes.size() > kMaxLanes) {
+    return false;
+  }
+  uint32_t total_weight = 0;
+  for (const LaneOptions &options : lanes) {
+    if (options.weight == 0) {
+      return false;
+    }
+    total_weight += options.weight;
+  }
+
+  // Workers may already be looking at lane 0, so its options are set
+  // in place.  The new lanes are only looked at once num_lanes_ says
+  // they're there.
+  lanes_[0]->options = lanes[0];
+  for (uint32_t i = 1; i < lanes.size(); i++) {
+    lanes_[i] = new Lane(queue_capacity_, lanes[i]);
+  }
+  total_weight_ = total_weight;
+  num_lanes_.store(lanes.size(), std::memory_order_release);
+  return true;
 }
 
 // Enqueue a Task for dispatch.
 void ThreadPool::dispatch(Task *t) {
-  pthread_mutex_lock(&q_lock_);
-  work_queue_.push_back(t);
-  pthread_cond_signal(&q_cond_);
-  pthread_mutex_unlock(&q_lock_);
+  t->dispatch_ns_ = NowNs();
+  uint32_t num_lanes = num_lanes_.load(std::memory_order_acquire);
+  if (t->lane_ >= num_lanes) {
+    t->lane_ = num_lanes - 1;
+  }
+  Lane *lane = lanes_[t->lane_];
+  if (t_pool == this && t->lane_ == 0 &&
+      work_stealing_.load(std::memory_order_relaxed) &&
+      deques_[t_worker].load(std::memory_order_relaxed)->push(t)) {
+    // One of our workers spawned this task, so it goes on the
+    // worker's own deque.
+  } else if (lane->overflow_size.load(std::memory_order_acquire) > 0 ||
+             !lane->queue.push(t, t->dispatch_ns_)) {
+    pthread_mutex_lock(&lane->overflow_lock);
+    lane->overflow_queue.push_back(t);
+    lane->overflow_size++;
+    pthread_mutex_unlock(&lane->overflow_lock);
+  }
+
+  // A worker about to go to sleep either sees the new task, or is
+  // counted in num_sleeping_ and gets woken up.  The fence keeps the
+  // load of num_sleeping_ from moving ahead of the push.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  wake_worker();
+
+  // If every worker is busy, the task would have to wait for one, so
+  // grow the pool if we may.
+  if (num_threads_running_.load(std::memory_order_relaxed) < max_threads_ &&
+      num_idle_.load(std::memory_order_relaxed) == 0) {
+    add_worker();
+  }
+}
+
+void ThreadPool::wake_worker() {
+  if (num_sleeping_.load(std::memory_order_relaxed) > 0 &&
+      !wake_pending_.load(std::memory_order_relaxed) &&
+      !wake_pending_.exchange(true, std::memory_order_acq_rel)) {
+    wake_seq_.fetch_add(1, std::memory_order_seq_cst);
+    FutexWake(&wake_seq_, 1);
+  }
+}
+
+bool ThreadPool::has_queued_tasks() const {
+  uint32_t num_lanes = num_lanes_.load(std::memory_order_acquire);
+  for (uint32_t i = 0; i < num_lanes; i++) {
+    if (lanes_[i]->queue.oldest_pushed_ns() >= 0 ||
+        lanes_[i]->overflow_size.load(std::memory_order_acquire) > 0) {
+      return true;
+    }
+  }
+  if (work_stealing_.load(std::memory_order_relaxed)) {
+    for (uint32_t i = 0; i < num_deques_; i++) {
+      TaskDeque *deque = deques_[i].load(std::memory_order_acquire);
+      if (deque != nullptr && !deque->empty()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+ThreadPool::Task *ThreadPool::next_task(int64_t *dispatch_ns,
+                                        int *counted_lane) {
+  *counted_lane = -1;
+  bool stealing = work_stealing_.load(std::memory_order_relaxed);
+  Task *t = nullptr;
+  if (stealing && t_pool == this) {
+    t = static_cast<Task *>(
+          deques_[t_worker].load(std::memory_order_relaxed)->pop());
+    if (t != nullptr) {
+      *dispatch_ns = t->dispatch_ns_;
+      return t;
+    }
+  }
+
+  // With several lanes, pick the one to try first by weighted round
+  // robin, then fall back to the others so no worker sits idle while
+  // there's work it may take.
+  uint32_t num_lanes = num_lanes_.load(std::memory_order_acquire);
+  uint32_t first = 0;
+  if (num_lanes > 1) {
+    uint32_t tick = lane_tick_.fetch_add(1, std::memory_order_relaxed) %
+                    total_weight_;
+    while (tick >= lanes_[first]->options.weight) {
+      tick -= lanes_[first]->options.weight;
+      first++;
+    }
+  }
+  for (uint32_t i = 0; i < num_lanes; i++) {
+    uint32_t lane = (first + i) % num_lanes;
+    t = pop_lane(lanes_[lane], dispatch_ns);
+    if (t != nullptr) {
+      if (lanes_[lane]->options.max_workers > 0) {
+        *counted_lane = lane;
+      }
+      return t;
+    }
+  }
+
+  if (stealing) {
+    t = steal_task();
+    if (t != nullptr) {
+      *dispatch_ns = t->dispatch_ns_;
+    }
+  }
+  return t;
+}
+
+ThreadPool::Task *ThreadPool::pop_lane(Lane *lane, int64_t *dispatch_ns) {
+  // Claim a place under the lane's limit before looking for a task,
+  // and give it back if there isn't one.
+  uint32_t max_workers = lane->options.max_workers;
+  if (max_workers > 0) {
+    uint32_t running = lane->num_running.load(std::memory_order_relaxed);
+    do {
+      if (running >= max_workers) {
+        return nullptr;
+      }
+    } while (!lane->num_running.compare_exchange_weak(
+               running, running + 1, std::memory_order_acq_rel));
+  }
+
+  Task *t = static_cast<Task *>(lane->queue.pop(dispatch_ns));
+  if (t == nullptr &&
+      lane->overflow_size.load(std::memory_order_acquire) > 0) {
+    pthread_mutex_lock(&lane->overflow_lock);
+    if (!lane->overflow_queue.empty()) {
+      t = lane->overflow_queue.front();
+      lane->overflow_queue.pop_front();
+      lane->overflow_size--;
+      *dispatch_ns = t->dispatch_ns_;
+    }
+    pthread_mutex_unlock(&lane->overflow_lock);
+  }
+  if (t == nullptr && max_workers > 0) {
+    lane->num_running.fetch_sub(1, std::memory_order_acq_rel);
+  }
+  return t;
+}
+
+void ThreadPool::finish_task(uint32_t lane) {
+  lanes_[lane]->num_running.fetch_sub(1, std::memory_order_acq_rel);
+
+  // A task may have been passed over, with workers going to sleep,
+  // because this lane was full.
+  if (num_sleeping_.load(std::memory_order_relaxed) > 0 &&
+      has_queued_tasks()) {
+    wake_worker();
+  }
+}
+
+ThreadPool::Task *ThreadPool::steal_task() {
+  // Start with a random victim, so that thieves spread out rather
+  // than all going after the same worker.
+  uint32_t seed = t_steal_seed;
+  if (seed == 0) {
+    seed = static_cast<uint32_t>(NowNs()) | 1;
+  }
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  t_steal_seed = seed;
+
+  uint32_t start = seed % num_deques_;
+  for (uint32_t i = 0; i < num_deques_; i++) {
+    uint32_t victim = (start + i) % num_deques_;
+    TaskDeque *deque = deques_[victim].load(std::memory_order_acquire);
+    if (deque == nullptr || (t_pool == this && victim == t_worker)) {
+      continue;
+    }
+    Task *t = static_cast<Task *>(deque->steal());
+    if (t != nullptr) {
+      return t;
+    }
+  }
+  return nullptr;
+}
+
+ThreadPool::Task *ThreadPool::wait_for_task(int64_t *dispatch_ns,
+                                            int *counted_lane) {
+  num_idle_.fetch_add(1, std::memory_order_relaxed);
+  while (!killthreads_.load(std::memory_order_acquire)) {
+    place_deque();
+    Task *t = nullptr;
+    for (int i = 0; i <= idle_spins_ && t == nullptr; i++) {
+      t = next_task(dispatch_ns, counted_lane);
+      if (t == nullptr && i < idle_spins_) {
+        CpuRelax();
+      }
+    }
+
+    bool timed_out = false;
+    if (t == nullptr) {
+      // Announce that we're going to sleep before looking one last
+      // time, so that a dispatch() racing with us either sees us or
+      // leaves a task for us to find.  Workers beyond min_threads_
+      // only sleep for idle_timeout_ns_.
+      num_sleeping_.fetch_add(1, std::memory_order_seq_cst);
+      wake_pending_.store(false, std::memory_order_seq_cst);
+      uint32_t seq = wake_seq_.load(std::memory_order_seq_cst);
+      t = next_task(dispatch_ns, counted_lane);
+      if (t == nullptr && !killthreads_.load(std::memory_order_acquire) &&
+          !workers_[t_worker].replace_deque.load()) {
+        int64_t timeout_ns =
+          (num_threads_running_.load(std::memory_order_relaxed) >
+           min_threads_) ? idle_timeout_ns_ : 0;
+        timed_out = !FutexWait(&wake_seq_, seq, timeout_ns);
+      }
+      num_sleeping_.fetch_sub(1, std::memory_order_seq_cst);
+      wake_pending_.store(false, std::memory_order_seq_cst);
+    }
+
+    if (t != nullptr) {
+      num_idle_.fetch_sub(1, std::memory_order_relaxed);
+
+      // If there's more work than we can take, get help with it.
+      if (num_sleeping_.load(std::memory_order_relaxed) > 0 &&
+          has_queued_tasks()) {
+        wake_worker();
+      } else if (num_threads_running_.load(std::memory_order_relaxed) <
+                 max_threads_ &&
+                 num_idle_.load(std::memory_order_relaxed) == 0 &&
+                 has_queued_tasks()) {
+        add_worker();
+      }
+      return t;
+    }
+
+    if (timed_out && retire_worker()) {
+      return nullptr;
+    }
+  }
+  num_idle_.fetch_sub(1, std::memory_order_relaxed);
+  return nullptr;
+}
+
+void ThreadPool::set_admission_control(uint32_t target_ms,
+                                       uint32_t interval_ms) {
+  pthread_mutex_lock(&admission_lock_);
+  target_ns_ = static_cast<int64_t>(target_ms) * 1000000;
+  interval_ns_ = static_cast<int64_t>(interval_ms) * 1000000;
+  above_target_since_ns_ = 0;
+  overload_ended_ns_ = 0;
+  overloaded_ = false;
+  pthread_mutex_unlock(&admission_lock_);
+}
+
+bool ThreadPool::overloaded() {
+  pthread_mutex_lock(&admission_lock_);
+  bool res = false;
+  if (target_ns_ > 0) {
+    // The task at the head of a lane has waited the longest in it,
+    // and will have waited at least this long by the time it runs.
+    // Tasks only overflow when the ring is full, so the ring's head is
+    // older than any of them.
+    int64_t now = NowNs();
+    int64_t oldest = -1;
+    uint32_t num_lanes = num_lanes_.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < num_lanes; i++) {
+      Lane *lane = lanes_[i];
+      int64_t lane_oldest = lane->queue.oldest_pushed_ns();
+      if (lane_oldest < 0 &&
+          lane->overflow_size.load(std::memory_order_acquire) > 0) {
+        pthread_mutex_lock(&lane->overflow_lock);
+        if (!lane->overflow_queue.empty()) {
+          lane_oldest = lane->overflow_queue.front()->dispatch_ns_;
+        }
+        pthread_mutex_unlock(&lane->overflow_lock);
+      }
+      if (lane_oldest >= 0 && (oldest < 0 || lane_oldest < oldest)) {
+        oldest = lane_oldest;
+      }
+    }
+    res = update_overload((oldest < 0) ? 0 : now - oldest, now);
+  }
+  pthread_mutex_unlock(&admission_lock_);
+  return res;
+}
+bool ThreadPool::update_overload(int64_t sojourn_ns, int64_t now_ns) {
+  if (sojourn_ns < target_ns_) {
+    if (overloaded_) {
+      overload_ended_ns_ = now_ns;
+    }
+    above_target_since_ns_ = 0;
+    overloaded_ = false;
+  } else if (above_target_since_ns_ == 0) {
+    above_target_since_ns_ = now_ns;
+    // Like CoDel, if the overload only just ended, it has come back
+    // rather than started over, so don't give it another interval.
+    if (overload_ended_ns_ != 0 &&
+        now_ns - overload_ended_ns_ < interval_ns_) {
+      overloaded_ = true;
+    }
+  } else if (now_ns - above_target_since_ns_ >= interval_ns_) {
+    overloaded_ = true;
+  }
+  return overloaded_;
 }
 
 // This is the main loop that all worker threads are born into.  They
-// wait for a signal on the work queue condition variable, then they
-// grab work off the queue.  Threads return (i.e., kill themselves)
-// when they notice that killthreads_ is true.
-void *thread_loop(void *t_pool) {
-  ThreadPool *pool = static_cast<ThreadPool *>(t_pool);
+// wait for a task to show up on the queue, then run it.  Threads
+// return (i.e., kill themselves) when they notice that killthreads_
+// is true.
+void *thread_loop(void *arg) {
+  ThreadPool::Worker *worker = static_cast<ThreadPool::Worker *>(arg);
+  ThreadPool *pool = worker->pool;
 
-  // Grab the lock, increment the thread count so that the ThreadPool
-  // constructor knows this new thread is alive.
-  pthread_mutex_lock(&(pool->q_lock_));
-  pool->num_threads_running_++;
+  // Note which pool and slot (and so deque) this thread has, make
+  // sure the slot has a deque, then let the ThreadPool constructor
+  // know this new thread is alive.
+  t_pool = pool;
+  t_worker = worker->index;
+  pool->place_deque();
+  pool->num_started_++;
+  FutexWake(&pool->num_started_, 1);
 
   // This is our main thread work loop.
-  while (pool->killthreads_ == false) {
-    // Wait to be signaled that something has happened.
-    pthread_cond_wait(&(pool->q_cond_), &(pool->q_lock_));
-
-    // Keep trying to dequeue work until the work queue is empty.
-    while (!pool->work_queue_.empty() && (pool->killthreads_ == false)) {
-      ThreadPool::Task *nextTask = pool->work_queue_.front();
-      pool->work_queue_.pop_front();
+  int64_t dispatch_ns;
+  int counted_lane;
+  ThreadPool::Task *nextTask;
+  while ((nextTask = pool->wait_for_task(&dispatch_ns, &counted_lane)) !=
+         nullptr) {
+    if (pool->target_ns_ > 0 &&
+        pthread_mutex_trylock(&pool->admission_lock_) == 0) {
+      int64_t now = NowNs();
+      pool->update_overload(now - dispatch_ns, now);
+      pthread_mutex_unlock(&pool->admission_lock_);
+    }
 
-      // We picked up a Task, so invoke the task function with the
-      // lock released, then check so see if more tasks are waiting to
-      // be picked up.
-      pthread_mutex_unlock(&(pool->q_lock_));
-      nextTask->func_(nextTask);
-      pthread_mutex_lock(&(pool->q_lock_));
+    // We picked up a Task, so invoke the task function, then go
+    // back for the next one.
+    nextTask->func_(nextTask);
+    if (counted_lane >= 0) {
+      pool->finish_task(counted_lane);
     }
   }
 
   // All done, exit.
-  pool->num_threads_running_--;
-  pthread_mutex_unlock(&(pool->q_lock_));
   return nullptr;
 }
 
+static int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void CpuRelax() {
+#ifdef __SSE2__
+  _mm_pause();
+#endif
+}
+
+static bool ReadNumaNodes(std::vector<std::vector<int>> *node_cpus) {
+  DIR *dir = opendir("/sys/devices/system/node");
+  if (dir == nullptr) {
+    return false;
+  }
+  std::vector<int> nodes;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    int node;
+    char extra;
+    if (sscanf(entry->d_name, "node%d%c", &node, &extra) == 1) {
+      nodes.push_back(node);
+    }
+  }
+  closedir(dir);
+  std::sort(nodes.begin(), nodes.end());
+
+  node_cpus->clear();
+  for (int node : nodes) {
+    char path[64], list[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    FILE *f = fopen(path, "r");
+    if (f == nullptr) {
+      continue;
+    }
+    std::vector<int> cpus;
+    if (fgets(list, sizeof(list), f) != nullptr) {
+      ParseCpuList(list, &cpus);
+    }
+    fclose(f);
+    node_cpus->push_back(cpus);
+  }
+  return !node_cpus->empty();
+}
+
+static void ParseCpuList(const char *list, std::vector<int> *cpus) {
+  const char *p = list;
+  while (*p != '\0') {
+    char *end;
+    long first = strtol(p, &end, 10);
+    if (end == p) {
+      break;
+    }
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+    if (*p != ',') {
+      break;
+    }
+    p++;
+  }
+}
+
+static bool FutexWait(std::atomic<uint32_t> *word, uint32_t expected,
+                      int64_t timeout_ns) {
+  struct timespec ts, *timeout = nullptr;
+  if (timeout_ns > 0) {
+    ts.tv_sec = timeout_ns / 1000000000;
+    ts.tv_nsec = timeout_ns % 1000000000;
+    timeout = &ts;
+  }
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word),
+                 FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0) == 0 ||
+         errno != ETIMEDOUT;
+}
+
+static void FutexWake(std::atomic<uint32_t> *word, int count) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE_PRIVATE,
+          count, nullptr, nullptr, 0);
+}
+
 }  // namespace searchserver
@@ -14,10 +14,22 @@
 
 extern "C" {
   #include <pthread.h>  // for the pthread threading/mutex functions
+  #include <sched.h>    // for cpu_set_t
 }
 
+#include <atomic>    // for std::atomic
+#include <cstddef>   // for std::max_align_t
 #include <cstdint>   // for uint32_t, etc.
+#include <exception>  // for std::current_exception
+#include <future>     // for std::future, std::promise
 #include <list>       // for std::list
+#include <memory>     // for std::unique_ptr
+#include <new>        // for placement new
+#include <type_traits>  // for std::decay_t, std::invoke_result_t
+#include <utility>    // for std::forward, std::move
+#include <vector>     // for std::vector
+
+#include "./TaskQueue.h"
 
 namespace searchserver {
 
@@ -28,13 +40,67 @@ namespace searchserver {
 // pointer in the task to process it.  When it is done processing the
 // task, the thread returns to the pool to receive and process the next
 // available task.
+//
+// The queue is a lock-free TaskQueue, so dispatching and picking up
+// tasks never takes a lock or allocates.  Should the ring fill up,
+// tasks spill over into a locked list until it drains.  A worker that
+// finds nothing to do spins briefly, then sleeps on a futex; dispatch()
+// only makes the futex syscall when some worker is asleep.
+//
+// The overflow list has no limit, and each task in it costs a node
+// allocation, so dispatch() never fails but the queue keeps growing
+// for as long as tasks come in faster than they are run.  The pool
+// deliberately doesn't push back itself: customers bound the backlog
+// by checking overloaded() and shedding work instead of dispatching
+// it, as HttpServer does.
+//
+// Tasks can be split by class into lanes (see set_lanes()), each with
+// its own queue.  Workers pick between lanes in proportion to their
+// weights, and a lane can be kept from taking up every worker, so
+// that a burst of expensive tasks in one lane doesn't hold up cheap
+// ones in another.
+//
+// Besides Task subclasses, any callable can be run on the pool with
+// submit() or post().  Small callables are stored inside the task,
+// and the tasks themselves are recycled through per-thread caches, so
+// post() normally doesn't allocate at all.
+//
+// In work-stealing mode (see set_work_stealing()), each worker also
+// owns a TaskDeque.  Tasks that a worker dispatches, such as the
+// subdirectories of a directory being crawled, go onto its own deque
+// rather than the shared queue; it runs them newest first, while its
+// data is still in cache, and idle workers steal the oldest ones.
+//
+// A pool can also be elastic: it starts with a minimum number of
+// workers and adds more, up to a maximum, whenever a task is queued
+// with no worker free to take it.  Workers beyond the minimum that sit
+// idle for longer than a timeout exit again.
 class ThreadPool {
  public:
   // Construct a new ThreadPool with a certain number of worker
   // threads.  Arguments:
   //
   //  - num_threads:  the number of threads in the pool.
-  explicit ThreadPool(uint32_t num_threads);
+  //
+  //  - queue_capacity: how many tasks the lock-free queue holds
+  //    before dispatch() falls back to the overflow list.
+  explicit ThreadPool(uint32_t num_threads,
+                      uint32_t queue_capacity = kDefaultQueueCapacity);
+
+  // Construct an elastic ThreadPool.  Arguments:
+  //
+  //  - min_threads: the number of threads started up front, and the
+  //    number the pool never shrinks below.
+  //
+  //  - max_threads: the most threads the pool grows to.
+  //
+  //  - idle_timeout_ms: how long a thread beyond min_threads waits
+  //    for a task before it exits.
+  //
+  //  - queue_capacity: as above.
+  ThreadPool(uint32_t min_threads, uint32_t max_threads,
+             uint32_t idle_timeout_ms,
+             uint32_t queue_capacity = kDefaultQueueCapacity);
   virtual ~ThreadPool();
 
   // This inner class defines what a Task is.  A worker thread will
@@ -50,41 +116,375 @@ class ThreadPool {
    public:
     // "f" is the task function that a worker thread should invoke to
     // process the task.
-    explicit Task(thread_task_fn func) : func_(func) { }
+    explicit Task(thread_task_fn func)
+      : func_(func), dispatch_ns_(0), lane_(0) { }
 
     // The dispatch function.
     thread_task_fn func_;
+
+    // When the task was handed to dispatch(), in CLOCK_MONOTONIC
+    // nanoseconds.
+    int64_t dispatch_ns_;
+
+    // The lane the task is queued in (see set_lanes()).  Lanes past
+    // the last one the pool has count as the last one.
+    uint32_t lane_;
+  };
+
+  // How one of the pool's lanes is scheduled.
+  struct LaneOptions {
+    // Of the times that workers find tasks waiting in several lanes,
+    // the share each lane goes first is its weight over the sum of
+    // the weights.
+    uint32_t weight = 1;
+
+    // The most workers that may be running the lane's tasks at once,
+    // or 0 for no limit.  Capping a lane keeps the other workers free
+    // for the other lanes.
+    uint32_t max_workers = 0;
   };
 
   // Customers use dispatch() to enqueue a Task for dispatch to a
   // worker thread.
   void dispatch(Task *t);
 
-  // A lock and condition variable that worker threads and the
-  // dispatch function use to guard the Task queue.
-  pthread_mutex_t q_lock_;
-  pthread_cond_t  q_cond_;
+  // Runs the callable "f", which may be move-only, on a worker thread
+  // from lane "lane", and returns a future for its result.  Whatever
+  // "f" throws is passed on through the future.
+  template <typename F>
+  std::future<std::invoke_result_t<std::decay_t<F>>> submit(F &&f,
+                                                           uint32_t lane = 0);
+
+  // Like submit(), but with nothing to wait on.  This skips the
+  // future's shared state, so unless "f" is bigger than
+  // kInlineCallableBytes, it doesn't allocate.  "f" must not throw.
+  template <typename F>
+  void post(F &&f, uint32_t lane = 0);
+
+  // How big a callable may be and still be stored in its task.
+  static constexpr size_t kInlineCallableBytes = 64;
+
+  // Splits the queue into one lane per element of "lanes", at most
+  // kMaxLanes.  Tasks go in the lane their lane_ says.  There is one
+  // lane, with no limit, until this is called.  Returns false, and
+  // changes nothing, if "lanes" is empty, too long or has a weight
+  // of 0.  Must be called once at most, before any tasks are
+  // dispatched.
+  bool set_lanes(const std::vector<LaneOptions> &lanes);
+
+  // Turns work-stealing mode on or off.  Tasks dispatched by one of
+  // the pool's own workers are then pushed onto that worker's deque,
+  // and workers with nothing to do take tasks from the other workers'
+  // deques.  Tasks dispatched from any other thread still go through
+  // the shared queue.  Only lane 0 tasks go on a worker's deque.
+  // Off by default; must be called before any tasks are dispatched.
+  void set_work_stealing(bool work_stealing) {
+    work_stealing_ = work_stealing;
+  }
+
+  // How set_cpu_affinity() places workers.
+  enum Placement {
+    // Workers run wherever the scheduler puts them.
+    kUnpinned,
 
-  // The queue of Tasks waiting to be dispatched to a worker thread.
-  std::list<Task *> work_queue_;
+    // Each worker is pinned to one CPU, round robin.
+    kPinToCpu,
+
+    // Workers are spread round robin across NUMA nodes, and each one
+    // may run on any of its node's CPUs.  Each worker allocates its
+    // deque again once it's on its node, and since Linux places fresh
+    // pages on the node of the CPU that first touches them, the
+    // deque ends up there too.
+    kPinToNode
+  };
+
+  // Pins the workers, present and future, to "cpus" as "placement"
+  // says.  An empty "cpus" means every CPU this process may run on.
+  // CPUs we may not run on are ignored.  Returns false, leaving the
+  // workers unpinned, if there are no CPUs left or pinning fails.
+  // With kPinToNode, waits for every worker to rebuild its deque.
+  // Must be called before any tasks are dispatched or work stealing
+  // is turned on.
+  bool set_cpu_affinity(const std::vector<int> &cpus, Placement placement);
+
+  // Turns on CoDel-style admission control.  The time a task spends
+  // queued (its "sojourn time") is measured as workers pick tasks up,
+  // and the oldest queued task's wait counts as well.  Once it has
+  // stayed above "target_ms" for a whole "interval_ms", the pool is
+  // overloaded until a task gets through in under target_ms again.
+  // A short burst fills the queue without tripping this, but a queue
+  // that never drains does.  If the wait goes back above target
+  // within an interval of the overload ending, the pool is overloaded
+  // again straight away.  A target of 0, the default, turns
+  // admission control off.
+  void set_admission_control(uint32_t target_ms, uint32_t interval_ms);
+
+  // Returns true if the pool is overloaded, in which case customers
+  // should shed new work (e.g. turn new connections away) rather than
+  // dispatch it, so that the queue drains and latency stays bounded.
+  bool overloaded();
+
+  // Returns how many worker threads the pool has right now.
+  uint32_t num_threads() const { return num_threads_running_; }
+
+  static const uint32_t kDefaultQueueCapacity;
+  static const uint32_t kDequeCapacity;
+  static const uint32_t kMaxLanes;
 
   // This should be set to "true" when it is time for the worker
   // threads to kill themselves, i.e., when the ThreadPool is
   // destroyed.  A worker thread will check this variable before
   // picking up its next piece of work; if it is true, the worker
   // threads will kill themselves off.
-  bool killthreads_;
+  std::atomic<bool> killthreads_;
 
-  // This variable stores how many threads are currently running.  As
-  // worker threads are born, they increment it, and as worker threads
-  // kill themselves, they decrement it.
-  uint32_t num_threads_running_;
+  // This variable stores how many threads are currently running.  It
+  // is incremented as worker threads are spawned, and decremented as
+  // idle ones beyond min_threads_ exit.
+  std::atomic<uint32_t> num_threads_running_;
 
  private:
-  // The pthreads pthread_t structures representing each thread.
-  pthread_t *thread_array_;
+  friend void *thread_loop(void *arg);
+
+  // The Task that post() queues.  Its callable lives in storage_ if
+  // it fits, or on the heap, with a pointer to it in storage_, if it
+  // doesn't.  run_ runs the callable and then destroys it.
+  class CallableTask : public Task {
+   public:
+    explicit CallableTask(uint32_t lane) : Task(&RunCallable) {
+      lane_ = lane;
+    }
+
+    void (*run_)(CallableTask *t);
+    alignas(std::max_align_t) unsigned char storage_[kInlineCallableBytes];
+  };
+
+  // The thread_task_fn of every CallableTask.
+  static void RunCallable(Task *t);
+
+  // Get and return memory for a CallableTask.  Blocks are kept in a
+  // cache for the calling thread, and a shared one behind it, so
+  // that a block freed by a worker can be reused by the thread that
+  // posts the next task.
+  static void *AllocCallableTask();
+  static void FreeCallableTask(void *block);
+
+  // A lane's queue of Tasks waiting to be dispatched to a worker
+  // thread, and its scheduling.
+  struct Lane {
+    Lane(uint32_t queue_capacity, const LaneOptions &options);
+    ~Lane();
+
+    TaskQueue queue;
+
+    // Tasks that didn't fit in queue, guarded by overflow_lock.
+    // While any are waiting here, new tasks are queued behind them,
+    // so tasks are still picked up in roughly the order they came in.
+    pthread_mutex_t overflow_lock;
+    std::list<Task *> overflow_queue;
+    std::atomic<size_t> overflow_size;
+
+    LaneOptions options;
+
+    // How many workers are running the lane's tasks, if the lane has
+    // a max_workers.
+    std::atomic<uint32_t> num_running;
+  };
+
+  // The lanes, of which the first num_lanes_ are in use.  Lane 0 is
+  // created by the constructor; the rest, by set_lanes(), before it
+  // publishes the new num_lanes_.
+  std::vector<Lane *> lanes_;
+  std::atomic<uint32_t> num_lanes_;
+  uint32_t total_weight_;
+  uint32_t queue_capacity_;
+
+  // Counts up as workers pick lanes; where it falls within
+  // total_weight_ picks the lane that goes first.
+  std::atomic<uint32_t> lane_tick_;
+
+  // Removes the next task from "lane", or returns nullptr if there is
+  // none or the lane is already running max_workers tasks.  A task
+  // from a capped lane counts towards its limit until it is passed to
+  // finish_task().
+  Task *pop_lane(Lane *lane, int64_t *dispatch_ns);
+
+  // Called when a task that counted towards "lane" is done.
+  void finish_task(uint32_t lane);
+
+  // What a worker thread's slot in workers_ holds.
+  enum WorkerState {
+    kSlotFree,     // no thread
+    kSlotRunning,  // a live worker thread
+    kSlotExited    // a thread that has exited but not been joined
+  };
+
+  // A worker thread's slot.  The slot's index is also the index of
+  // the worker's deque.  replace_deque is set when the worker should
+  // allocate itself a new deque.
+  struct Worker {
+    ThreadPool *pool;
+    uint32_t index;
+    pthread_t thread;
+    WorkerState state;
+    std::atomic<bool> replace_deque;
+  };
+
+  // Starts a new worker thread in a free slot, unless the pool already
+  // has max_threads_ or is being destroyed.
+  void add_worker();
+
+  // Called by an idle worker whose wait for a task timed out.  Returns
+  // true, having given up the worker's slot and its place in
+  // num_idle_, if the pool has more than min_threads_, no task is
+  // queued, and the worker should exit.
+  bool retire_worker();
+
+  // The CPUs that the worker in each slot is pinned to, or empty if
+  // workers aren't pinned.  Guarded by workers_lock_.
+  std::vector<cpu_set_t> slot_cpus_;
+
+  // The pool's size limits, and how long an idle worker beyond
+  // min_threads_ waits before it exits, in nanoseconds.
+  uint32_t min_threads_;
+  uint32_t max_threads_;
+  int64_t idle_timeout_ns_;
+
+  // One slot for each of the max_threads_ workers the pool may have,
+  // guarded by workers_lock_.
+  pthread_mutex_t workers_lock_;
+  Worker *workers_;
+
+  // How many workers have come up.  The constructor waits on this
+  // futex word until all min_threads_ have, rather than polling.
+  std::atomic<uint32_t> num_started_;
+
+  // How many workers are looking for a task rather than running one.
+  // When a task is queued and this is 0, the pool grows.
+  std::atomic<uint32_t> num_idle_;
+
+  // Removes the next task, or returns nullptr if there is none.  A
+  // worker looks in its own deque, then the lanes, then steals.  The
+  // time the task was dispatched is returned through "dispatch_ns",
+  // and the lane the task counts towards, if any, through
+  // "counted_lane" (or -1 otherwise).
+  Task *next_task(int64_t *dispatch_ns, int *counted_lane);
+
+  // Steals a task from some worker's deque, or returns nullptr.
+  Task *steal_task();
+
+  // Called by a worker: allocates its slot's deque if it has none yet,
+  // and allocates it a new one if set_cpu_affinity() asked for that.
+  void place_deque();
+
+  // One deque per worker slot, or nullptr until a worker has run in
+  // the slot, and whether work-stealing mode is on.
+  std::atomic<TaskDeque *> *deques_;
+  uint32_t num_deques_;
+  std::atomic<bool> work_stealing_;
+
+  // How many workers set_cpu_affinity() is waiting on to rebuild their
+  // deques.  It waits on this futex word until it is 0.
+  std::atomic<uint32_t> deques_pending_;
+
+  // Waits for a task and removes it, as next_task() does.  Returns
+  // nullptr once killthreads_ is set, or once the calling worker has
+  // been retired.
+  Task *wait_for_task(int64_t *dispatch_ns, int *counted_lane);
+
+  // Wakes up a sleeping worker, if there is one and no wakeup is on
+  // its way already.
+  void wake_worker();
+
+  // Returns true if any task is queued.
+  bool has_queued_tasks() const;
+
+  // Idle workers sleep on the futex word wake_seq_, which
+  // wake_worker() bumps, but only if num_sleeping_ says someone is
+  // asleep.  wake_pending_ is set from a wakeup until a worker comes
+  // out of (or goes into) the sleep, so a burst of dispatch() calls
+  // makes one futex syscall rather than one each; a worker that wakes
+  // up and sees more tasks queued wakes the next one.
+  std::atomic<uint32_t> wake_seq_;
+  std::atomic<uint32_t> num_sleeping_;
+  std::atomic<bool> wake_pending_;
+
+  // How many times an idle worker looks for a task before it goes to
+  // sleep.  Spinning only pays off if a dispatch() can happen on
+  // another CPU while we spin, so it is 0 on a single CPU.
+  int idle_spins_;
+
+  // Feeds the CoDel state with the sojourn time of a task, observed
+  // at "now_ns", and returns whether the pool is overloaded.  Must be
+  // called with admission_lock_ held.
+  bool update_overload(int64_t sojourn_ns, int64_t now_ns);
+
+  // Guards the admission control state below.  Workers only try to
+  // take it, and skip the update if someone else holds it, so the
+  // lock never holds up picking up a task.
+  pthread_mutex_t admission_lock_;
+
+  // The admission control settings, when the sojourn time first went
+  // above target (or 0 if it's below), and when the pool last stopped
+  // being overloaded, all in nanoseconds.
+  std::atomic<int64_t> target_ns_;
+  int64_t interval_ns_;
+  int64_t above_target_since_ns_;
+  int64_t overload_ended_ns_;
+  bool overloaded_;
 };
 
+template <typename F>
+std::future<std::invoke_result_t<std::decay_t<F>>> ThreadPool::submit(
+    F &&f, uint32_t lane) {
+  typedef std::invoke_result_t<std::decay_t<F>> Result;
+  std::promise<Result> promise;
+  std::future<Result> future = promise.get_future();
+  post([promise = std::move(promise), f = std::forward<F>(f)]() mutable {
+    try {
+      if constexpr (std::is_void_v<Result>) {
+        f();
+        promise.set_value();
+      } else {
+        promise.set_value(f());
+      }
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+    }
+  }, lane);
+  return future;
+}
+
+template <typename F>
+void ThreadPool::post(F &&f, uint32_t lane) {
+  typedef std::decay_t<F> Fn;
+  CallableTask *t = new (AllocCallableTask()) CallableTask(lane);
+  try {
+    // The callable is built in place and never moved, so anything
+    // small enough can go inline, even if moving it could throw.
+    if constexpr (sizeof(Fn) <= kInlineCallableBytes &&
+                  alignof(Fn) <= alignof(std::max_align_t)) {
+      new (t->storage_) Fn(std::forward<F>(f));
+      t->run_ = [](CallableTask *t) {
+        Fn *fn = std::launder(reinterpret_cast<Fn *>(t->storage_));
+        (*fn)();
+        fn->~Fn();
+      };
+    } else {
+      *reinterpret_cast<Fn **>(t->storage_) = new Fn(std::forward<F>(f));
+      t->run_ = [](CallableTask *t) {
+        std::unique_ptr<Fn> fn(*reinterpret_cast<Fn **>(t->storage_));
+        (*fn)();
+      };
+    }
+  } catch (...) {
+    t->~CallableTask();
+    FreeCallableTask(t);
+    throw;
+  }
+  dispatch(t);
+}
+
 }  // namespace searchserver
 
 #endif  // THREADPOOL_H_
@@ -1,35 +1,80 @@
 #include "./WordIndex.h"
 
+#include <algorithm>
+#include <cstdint>
+
 namespace searchserver {
 
+// Returns true if "a" ranks ahead of "b": it has a higher rank, or the
+// same rank and a lower DocID.  Worse() is the other way around.
+static bool Better(const Result& a, const Result& b);
+static bool Worse(const Result& a, const Result& b);
+
 WordIndex::WordIndex() {
-  wordMap = unordered_map<string, unordered_map<string, int>>();
+  wordMap = unordered_map<string, vector<Posting>>();
 }
 
  // Returns the number of unique words recorded in the index
 size_t WordIndex::num_words() {
-  return wordMap.size();
+  return wordMap.size() + packedMap.size();
+}
+
+ // Returns the number of documents recorded in the index
+size_t WordIndex::num_docs() {
+  return docNames.size();
+}
+
+DocID WordIndex::add_document(const string& doc_name) {
+  auto inserted = docIds.emplace(doc_name, docNames.size());
+  if (inserted.second) {
+    docNames.push_back(&inserted.first->first);
+  }
+  return inserted.first->second;
 }
- 
+
+const string& WordIndex::doc_name(DocID doc_id) {
+  return *docNames.at(doc_id);
+}
+
  // Record an occurrence of a document having the specified word show up in it
-  // 
+  //
   // Arguments:
   //  - word: the word found in the specified document
   //  - doc_name: the name of the document the word occurrence showed up in
   //
   // Returns: None
 void WordIndex::record(const string& word, const string& doc_name) {
+  record(word, add_document(doc_name));
+}
 
-  if(wordMap.find(word) != wordMap.end()) {
-    if(wordMap[word].find(doc_name) != wordMap[word].end()) {
-      wordMap[word][doc_name]++;
-    } else {
-      wordMap[word][doc_name] = 1;
-    }
+void WordIndex::record(const string& word, DocID doc_id) {
+  auto packed = packedMap.find(word);
+  if (packed != packedMap.end()) {
+    // Compacted words are read-only; grow a copy instead.
+    packed->second.decode(&wordMap[word]);
+    packedMap.erase(packed);
+  }
+  vector<Posting>& postings = wordMap[word];
+
+  // Documents are usually recorded one at a time, in the order they
+  // were added, so the posting is almost always the last one or a new
+  // one after it.
+  if (postings.empty() || postings.back().doc_id < doc_id) {
+    postings.push_back(Posting{doc_id, 1});
+    return;
+  }
+  if (postings.back().doc_id == doc_id) {
+    postings.back().count++;
+    return;
+  }
+  auto it = std::lower_bound(postings.begin(), postings.end(), doc_id,
+                             [](const Posting& p, DocID id) {
+                               return p.doc_id < id;
+                             });
+  if (it != postings.end() && it->doc_id == doc_id) {
+    it->count++;
   } else {
-    unordered_map<string, int> newMap;
-    newMap[doc_name] = 1;
-    wordMap[word] = newMap;
+    postings.insert(it, Posting{doc_id, 1});
   }
 }
 
@@ -40,25 +85,13 @@ void WordIndex::record(const string& word, const string& doc_name) {
   //  - word: a word we are looking up results for
   //
   // Returns:
-  //  - A list of results. Each result contains a document name and the number
+  //  - A list of results. Each result contains a document ID and the number
   //    of recorded occurances of the specified word in that document. The list is
   //    sorted with documents with the highest rank at the front.
 list<Result> WordIndex::lookup_word(const string& word) {
-  list<Result> result;
-
-  // return empty list immediately if not found
-  if (wordMap.find(word) == wordMap.end()) {
-    return result;
-  } 
-  
-  unordered_map<string, int> resultMap = wordMap.at(word);
-  for(auto it = resultMap.begin(); it != resultMap.end(); ++it) {
-    result.push_back(Result(it->first, it->second));
-  }
-
-  result.sort(); 
-  
-  return result;
+  vector<Result> best;
+  top_matches({word}, SIZE_MAX, &Better, &best);
+  return list<Result>(best.begin(), best.end());
 }
 
  // Lookup a query (multiple words) in the index, getting a sorted list of all documents
@@ -69,76 +102,164 @@ list<Result> WordIndex::lookup_word(const string& word) {
   //  - word: a word we are looking up results for
   //
   // Returns:
-  //  - A list of results. Each result contains a document name and the sum of the
+  //  - A list of results. Each result contains a document ID and the sum of the
   //    number of recorded occurences of the each query word in that document. The list is
   //    sorted with documents with the highest rank at the front.
 list<Result> WordIndex::lookup_query(const vector<string>& query) {
-  list<Result> results;
+  vector<Result> best;
+  top_matches(query, SIZE_MAX, &Better, &best);
+  return list<Result>(best.begin(), best.end());
+}
 
-  if(query.empty()) {
-    return results;
+size_t WordIndex::lookup_query(const vector<string>& query, size_t offset,
+                               size_t k, vector<Result>* page) {
+  if (offset == 0) {
+    return top_matches(query, k, &Better, page);
   }
-  // Run query on first query word 
-  list<Result> firstQuery = lookup_word(query[0]);
 
-  if (firstQuery.size() == 0) {
-    return results;
+  // Further in, count the matches first.  A page past the end is then
+  // empty without ranking anything, and the rest never keep more than
+  // the results from the start to the page's end, or from the page's
+  // start to the end, whichever is fewer.
+  size_t total = top_matches(query, 0, &Better, page);
+  if (offset >= total) {
+    return total;
+  }
+  size_t to_end = total - offset;
+  size_t on_page = std::min(k, to_end);
+  if (to_end < offset + on_page) {
+    // Pick out the worst "to_end" instead, which this page starts.
+    top_matches(query, to_end, &Worse, page);
+    std::reverse(page->begin(), page->end());
+    page->resize(on_page);
+  } else {
+    top_matches(query, offset + on_page, &Better, page);
+    page->erase(page->begin(), page->begin() + offset);
   }
+  return total;
+}
 
-  if(query.size() == 1){
-    return firstQuery;
+size_t WordIndex::top_matches(const vector<string>& query, size_t limit,
+                              bool (*before)(const Result&, const Result&),
+                              vector<Result>* best) {
+  best->clear();
+  if(query.empty()) {
+    return 0;
   }
 
-unordered_map<string, int> map;
-      // accumulate all queries into map
-      for(Result r :firstQuery) {
-        map[r.doc_name] = r.rank;
+  // Find every query word's postings.  If any word isn't in the index,
+  // no document has all of them.
+  std::deque<PostingCursor> cursors;
+  for (const string& word : query) {
+    if (!add_cursor(word, &cursors)) {
+      return 0;
     }
-firstQuery.clear();
-
- // for queries greater than 1 
-    uint16_t i;
-
-    for(i = 1; i < query.size(); i++){
-      list<Result> subResult = lookup_word(query[i]);
+  }
 
-      // return empty list if query word is not contained in any docs
-      if(subResult.size() == 0){
-        results.clear();
-        return results;
-      }
+  // Intersect the lists shortest first.  Each DocID of the shortest
+  // is looked for in the next shortest, and so on; when a list doesn't
+  // have it, the shortest skips ahead to the DocID that list has
+  // instead.  Every list is sorted by DocID and seeks by galloping, so
+  // a short list costs little against a long one, and a compressed
+  // list doesn't even decode the blocks it skips.
+  vector<PostingCursor*> order;
+  for (PostingCursor& c : cursors) {
+    order.push_back(&c);
+  }
+  std::sort(order.begin(), order.end(),
+            [](const PostingCursor* a, const PostingCursor* b) {
+              return a->size() < b->size();
+            });
 
-      std::unordered_map<string, int> subResultMap;
-      for(Result r : subResult) {
-          subResultMap[r.doc_name] = r.rank;
+  // The best "limit" matches so far, by "before".  Once there are that
+  // many, they are kept as a heap with the worst of them on top, which
+  // each new match has to beat to get in.
+  size_t total = 0;
+  bool full = limit == 0;
+  PostingCursor* lead = order[0];
+  while (!lead->done()) {
+    DocID doc_id = (*lead)->doc_id;
+    size_t i;
+    for (i = 1; i < order.size(); i++) {
+      order[i]->seek(doc_id);
+      if (order[i]->done() || (*order[i])->doc_id != doc_id) {
+        break;
       }
-
-      // remove all docs from map that don't contain string
-      for(auto it = map.begin(); it != map.end(); ++it) {
-        string queryWord = it->first;
-        if(subResultMap.find(queryWord) == subResultMap.end()) {
-          map.at(queryWord) = -1;
-        } else {
-          if(map.at(queryWord) != -1) {
-            map.at(queryWord) += subResultMap.at(queryWord);
-          }
-        }
+    }
+    if (i < order.size()) {
+      if (order[i]->done()) {
+        // Nothing after this can be in every list.
+        break;
       }
+      lead->seek((*order[i])->doc_id);
+      continue;
+    }
 
-      subResult.clear();
-      subResultMap.clear();
+    // Every list is at this DocID.
+    Result match(doc_id, 0);
+    for (PostingCursor* c : order) {
+      match.rank += (*c)->count;
     }
-  
-  // Convert map values into list
-  for(auto it = map.begin(); it != map.end(); ++it) {
-    if(it-> second != -1) {
-      results.push_back(Result(it->first, it->second));
+    total++;
+    if (!full) {
+      best->push_back(match);
+      if (best->size() == limit) {
+        std::make_heap(best->begin(), best->end(), before);
+        full = true;
+      }
+    } else if (!best->empty() && before(match, best->front())) {
+      std::pop_heap(best->begin(), best->end(), before);
+      best->back() = match;
+      std::push_heap(best->begin(), best->end(), before);
     }
+    lead->next();
+  }
+
+  std::sort(best->begin(), best->end(), before);
+  return total;
+}
+
+void WordIndex::compact() {
+  for (auto& entry : wordMap) {
+    packedMap.emplace(entry.first, PostingList(entry.second));
   }
-  map.clear();
-  results.sort();
-  return results;
+  // Swap rather than clear(), so the buckets are freed too.
+  unordered_map<string, vector<Posting>>().swap(wordMap);
 }
 
+size_t WordIndex::postings_bytes() {
+  size_t bytes = 0;
+  for (auto& entry : wordMap) {
+    bytes += entry.second.capacity() * sizeof(Posting);
+  }
+  for (auto& entry : packedMap) {
+    bytes += entry.second.memory_bytes();
+  }
+  return bytes;
+}
+
+bool WordIndex::add_cursor(const string& word,
+                           std::deque<PostingCursor>* cursors) {
+  auto found = wordMap.find(word);
+  if (found != wordMap.end()) {
+    cursors->emplace_back(found->second);
+    return true;
+  }
+  auto packed = packedMap.find(word);
+  if (packed != packedMap.end()) {
+    cursors->emplace_back(packed->second);
+    return true;
+  }
+  return false;
+}
+
+
+static bool Better(const Result& a, const Result& b) {
+  return a.rank > b.rank || (a.rank == b.rank && a.doc_id < b.doc_id);
+}
+
+static bool Worse(const Result& a, const Result& b) {
+  return Better(b, a);
+}
 
 }  // namespace searchserver
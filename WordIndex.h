@@ -1,6 +1,7 @@
 #ifndef WORD_INDEX_H_
 #define WORD_INDEX_H_
 
+#include <deque>
 #include <unordered_map>
 #include <unordered_set>
 #include <list>
@@ -10,6 +11,7 @@
 #include <sstream>
 #include <fstream>
 
+#include "./PostingList.h"
 #include "./Result.h"
 
 using std::string;
@@ -22,6 +24,16 @@ namespace searchserver {
 
 // A WordIndex is used to keep track of which documents contain certain words
 // and how many occurances there are of that word in the document
+//
+// Each document is given a DocID the first time it is recorded, and
+// its name is stored once, in a table shared by every word.  A word's
+// postings are (DocID, count) pairs sorted by DocID, so a query only
+// ever compares integers.
+//
+// While the index is being built, each word's postings are a plain
+// vector that record() can grow.  compact() then compresses them into
+// PostingLists, which take a fraction of the memory and are what
+// lookups read while the server runs.
 class WordIndex {
  public:
 
@@ -31,7 +43,23 @@ class WordIndex {
 
   // Returns the number of unique words recorded in the index
   size_t num_words();
-  
+
+  // Returns the number of documents recorded in the index
+  size_t num_docs();
+
+  // Looks up the ID of a document, giving it the next one if the
+  // index hasn't seen it before
+  //
+  // Arguments:
+  //  - doc_name: the name of the document
+  //
+  // Returns: the document's ID
+  DocID add_document(const string& doc_name);
+
+  // Returns the name of the document with the specified ID, which must
+  // have come from this index
+  const string& doc_name(DocID doc_id);
+
   // Record an occurance of a document having the specified word show up in it
   // 
   // Arguments:
@@ -41,6 +69,21 @@ class WordIndex {
   // Returns: None
   void record(const string& word, const string& doc_name);
 
+  // Like record() above, for a document already added with
+  // add_document().  Recording every word of a document this way saves
+  // looking up its name for each one.
+  void record(const string& word, DocID doc_id);
+
+  // Compresses the postings of every word recorded since the last
+  // call.  Call this once the index is built; recording a word after
+  // that uncompresses its postings again, until the next compact().
+  // Must not be called while other threads are using the index.
+  void compact();
+
+  // Returns how many bytes the postings of every word take up, not
+  // counting the words themselves.
+  size_t postings_bytes();
+
   // Lookup a word in the index, getting a sorted list of all documents that contain
   // the word and a rank which is the number of occurances of that word in the document
   //
@@ -48,7 +91,7 @@ class WordIndex {
   //  - word: a word we are looking up results for
   //
   // Returns:
-  //  - A list of results. Each result contains a document name and the number
+  //  - A list of results. Each result contains a document ID and the number
   //    of recorded occurances of the specified word in that document. The list is
   //    sorted with documents with the highest rank at the front.
   list<Result> lookup_word(const string& word);
@@ -61,18 +104,56 @@ class WordIndex {
   //  - word: a word we are looking up results for
   //
   // Returns:
-  //  - A list of results. Each result contains a document name and the sum of the
+  //  - A list of results. Each result contains a document ID and the sum of the
   //    number of recorded occurances of the each query word in that document. The list is
   //    sorted with documents with the highest rank at the front.
   list<Result> lookup_query(const vector<string>& query);
 
+  // Lookup a query like lookup_query() above, but only return one page of
+  // the sorted results, without sorting the rest of them.  Documents of
+  // equal rank are ordered by DocID.  A page past the end is empty, and
+  // costs no more than counting the results.
+  //
+  // Arguments:
+  //  - query: the words we are looking up results for
+  //  - offset: how many of the best results to skip
+  //  - k: how many results to return after those
+  //  - page: an output parameter through which the results are returned
+  //
+  // Returns:
+  //  - The number of documents that contain every query word, including
+  //    the ones that aren't on the page.
+  size_t lookup_query(const vector<string>& query, size_t offset, size_t k,
+                      vector<Result>* page);
+
   // delete cctor and op=
   WordIndex(const WordIndex& other) = delete;
   WordIndex& operator=(const WordIndex& other) = delete;
 
  private:
- // word, doc, count
-  std::unordered_map<std::string, unordered_map<string, int>> wordMap;
+  // Finds every document with all the words of "query", keeping the
+  // first "limit" of them by "before" in "best", sorted that way.
+  // Returns how many there were in all.
+  size_t top_matches(const vector<string>& query, size_t limit,
+                     bool (*before)(const Result&, const Result&),
+                     vector<Result>* best);
+
+  // Appends a cursor over the postings of "word" to "cursors", or
+  // returns false if the word isn't in the index.
+  bool add_cursor(const string& word, std::deque<PostingCursor>* cursors);
+
+  // word -> its postings, sorted by doc_id, for the words recorded
+  // since the last compact()
+  unordered_map<string, vector<Posting>> wordMap;
+
+  // word -> its compressed postings, for the rest of the words.  No
+  // word is in both maps.
+  unordered_map<string, PostingList> packedMap;
+
+  // doc name -> doc ID, and doc ID -> doc name.  The names in docNames
+  // point at the keys of docIds, so each one is only stored once.
+  unordered_map<string, DocID> docIds;
+  vector<const string*> docNames;
 };
 
 }
@@ -0,0 +1,123 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+// Shows what ThreadPool admission control does under overload.  Tasks
+// that each keep a worker busy for a fixed time arrive at twice the
+// rate the pool can serve them.  Without admission control every task
+// is queued, and the time each one takes from arrival to completion
+// keeps growing for as long as the overload lasts.  With it, the
+// producer sheds arrivals while the pool reports overloaded(), the
+// way HttpServer turns connections away, and the latency of the
+// tasks that do get in stays bounded.
+//
+// Usage: bench_admission [seconds] [num_threads]
+
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "./ThreadPool.h"
+
+using std::cerr;
+using std::endl;
+using std::vector;
+
+namespace searchserver {
+
+// How long each task keeps its worker busy.
+static const int kServiceUs = 2000;
+
+// The admission control settings, the same as HttpServer's defaults.
+static const uint32_t kTargetMs = 50;
+static const uint32_t kIntervalMs = 500;
+
+static int64_t NowUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+class BenchTask : public ThreadPool::Task {
+ public:
+  BenchTask(ThreadPool::thread_task_fn f, int64_t *latency_us,
+            std::atomic<int> *done)
+    : ThreadPool::Task(f), arrival_us(NowUs()), latency_us(latency_us),
+      done(done) { }
+
+  int64_t arrival_us;
+  int64_t *latency_us;
+  std::atomic<int> *done;
+};
+
+static void BenchTaskFn(ThreadPool::Task *t) {
+  BenchTask *bt = static_cast<BenchTask *>(t);
+  usleep(kServiceUs);
+  *bt->latency_us = NowUs() - bt->arrival_us;
+  (*bt->done)++;
+  delete bt;
+}
+
+static void RunBench(const char *name, bool admission, int seconds,
+                     uint32_t num_threads) {
+  ThreadPool tp(num_threads);
+  if (admission) {
+    tp.set_admission_control(kTargetMs, kIntervalMs);
+  }
+
+  // Offer twice what the pool can serve.
+  double rate = 2.0 * num_threads * 1000000 / kServiceUs;
+  int64_t total = static_cast<int64_t>(rate * seconds);
+  vector<int64_t> latencies(total);
+  std::atomic<int> done(0);
+  int accepted = 0, shed = 0;
+  int64_t start = NowUs();
+  for (int64_t i = 0; i < total; i++) {
+    // Wait for this task's arrival time.
+    int64_t arrival = start + static_cast<int64_t>(i * 1000000 / rate);
+    while (NowUs() < arrival) { }
+    if (admission && tp.overloaded()) {
+      shed++;
+      continue;
+    }
+    tp.dispatch(new BenchTask(BenchTaskFn, &latencies[accepted], &done));
+    accepted++;
+  }
+  while (done < accepted) {
+    usleep(1000);
+  }
+
+  latencies.resize(accepted);
+  std::sort(latencies.begin(), latencies.end());
+  printf("%-10s %6d accepted %6d shed   p50 %8.1f ms   p99 %8.1f ms"
+         "   max %8.1f ms\n", name, accepted, shed,
+         latencies[accepted / 2] / 1000.0,
+         latencies[accepted * 99 / 100] / 1000.0,
+         latencies.back() / 1000.0);
+}
+
+}  // namespace searchserver
+
+int main(int argc, char **argv) {
+  int seconds = (argc > 1) ? atoi(argv[1]) : 3;
+  int num_threads = (argc > 2) ? atoi(argv[2]) : 8;
+  if (seconds <= 0 || num_threads <= 0) {
+    cerr << "Usage: " << argv[0] << " [seconds] [num_threads]" << endl;
+    return EXIT_FAILURE;
+  }
+  searchserver::RunBench("unbounded", false, seconds, num_threads);
+  searchserver::RunBench("codel", true, seconds, num_threads);
+  return EXIT_SUCCESS;
+}
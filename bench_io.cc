@@ -0,0 +1,204 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+// Compares the blocking and io_uring I/O backends on small keep-alive
+// requests.  A number of client threads each open one connection to a
+// local server and send it back-to-back requests; the server answers
+// every request through HttpConnection, the same way HttpServer does.
+// The clients always use plain read()/write(), so only the server's
+// backend changes between runs.
+//
+// Usage: bench_io [num_clients] [requests_per_client]
+
+extern "C" {
+  #include <pthread.h>
+}
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "./HttpConnection.h"
+#include "./HttpRequest.h"
+#include "./HttpResponse.h"
+#include "./HttpUtils.h"
+#include "./ServerSocket.h"
+#include "./ThreadPool.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+
+namespace searchserver {
+
+static const char *kRequest =
+  "GET /query?terms=foo HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+// The response the server sends for every request.
+static HttpResponse BenchResponse() {
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.set_content_type("text/html");
+  rep.AppendToBody("<html><body>hi</body></html>\n");
+  return rep;
+}
+
+// The server side of one connection.
+class BenchServerTask : public ThreadPool::Task {
+ public:
+  explicit BenchServerTask(ThreadPool::thread_task_fn f)
+    : ThreadPool::Task(f) { }
+  int client_fd;
+};
+
+static void BenchServerFn(ThreadPool::Task *t) {
+  BenchServerTask *task = static_cast<BenchServerTask *>(t);
+  HttpConnection hc(task->client_fd);
+  HttpResponse rep = BenchResponse();
+  HttpRequest req;
+  bool have_request = hc.next_request(&req);
+  while (have_request) {
+    have_request = hc.write_response_and_next_request(rep, &req);
+  }
+  delete task;
+}
+
+// The client side of one connection.
+struct BenchClient {
+  uint16_t port;
+  int num_requests;
+  size_t response_size;
+  bool ok;
+};
+
+static void *BenchClientFn(void *arg) {
+  BenchClient *bc = static_cast<BenchClient *>(arg);
+  bc->ok = false;
+  int fd;
+  if (!connect_to_server("127.0.0.1", bc->port, &fd)) {
+    return nullptr;
+  }
+  size_t req_len = string(kRequest).size();
+  char buf[4096];
+  for (int i = 0; i < bc->num_requests; i++) {
+    if (write(fd, kRequest, req_len) != static_cast<ssize_t>(req_len)) {
+      close(fd);
+      return nullptr;
+    }
+    size_t got = 0;
+    while (got < bc->response_size) {
+      ssize_t res = read(fd, buf, sizeof(buf));
+      if (res <= 0) {
+        close(fd);
+        return nullptr;
+      }
+      got += res;
+    }
+  }
+  close(fd);
+  bc->ok = true;
+  return nullptr;
+}
+
+static double NowSeconds() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Runs one round of the benchmark with the given backend and prints
+// the throughput.  Returns false if anything went wrong.
+static bool RunBench(const char *name, IoBackend backend,
+                     int num_clients, int num_requests) {
+  if (set_io_backend(backend) != backend) {
+    cout << name << ": not available on this kernel" << endl;
+    return true;
+  }
+
+  ServerSocket *ss = nullptr;
+  uint16_t port = 0;
+  int listen_fd;
+  for (int tries = 0; tries < 10 && ss == nullptr; tries++) {
+    port = rand_port();
+    ss = new ServerSocket(port);
+    if (!ss->bind_and_listen(AF_INET6, &listen_fd)) {
+      delete ss;
+      ss = nullptr;
+    }
+  }
+  if (ss == nullptr) {
+    cout << name << ": couldn't bind a listening socket" << endl;
+    return false;
+  }
+
+  ThreadPool tp(num_clients);
+  pthread_t *threads = new pthread_t[num_clients];
+  BenchClient *clients = new BenchClient[num_clients];
+  size_t response_size = BenchResponse().GenerateResponseString().size();
+
+  double start = NowSeconds();
+  for (int i = 0; i < num_clients; i++) {
+    clients[i].port = port;
+    clients[i].num_requests = num_requests;
+    clients[i].response_size = response_size;
+    pthread_create(&threads[i], nullptr, &BenchClientFn, &clients[i]);
+  }
+  for (int i = 0; i < num_clients; i++) {
+    BenchServerTask *task = new BenchServerTask(&BenchServerFn);
+    string caddr, cdns, saddr, sdns;
+    uint16_t cport;
+    if (!ss->accept_client(&task->client_fd, &caddr, &cport,
+                          &cdns, &saddr, &sdns)) {
+      delete task;
+      break;
+    }
+    tp.dispatch(task);
+  }
+  bool ok = true;
+  for (int i = 0; i < num_clients; i++) {
+    pthread_join(threads[i], nullptr);
+    ok = ok && clients[i].ok;
+  }
+  double elapsed = NowSeconds() - start;
+
+  long total = static_cast<long>(num_clients) * num_requests;
+  printf("%-10s %8ld requests in %7.3fs  %10.0f req/s  %8.2f us/req\n",
+         name, total, elapsed, total / elapsed,
+         elapsed * 1000000.0 * num_clients / total);
+  delete[] clients;
+  delete[] threads;
+  delete ss;
+  return ok;
+}
+
+}  // namespace searchserver
+
+int main(int argc, char **argv) {
+  int num_clients = (argc > 1) ? atoi(argv[1]) : 4;
+  int num_requests = (argc > 2) ? atoi(argv[2]) : 20000;
+  if (num_clients <= 0 || num_requests <= 0) {
+    std::cerr << "Usage: " << argv[0]
+              << " [num_clients] [requests_per_client]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  cout << num_clients << " keep-alive clients, " << num_requests
+       << " requests each" << endl;
+  bool ok = searchserver::RunBench("blocking", searchserver::kBlockingIo,
+                                   num_clients, num_requests);
+  ok = searchserver::RunBench("io_uring", searchserver::kIoUringIo,
+                              num_clients, num_requests) && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
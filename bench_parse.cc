@@ -0,0 +1,192 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+// Measures what it costs to parse a request, in time and in heap
+// allocations.  Batches of pipelined requests are written into one end
+// of a socketpair and read back out with HttpConnection::next_request(),
+// the way HttpServer_ThrFn does.  For comparison, the same requests are
+// also put through the old parser, which split the request into
+// strings and stored the headers in a std::map.
+//
+// Usage: bench_parse [num_requests]
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <boost/algorithm/string.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "./HttpConnection.h"
+#include "./HttpRequest.h"
+#include "./HttpUtils.h"
+
+using std::cout;
+using std::endl;
+using std::map;
+using std::string;
+using std::vector;
+
+// Every allocation the program makes goes through here, so that we can
+// count them.
+static size_t g_allocations = 0;
+
+void *operator new(size_t size) {
+  g_allocations++;
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+namespace searchserver {
+
+static const char *kRequest =
+  "GET /static/bikeapalooza_2011/Images/bike.jpg HTTP/1.1\r\n"
+  "Host: localhost:5950\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Firefox/115.0\r\n"
+  "Accept: image/avif,image/webp,*/*\r\n"
+  "Accept-Language: en-US,en;q=0.5\r\n"
+  "Accept-Encoding: gzip, deflate, br\r\n"
+  "Connection: keep-alive\r\n"
+  "Referer: http://localhost:5950/static/bikeapalooza_2011/index.html\r\n"
+  "If-None-Match: \"11e1f1-12c0-62ddb3cd.0\"\r\n"
+  "\r\n";
+
+// How many requests are written into the socket at a time; small
+// enough that a batch fits in the socket buffer.
+static const int kBatchSize = 64;
+
+// The parser HttpConnection used before, kept here to compare with.
+static bool LegacyParse(const string &request, string *uri,
+                        map<string, string> *headers) {
+  string requestCopy(request);
+  if (request.length() == 0) {
+    return false;
+  }
+  boost::algorithm::trim(requestCopy);
+  vector<string> lines;
+  boost::split(lines, requestCopy, boost::is_any_of("\r\n"),
+               boost::token_compress_on);
+  vector<string> first;
+  boost::split(first, lines[0], boost::is_any_of(" "),
+               boost::token_compress_on);
+  *uri = first[1];
+  headers->clear();
+  for (size_t i = 1; i < lines.size(); i++) {
+    string line = lines[i];
+    boost::to_lower(line);
+    size_t index = line.find(":");
+    if (index == string::npos) {
+      continue;
+    }
+    string key = line.substr(0, index);
+    string val = line.substr(index + 1);
+    boost::algorithm::trim(key);
+    boost::algorithm::trim(val);
+    (*headers)[key] = val;
+  }
+  return true;
+}
+
+static double NowSeconds() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void Report(const char *name, int num_requests, double elapsed,
+                   size_t allocations) {
+  printf("%-8s %8d requests  %8.0f ns/req  %8.2f allocs/req\n",
+         name, num_requests, elapsed * 1e9 / num_requests,
+         static_cast<double>(allocations) / num_requests);
+}
+
+static bool RunBench(int num_requests) {
+  int spair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, spair) != 0) {
+    return false;
+  }
+  string batch;
+  for (int i = 0; i < kBatchSize; i++) {
+    batch += kRequest;
+  }
+
+  // The new parser, through HttpConnection.  The connection and the
+  // request are reused, as they are for a keep-alive client.
+  HttpConnection hc(spair[0]);
+  HttpRequest req;
+  double parse_time = 0;
+  size_t allocations = 0;
+  int done = 0;
+  while (done < num_requests) {
+    if (wrapped_write(spair[1], batch) != static_cast<int>(batch.size())) {
+      return false;
+    }
+    double start = NowSeconds();
+    size_t before = g_allocations;
+    for (int i = 0; i < kBatchSize; i++) {
+      if (!hc.next_request(&req) ||
+          req.GetHeaderValue("connection") != "keep-alive") {
+        return false;
+      }
+    }
+    allocations += g_allocations - before;
+    parse_time += NowSeconds() - start;
+    done += kBatchSize;
+  }
+  Report("parser", done, parse_time, allocations);
+  close(spair[1]);
+
+  // The old parser on the same text.
+  string text(kRequest, string(kRequest).size() - 4);
+  string uri;
+  map<string, string> headers;
+  double start = NowSeconds();
+  size_t before = g_allocations;
+  for (int i = 0; i < done; i++) {
+    if (!LegacyParse(text, &uri, &headers) ||
+        headers["connection"] != "keep-alive") {
+      return false;
+    }
+  }
+  Report("legacy", done, NowSeconds() - start, g_allocations - before);
+  return true;
+}
+
+}  // namespace searchserver
+
+int main(int argc, char **argv) {
+  int num_requests = (argc > 1) ? atoi(argv[1]) : 200000;
+  if (num_requests <= 0) {
+    std::cerr << "Usage: " << argv[0] << " [num_requests]" << endl;
+    return EXIT_FAILURE;
+  }
+  if (!searchserver::RunBench(num_requests)) {
+    std::cerr << "benchmark failed" << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
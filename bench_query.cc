@@ -0,0 +1,189 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+// Measures how long multi-word queries take.  A synthetic corpus is
+// indexed, with word frequencies that fall off the way they do in
+// text, and queries mixing common and rare words are run against it
+// before and after WordIndex::compact(), and for just the first page
+// of results, as the query page asks for.  For comparison, the same
+// queries are also run the way the index used to answer them, with a
+// map from document name to count per word, intersected through more
+// maps.
+//
+// Usage: bench_query [num_docs]
+
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./WordIndex.h"
+
+using std::endl;
+using std::list;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace searchserver {
+
+// How many distinct words the corpus has, and how many words each
+// document has.
+static const int kVocabulary = 2000;
+static const int kWordsPerDoc = 200;
+
+// How many times each query is run.
+static const int kRepeats = 20;
+
+// How many results are on a page.
+static const size_t kPageSize = 20;
+
+// The old index: word -> document name -> count.
+typedef unordered_map<string, unordered_map<string, int>> OldIndex;
+
+static double NowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static string WordName(int rank) {
+  return "word" + std::to_string(rank);
+}
+
+// Answers "query" the way WordIndex did before documents had IDs.
+static size_t OldLookupQuery(const OldIndex &index,
+                             const vector<string> &query) {
+  auto first = index.find(query[0]);
+  if (first == index.end()) {
+    return 0;
+  }
+  unordered_map<string, int> matches(first->second);
+  for (size_t i = 1; i < query.size(); i++) {
+    auto found = index.find(query[i]);
+    if (found == index.end()) {
+      return 0;
+    }
+    for (auto &entry : matches) {
+      auto doc = found->second.find(entry.first);
+      if (doc == found->second.end()) {
+        entry.second = -1;
+      } else if (entry.second != -1) {
+        entry.second += doc->second;
+      }
+    }
+  }
+  list<Result> results;
+  for (auto &entry : matches) {
+    if (entry.second != -1) {
+      results.push_back(Result(0, entry.second));
+    }
+  }
+  results.sort();
+  return results.size();
+}
+
+static void RunBench(int num_docs) {
+  // Word k turns up with probability proportional to 1 / (k + 1), as
+  // Zipf's law has it.
+  vector<double> weights;
+  for (int k = 0; k < kVocabulary; k++) {
+    weights.push_back(1.0 / (k + 1));
+  }
+  std::discrete_distribution<int> pick(weights.begin(), weights.end());
+  std::mt19937 rng(1);
+
+  WordIndex index;
+  OldIndex old_index;
+  for (int doc = 0; doc < num_docs; doc++) {
+    string name = "./corpus/doc" + std::to_string(doc) + ".txt";
+    DocID doc_id = index.add_document(name);
+    for (int i = 0; i < kWordsPerDoc; i++) {
+      string word = WordName(pick(rng));
+      index.record(word, doc_id);
+      old_index[word][name]++;
+    }
+  }
+
+  const vector<vector<int>> queries = {
+    {0, 1}, {0, 1, 2}, {3, 5, 8}, {0, 50}, {1, 500}, {0, 1, 1500},
+    {20, 30}, {100, 200, 300},
+  };
+
+  printf("%d documents, %d words each\n\n", num_docs, kWordsPerDoc);
+  printf("%-22s %8s  %12s %12s %12s %12s\n", "query (word ranks)",
+         "results", "old us", "vector us", "packed us", "page us");
+  vector<double> old_us, vector_us;
+  vector<size_t> counts;
+  for (const vector<int> &ranks : queries) {
+    vector<string> query;
+    for (int rank : ranks) {
+      query.push_back(WordName(rank));
+    }
+    double start = NowSeconds();
+    for (int r = 0; r < kRepeats; r++) {
+      OldLookupQuery(old_index, query);
+    }
+    old_us.push_back((NowSeconds() - start) * 1e6 / kRepeats);
+
+    size_t n = 0;
+    start = NowSeconds();
+    for (int r = 0; r < kRepeats; r++) {
+      n = index.lookup_query(query).size();
+    }
+    vector_us.push_back((NowSeconds() - start) * 1e6 / kRepeats);
+    counts.push_back(n);
+  }
+
+  size_t vector_bytes = index.postings_bytes();
+  index.compact();
+  for (size_t q = 0; q < queries.size(); q++) {
+    vector<string> query;
+    string label;
+    for (int rank : queries[q]) {
+      query.push_back(WordName(rank));
+      label += (label.empty() ? "" : " ") + std::to_string(rank);
+    }
+    double start = NowSeconds();
+    for (int r = 0; r < kRepeats; r++) {
+      index.lookup_query(query);
+    }
+    double packed_us = (NowSeconds() - start) * 1e6 / kRepeats;
+
+    vector<Result> page;
+    start = NowSeconds();
+    for (int r = 0; r < kRepeats; r++) {
+      index.lookup_query(query, 0, kPageSize, &page);
+    }
+    double page_us = (NowSeconds() - start) * 1e6 / kRepeats;
+    printf("%-22s %8zu  %12.1f %12.1f %12.1f %12.1f\n", label.c_str(),
+           counts[q], old_us[q], vector_us[q], packed_us, page_us);
+  }
+  printf("\npostings: %zu bytes as vectors, %zu packed\n", vector_bytes,
+         index.postings_bytes());
+}
+
+}  // namespace searchserver
+
+int main(int argc, char **argv) {
+  int num_docs = (argc > 1) ? atoi(argv[1]) : 20000;
+  if (num_docs <= 0) {
+    std::cerr << "Usage: " << argv[0] << " [num_docs]" << endl;
+    return EXIT_FAILURE;
+  }
+  searchserver::RunBench(num_docs);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,372 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+// Measures how each SocketOptions setting affects the latency of small
+// responses.  Client threads time every request, either on one
+// keep-alive connection each or on a fresh connection per request,
+// against a local server whose listening socket is tuned with one
+// option at a time.  Two responses are timed: a small query result,
+// written with a single writev(), and a small static file, written as
+// a header followed by a sendfile() body.
+//
+// Usage: bench_sockopt [num_clients] [requests_per_client]
+
+extern "C" {
+  #include <pthread.h>
+}
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "./HttpConnection.h"
+#include "./HttpRequest.h"
+#include "./HttpResponse.h"
+#include "./HttpUtils.h"
+#include "./ServerSocket.h"
+#include "./ThreadPool.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+namespace searchserver {
+
+static const char *kQueryRequest =
+  "GET /query?terms=foo HTTP/1.1\r\nHost: localhost\r\n\r\n";
+static const char *kFileRequest =
+  "GET /static/hi.html HTTP/1.1\r\nHost: localhost\r\n\r\n";
+static const char *kFileBody = "<html><body>hi</body></html>\n";
+
+// The server's two responses.  The file one shares "file_fd".
+static HttpResponse QueryResponse() {
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.set_content_type("text/html");
+  rep.AppendToBody(kFileBody);
+  return rep;
+}
+
+static HttpResponse FileResponse(int file_fd) {
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.set_content_type("text/html");
+  rep.set_body_file(file_fd, 0, string(kFileBody).size());
+  return rep;
+}
+
+// The server side of one connection.
+class BenchServerTask : public ThreadPool::Task {
+ public:
+  explicit BenchServerTask(ThreadPool::thread_task_fn f)
+    : ThreadPool::Task(f) { }
+  int client_fd;
+  const HttpResponse *query_rep;
+  const HttpResponse *file_rep;
+};
+
+static void BenchServerFn(ThreadPool::Task *t) {
+  BenchServerTask *task = static_cast<BenchServerTask *>(t);
+  HttpConnection hc(task->client_fd);
+  HttpRequest req;
+  bool have_request = hc.next_request(&req);
+  while (have_request) {
+    const HttpResponse &rep =
+      (req.uri().substr(0, 7) == "/static") ? *task->file_rep
+                                            : *task->query_rep;
+    have_request = hc.write_response_and_next_request(rep, &req);
+  }
+  delete task;
+}
+
+// Accepts connections for the server until "stop" is set.
+struct BenchServer {
+  ServerSocket *ss;
+  ThreadPool *tp;
+  const HttpResponse *query_rep;
+  const HttpResponse *file_rep;
+  volatile bool stop;
+};
+
+static void *BenchAcceptFn(void *arg) {
+  BenchServer *bs = static_cast<BenchServer *>(arg);
+  while (!bs->stop) {
+    BenchServerTask *task = new BenchServerTask(&BenchServerFn);
+    string caddr, saddr;
+    uint16_t cport;
+    if (!bs->ss->accept_client(&task->client_fd, &caddr, &cport, &saddr)) {
+      delete task;
+      break;
+    }
+    task->query_rep = bs->query_rep;
+    task->file_rep = bs->file_rep;
+    bs->tp->dispatch(task);
+  }
+  return nullptr;
+}
+
+// The client side: times "num_requests" requests.
+struct BenchClient {
+  uint16_t port;
+  bool new_connections;
+  bool fastopen;
+  const char *request;
+  size_t response_size;
+  int num_requests;
+  vector<int64_t> latencies_ns;
+  bool ok;
+};
+
+static int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Opens a connection to the server and sends it "request".  With
+// "fastopen", the request rides in the SYN if the kernel has a Fast
+// Open cookie for the server.  Returns the socket, or -1.
+static int ConnectAndSend(uint16_t port, bool fastopen, const char *request) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  size_t len = string(request).size();
+  ssize_t res;
+  if (fastopen) {
+    res = sendto(fd, request, len, MSG_FASTOPEN,
+                 reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+  } else if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+                     sizeof(addr)) != 0) {
+    res = -1;
+  } else {
+    res = write(fd, request, len);
+  }
+  if (res != static_cast<ssize_t>(len)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Reads one response of "size" bytes from "fd".
+static bool ReadResponse(int fd, size_t size) {
+  char buf[4096];
+  size_t got = 0;
+  while (got < size) {
+    ssize_t res = read(fd, buf, sizeof(buf));
+    if (res <= 0) {
+      return false;
+    }
+    got += res;
+  }
+  return true;
+}
+
+static void *BenchClientFn(void *arg) {
+  BenchClient *bc = static_cast<BenchClient *>(arg);
+  bc->ok = false;
+  size_t req_len = string(bc->request).size();
+  int fd = -1;
+  for (int i = 0; i < bc->num_requests; i++) {
+    int64_t start = NowNs();
+    if (bc->new_connections || fd < 0) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      fd = ConnectAndSend(bc->port, bc->fastopen, bc->request);
+      if (fd < 0) {
+        return nullptr;
+      }
+    } else if (write(fd, bc->request, req_len) !=
+               static_cast<ssize_t>(req_len)) {
+      close(fd);
+      return nullptr;
+    }
+    if (!ReadResponse(fd, bc->response_size)) {
+      close(fd);
+      return nullptr;
+    }
+    bc->latencies_ns.push_back(NowNs() - start);
+  }
+  close(fd);
+  bc->ok = true;
+  return nullptr;
+}
+
+// Runs the clients for one workload against "port" and prints the
+// latency percentiles.  Returns false if anything went wrong.
+static bool RunClients(uint16_t port, const char *workload,
+                       bool new_connections, bool fastopen,
+                       const char *request, size_t response_size,
+                       int num_clients, int num_requests) {
+  vector<pthread_t> threads(num_clients);
+  vector<BenchClient> clients(num_clients);
+  for (int i = 0; i < num_clients; i++) {
+    clients[i].port = port;
+    clients[i].new_connections = new_connections;
+    clients[i].fastopen = fastopen;
+    clients[i].request = request;
+    clients[i].response_size = response_size;
+    clients[i].num_requests = num_requests;
+    pthread_create(&threads[i], nullptr, &BenchClientFn, &clients[i]);
+  }
+  bool ok = true;
+  vector<int64_t> all;
+  for (int i = 0; i < num_clients; i++) {
+    pthread_join(threads[i], nullptr);
+    ok = ok && clients[i].ok;
+    all.insert(all.end(), clients[i].latencies_ns.begin(),
+               clients[i].latencies_ns.end());
+  }
+  if (all.empty()) {
+    printf("  %-12s failed\n", workload);
+    return false;
+  }
+  std::sort(all.begin(), all.end());
+  double sum = 0;
+  for (int64_t ns : all) {
+    sum += ns;
+  }
+  printf("  %-12s avg %8.1f us  p50 %8.1f us  p99 %8.1f us%s\n", workload,
+         sum / all.size() / 1000.0, all[all.size() / 2] / 1000.0,
+         all[all.size() * 99 / 100] / 1000.0, ok ? "" : "  (errors)");
+  return ok;
+}
+
+// Runs every workload against a server tuned with "options".
+static bool RunBench(const char *name, const SocketOptions &options,
+                     ThreadPool *tp, int file_fd,
+                     int num_clients, int num_requests) {
+  ServerSocket *ss = nullptr;
+  uint16_t port = 0;
+  int listen_fd;
+  for (int tries = 0; tries < 10 && ss == nullptr; tries++) {
+    port = rand_port();
+    ss = new ServerSocket(port);
+    ss->set_socket_options(options);
+    if (!ss->bind_and_listen(AF_INET6, &listen_fd)) {
+      delete ss;
+      ss = nullptr;
+    }
+  }
+  if (ss == nullptr) {
+    cout << name << ": couldn't bind a listening socket" << endl;
+    return false;
+  }
+
+  HttpResponse query_rep = QueryResponse();
+  HttpResponse file_rep = FileResponse(dup(file_fd));
+  size_t query_size = query_rep.GenerateResponseString().size();
+  size_t file_size = file_rep.GenerateHeaderString().size() +
+                     string(kFileBody).size();
+  BenchServer bs = {ss, tp, &query_rep, &file_rep, false};
+  pthread_t acceptor;
+  pthread_create(&acceptor, nullptr, &BenchAcceptFn, &bs);
+
+  cout << name << endl;
+  bool fastopen = options.fastopen_queue > 0;
+  bool ok = RunClients(port, "query", false, false, kQueryRequest,
+                       query_size, num_clients, num_requests);
+  ok = RunClients(port, "file", false, false, kFileRequest,
+                  file_size, num_clients, num_requests) && ok;
+  ok = RunClients(port, "query/conn", true, fastopen, kQueryRequest,
+                  query_size, num_clients, num_requests) && ok;
+
+  // Wake the acceptor with one last connection so it sees "stop".
+  bs.stop = true;
+  int fd;
+  if (connect_to_server("127.0.0.1", port, &fd)) {
+    close(fd);
+  }
+  pthread_join(acceptor, nullptr);
+  delete ss;
+  return ok;
+}
+
+}  // namespace searchserver
+
+int main(int argc, char **argv) {
+  int num_clients = (argc > 1) ? atoi(argv[1]) : 4;
+  int num_requests = (argc > 2) ? atoi(argv[2]) : 200;
+  if (num_clients <= 0 || num_requests <= 0) {
+    std::cerr << "Usage: " << argv[0]
+              << " [num_clients] [requests_per_client]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  // The "static file" the server sends.
+  char path[] = "/tmp/bench_sockoptXXXXXX";
+  int file_fd = mkstemp(path);
+  if (file_fd < 0) {
+    perror("mkstemp");
+    return EXIT_FAILURE;
+  }
+  unlink(path);
+  string body(searchserver::kFileBody);
+  if (write(file_fd, body.data(), body.size()) !=
+      static_cast<ssize_t>(body.size())) {
+    perror("write");
+    return EXIT_FAILURE;
+  }
+
+  struct Config {
+    const char *name;
+    searchserver::SocketOptions options;
+  };
+  vector<Config> configs(7);
+  configs[0].name = "defaults";
+  configs[1].name = "TCP_NODELAY";
+  configs[1].options.no_delay = true;
+  configs[2].name = "TCP_DEFER_ACCEPT=1";
+  configs[2].options.defer_accept_secs = 1;
+  configs[3].name = "TCP_FASTOPEN=256";
+  configs[3].options.fastopen_queue = 256;
+  configs[4].name = "SO_RCVBUF/SO_SNDBUF=16k";
+  configs[4].options.rcvbuf_bytes = 16 * 1024;
+  configs[4].options.sndbuf_bytes = 16 * 1024;
+  configs[5].name = "SO_BUSY_POLL=50";
+  configs[5].options.busy_poll_usecs = 50;
+  configs[6].name = "backlog=4";
+  configs[6].options.backlog = 4;
+
+  cout << num_clients << " clients, " << num_requests
+       << " requests each per workload" << endl;
+  // Every keep-alive client holds a worker for its whole run.
+  searchserver::ThreadPool tp(num_clients + 1);
+  bool ok = true;
+  for (const Config &c : configs) {
+    ok = searchserver::RunBench(c.name, c.options, &tp, file_fd,
+                                num_clients, num_requests) && ok;
+  }
+  close(file_fd);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
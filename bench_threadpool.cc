@@ -0,0 +1,241 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+// Measures how fast tasks get through a ThreadPool as the number of
+// threads dispatching them and the number of workers running them
+// grows.  Every task is a no-op, so this is all queue overhead and
+// contention.  The same runs are repeated against LegacyPool, a copy
+// of the ThreadPool that guarded a std::list with one mutex and
+// condition variable, for comparison.
+//
+// A second set of runs compares allocating each task with new, as
+// callers of dispatch() do, against post(), whose tasks are recycled.
+//
+// Usage: bench_threadpool [tasks_per_run]
+
+extern "C" {
+  #include <pthread.h>
+}
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "./ThreadPool.h"
+
+using std::cerr;
+using std::endl;
+using std::vector;
+
+namespace searchserver {
+
+// The old ThreadPool's queue, minus admission control.  Like the old
+// ThreadPool, dispatch() stamps each task with the time.
+class LegacyPool {
+ public:
+  explicit LegacyPool(uint32_t num_threads)
+    : killthreads_(false), threads_(num_threads) {
+    pthread_mutex_init(&q_lock_, nullptr);
+    pthread_cond_init(&q_cond_, nullptr);
+    for (uint32_t i = 0; i < num_threads; i++) {
+      pthread_create(&threads_[i], nullptr, &LegacyPool::Loop, this);
+    }
+  }
+
+  ~LegacyPool() {
+    pthread_mutex_lock(&q_lock_);
+    killthreads_ = true;
+    pthread_cond_broadcast(&q_cond_);
+    pthread_mutex_unlock(&q_lock_);
+    for (pthread_t &t : threads_) {
+      pthread_join(t, nullptr);
+    }
+  }
+
+  void dispatch(ThreadPool::Task *t) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t->dispatch_ns_ = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    pthread_mutex_lock(&q_lock_);
+    work_queue_.push_back(t);
+    pthread_cond_signal(&q_cond_);
+    pthread_mutex_unlock(&q_lock_);
+  }
+
+ private:
+  static void *Loop(void *arg) {
+    LegacyPool *pool = static_cast<LegacyPool *>(arg);
+    pthread_mutex_lock(&pool->q_lock_);
+    while (!pool->killthreads_) {
+      if (pool->work_queue_.empty()) {
+        pthread_cond_wait(&pool->q_cond_, &pool->q_lock_);
+        continue;
+      }
+      ThreadPool::Task *t = pool->work_queue_.front();
+      pool->work_queue_.pop_front();
+      pthread_mutex_unlock(&pool->q_lock_);
+      t->func_(t);
+      pthread_mutex_lock(&pool->q_lock_);
+    }
+    pthread_mutex_unlock(&pool->q_lock_);
+    return nullptr;
+  }
+
+  pthread_mutex_t q_lock_;
+  pthread_cond_t q_cond_;
+  std::list<ThreadPool::Task *> work_queue_;
+  bool killthreads_;
+  vector<pthread_t> threads_;
+};
+
+// The tasks are allocated up front and never freed by the workers,
+// so that malloc() doesn't figure in the results.
+static std::atomic<int64_t> num_done;
+
+static void NoopTaskFn(ThreadPool::Task *t) {
+  num_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename Pool>
+struct Producer {
+  Pool *pool;
+  ThreadPool::Task *tasks;
+  int64_t num_tasks;
+};
+
+template <typename Pool>
+static void *ProducerFn(void *arg) {
+  Producer<Pool> *p = static_cast<Producer<Pool> *>(arg);
+  for (int64_t i = 0; i < p->num_tasks; i++) {
+    p->pool->dispatch(&p->tasks[i]);
+  }
+  return nullptr;
+}
+
+static double NowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+// Pushes "num_tasks" tasks through "pool" from "num_producers"
+// threads and returns how many seconds it took for all of them to run.
+template <typename Pool>
+static double RunOnce(Pool *pool, int num_producers, int64_t num_tasks,
+                      vector<ThreadPool::Task> *tasks) {
+  num_done = 0;
+  vector<pthread_t> threads(num_producers);
+  vector<Producer<Pool>> producers(num_producers);
+  int64_t per_producer = num_tasks / num_producers;
+  double start = NowSeconds();
+  for (int i = 0; i < num_producers; i++) {
+    producers[i].pool = pool;
+    producers[i].tasks = tasks->data() + i * per_producer;
+    producers[i].num_tasks = per_producer;
+    pthread_create(&threads[i], nullptr, &ProducerFn<Pool>, &producers[i]);
+  }
+  for (int i = 0; i < num_producers; i++) {
+    pthread_join(threads[i], nullptr);
+  }
+  while (num_done.load() < per_producer * num_producers) {
+    sched_yield();
+  }
+  return NowSeconds() - start;
+}
+
+// A task carrying a client address, allocated for each dispatch() and
+// freed by the worker, the way the accept loop used to do it.
+class AddrTask : public ThreadPool::Task {
+ public:
+  explicit AddrTask(const std::string &addr)
+    : ThreadPool::Task(&AddrTaskFn), addr(addr) { }
+  static void AddrTaskFn(ThreadPool::Task *t) {
+    num_done.fetch_add(1, std::memory_order_relaxed);
+    delete static_cast<AddrTask *>(t);
+  }
+  std::string addr;
+};
+
+// Pushes "num_tasks" tasks carrying a client address through a pool
+// of "num_workers", either as AddrTasks or with post(), and returns
+// how many seconds it took for all of them to run.
+static double RunAllocating(int num_workers, int64_t num_tasks,
+                            bool use_post) {
+  ThreadPool pool(num_workers);
+  num_done = 0;
+  const std::string addr("10.1.2.3");
+  double start = NowSeconds();
+  for (int64_t i = 0; i < num_tasks; i++) {
+    if (use_post) {
+      pool.post([addr]() {
+        num_done.fetch_add(1, std::memory_order_relaxed);
+      });
+    } else {
+      pool.dispatch(new AddrTask(addr));
+    }
+  }
+  while (num_done.load() < num_tasks) {
+    sched_yield();
+  }
+  return NowSeconds() - start;
+}
+
+}  // namespace searchserver
+
+int main(int argc, char **argv) {
+  int64_t num_tasks = (argc > 1) ? atoll(argv[1]) : 1000000;
+  if (num_tasks <= 0) {
+    cerr << "Usage: " << argv[0] << " [tasks_per_run]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  using searchserver::ThreadPool;
+  vector<ThreadPool::Task> tasks(num_tasks,
+                                 ThreadPool::Task(&searchserver::NoopTaskFn));
+  const int kCounts[][2] = {
+    {1, 1}, {2, 2}, {4, 4}, {8, 8}, {16, 16}, {32, 32}, {64, 64},
+    {1, 64}, {64, 1},
+  };
+  printf("%lld no-op tasks per run, %ld cpus\n",
+         static_cast<long long>(num_tasks), sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%9s %9s  %14s %14s\n", "producers", "workers",
+         "legacy ns/task", "lockfree ns/task");
+  for (const auto &count : kCounts) {
+    int producers = count[0];
+    int workers = count[1];
+    double legacy, lockfree;
+    {
+      searchserver::LegacyPool pool(workers);
+      legacy = searchserver::RunOnce(&pool, producers, num_tasks, &tasks);
+    }
+    {
+      ThreadPool pool(workers);
+      lockfree = searchserver::RunOnce(&pool, producers, num_tasks, &tasks);
+    }
+    printf("%9d %9d  %14.1f %14.1f\n", producers, workers,
+           legacy * 1e9 / num_tasks, lockfree * 1e9 / num_tasks);
+  }
+
+  printf("\n%9s %9s  %14s %14s\n", "producers", "workers",
+         "new ns/task", "post ns/task");
+  for (int workers : {1, 4, 16}) {
+    double allocated = searchserver::RunAllocating(workers, num_tasks, false);
+    double posted = searchserver::RunAllocating(workers, num_tasks, true);
+    printf("%9d %9d  %14.1f %14.1f\n", 1, workers,
+           allocated * 1e9 / num_tasks, posted * 1e9 / num_tasks);
+  }
+  return EXIT_SUCCESS;
+}
@@ -14,15 +14,20 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <signal.h>
+#include <cerrno>
+#include <cstdint>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <list>
 #include <string>
 
 #include "./ServerSocket.h"
 #include "./HttpServer.h"
+#include "./HttpUtils.h"
 #include "./CrawlFileTree.h"
 
 using std::cerr;
@@ -31,9 +36,53 @@ using std::endl;
 using std::list;
 using std::string;
 
+// The optional settings that can be passed to httpd as flags
+// in front of the port and path.
+struct ServerFlags {
+  searchserver::HttpServer::ServingMode mode;
+  searchserver::IoBackend io_backend;
+  uint32_t num_listeners;
+  bool reverse_dns;
+  size_t static_cache_bytes;
+  size_t max_header_bytes;
+  int header_timeout_ms;
+  int idle_timeout_ms;
+  int write_timeout_ms;
+  uint32_t max_requests;
+  uint32_t queue_target_ms;
+  uint32_t min_threads;
+  uint32_t max_threads;
+  searchserver::ThreadPool::Placement placement;
+  searchserver::SocketOptions socket_options;
+};
+
+// With -a, how long (as a multiple of the target) the queue delay has
+// to stay above the target before connections are shed.
+static const uint32_t kQueueIntervalPerTarget = 10;
+
 // Print out program usage, and exit() with EXIT_FAILURE.
 static void Usage(char *prog_name);
 
+// Parses the option argument "arg" as a number no bigger than "max",
+// or calls Usage() if it isn't one.
+static unsigned long GetNumber(char *prog_name, const char *arg,
+                               unsigned long max);
+
+// Parses the comma-separated "name[=value]" list "arg" given to -s
+// into "options", or calls Usage() if it isn't one.
+static void GetSocketOptions(char *prog_name, char *arg,
+                             searchserver::SocketOptions *options);
+
+// Parses the "min:max" given to -p into "min_threads" and
+// "max_threads", or calls Usage() if it isn't valid.
+static void GetThreadLimits(char *prog_name, char *arg,
+                            uint32_t *min_threads, uint32_t *max_threads);
+
+// Parses the leading command-line flags into "flags", invokes
+// Usage() on failure.  Returns the index into argv of the first
+// argument that isn't a flag.
+static int GetFlags(int argc, char **argv, ServerFlags *flags);
+
 // Parses the command-line arguments, invokes Usage() on failure.
 // "port" is a return parameter to the port number to listen on,
 // "path" is a return parameter to the directory containing
@@ -43,6 +92,7 @@ static void Usage(char *prog_name);
 // invokes Usage() to exit.
 static void GetPortAndPath(int argc,
                     char **argv,
+                    int first_arg,
                     uint16_t *port,
                     string *path);
 
@@ -56,21 +106,48 @@ int main(int argc, char **argv) {
   signal(SIGPIPE, SIG_IGN);
 
   // Get the port number and list of index files.
+  ServerFlags flags;
   uint16_t port_num;
   string static_dir;
-  GetPortAndPath(argc, argv, &port_num, &static_dir);
+  int first_arg = GetFlags(argc, argv, &flags);
+  GetPortAndPath(argc, argv, first_arg, &port_num, &static_dir);
   cout << "    port: " << port_num << endl;
   cout << "    path: " << static_dir << endl;
 
+  // Pick the I/O backend before any sockets get created.
+  if (flags.io_backend != searchserver::kBlockingIo &&
+      searchserver::set_io_backend(flags.io_backend) !=
+      flags.io_backend) {
+    cout << "    io_uring unavailable, using blocking I/O" << endl;
+  }
+
   searchserver::WordIndex *index = new searchserver::WordIndex();
 
   if (!searchserver::crawl_filetree(static_dir, index)) {
     cerr << " failed to crawl the file directory" << endl;
     return EXIT_FAILURE;
   }
+  // Nothing is added to the index from here on, so squeeze it down to
+  // its read-only form.
+  index->compact();
  
   // Run the server.
   searchserver::HttpServer hs(port_num, static_dir, index);
+  hs.set_serving_mode(flags.mode);
+  hs.set_num_listeners(flags.num_listeners);
+  hs.set_reverse_dns(flags.reverse_dns);
+  hs.set_static_cache_bytes(flags.static_cache_bytes);
+  hs.set_max_header_bytes(flags.max_header_bytes);
+  hs.set_timeouts(flags.header_timeout_ms, flags.idle_timeout_ms,
+                  flags.write_timeout_ms);
+  hs.set_max_requests(flags.max_requests);
+  hs.set_socket_options(flags.socket_options);
+  hs.set_worker_threads(flags.min_threads, flags.max_threads,
+                        searchserver::HttpServer::kDefaultThreadIdleMs);
+  hs.set_worker_placement(flags.placement);
+  hs.set_admission_control(flags.queue_target_ms,
+                           flags.queue_target_ms *
+                           kQueueIntervalPerTarget);
   if (!hs.run()) {
     cerr << "  server failed to run!?" << endl;
   }
@@ -81,48 +158,252 @@ int main(int argc, char **argv) {
 
 
 static void Usage(char *prog_name) {
-  cerr << "Usage: " << prog_name << " port staticfiles_directory";
+  cerr << "Usage: " << prog_name
+       << " [-e] [-u] [-r] [-n] [-c cache_mb] [-m header_kb]"
+       << " [-t header_secs] [-k idle_secs] [-w write_secs]"
+       << " [-q max_requests] [-a queue_target_ms] [-p min:max]"
+       << " [-P cpu|node]"
+       << " [-s sockopt[=n],...]"
+       << " port staticfiles_directory";
   cerr << endl;
+  cerr << "  -e  serve connections from an epoll event loop" << endl;
+  cerr << "  -u  use io_uring for accept, read and write" << endl;
+  cerr << "  -r  open one SO_REUSEPORT listener per core" << endl;
+  cerr << "  -n  log clients by IP address only (no reverse DNS)" << endl;
+  cerr << "  -c  megabytes of static file responses to cache in memory"
+       << " (default "
+       << (searchserver::HttpServer::kDefaultStaticCacheBytes >> 20)
+       << ", 0 disables)" << endl;
+  cerr << "  -m  kilobytes a request header may take up (default "
+       << (searchserver::HttpConnection::kDefaultMaxHeaderBytes >> 10)
+       << ")" << endl;
+  cerr << "  -t  seconds a client may take to send a request header"
+       << " (default "
+       << searchserver::HttpServer::kDefaultHeaderTimeoutMs / 1000
+       << ", 0 disables)" << endl;
+  cerr << "  -k  seconds a client may stay idle between requests (default "
+       << searchserver::HttpServer::kDefaultIdleTimeoutMs / 1000
+       << ", 0 disables)" << endl;
+  cerr << "  -w  seconds a client may leave a response unread (default "
+       << searchserver::HttpServer::kDefaultWriteTimeoutMs / 1000
+       << ", 0 disables)" << endl;
+  cerr << "  -q  requests served per connection (default "
+       << searchserver::HttpServer::kDefaultMaxRequests
+       << ", 0 means no limit)" << endl;
+  cerr << "  -a  milliseconds work may keep waiting for a worker before"
+       << " new clients get a 503 (default "
+       << searchserver::HttpServer::kDefaultQueueTargetMs
+       << ", 0 disables)" << endl;
+  cerr << "  -p  worker threads started up front, and the most there"
+       << " may be (default "
+       << searchserver::HttpServer::kDefaultMinThreads << ":"
+       << searchserver::HttpServer::kDefaultMaxThreads << ")" << endl;
+  cerr << "  -P  pin each worker thread to one CPU, or to one NUMA node"
+       << endl;
+  cerr << "  -s  listening socket tuning, any of nodelay=0|1 (default 1),"
+       << " defer_accept=secs," << endl
+       << "      fastopen=queue_len, rcvbuf=bytes, sndbuf=bytes,"
+       << " busy_poll=usecs, backlog=n" << endl;
   exit(EXIT_FAILURE);
 }
 
+static int GetFlags(int argc, char **argv, ServerFlags *flags) {
+  flags->mode = searchserver::HttpServer::kThreadPerConnection;
+  flags->io_backend = searchserver::kBlockingIo;
+  flags->num_listeners = 1;
+  flags->reverse_dns = true;
+  flags->static_cache_bytes =
+    searchserver::HttpServer::kDefaultStaticCacheBytes;
+  flags->max_header_bytes =
+    searchserver::HttpConnection::kDefaultMaxHeaderBytes;
+  flags->header_timeout_ms = searchserver::HttpServer::kDefaultHeaderTimeoutMs;
+  flags->idle_timeout_ms = searchserver::HttpServer::kDefaultIdleTimeoutMs;
+  flags->write_timeout_ms = searchserver::HttpServer::kDefaultWriteTimeoutMs;
+  flags->max_requests = searchserver::HttpServer::kDefaultMaxRequests;
+  flags->queue_target_ms = searchserver::HttpServer::kDefaultQueueTargetMs;
+  flags->min_threads = searchserver::HttpServer::kDefaultMinThreads;
+  flags->max_threads = searchserver::HttpServer::kDefaultMaxThreads;
+  flags->placement = searchserver::ThreadPool::kUnpinned;
+  flags->socket_options = searchserver::HttpServer::DefaultSocketOptions();
+
+  int opt;
+  while ((opt = getopt(argc, argv, "eurnc:m:t:k:w:q:a:p:P:s:")) != -1) {
+    switch (opt) {
+      case 'e':
+        flags->mode = searchserver::HttpServer::kEventLoop;
+        break;
+      case 'u':
+        flags->io_backend = searchserver::kIoUringIo;
+        break;
+      case 'r': {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        flags->num_listeners = (num_cpus > 0) ? num_cpus : 1;
+        break;
+      }
+      case 'n':
+        flags->reverse_dns = false;
+        break;
+      case 'c':
+        flags->static_cache_bytes =
+          static_cast<size_t>(GetNumber(argv[0], optarg, 1 << 20)) << 20;
+        break;
+      case 'm': {
+        unsigned long kb = GetNumber(argv[0], optarg, 1 << 20);
+        if (kb == 0) {
+          Usage(argv[0]);
+        }
+        flags->max_header_bytes = static_cast<size_t>(kb) << 10;
+        break;
+      }
+      case 't':
+        flags->header_timeout_ms = GetNumber(argv[0], optarg, 86400) * 1000;
+        break;
+      case 'k':
+        flags->idle_timeout_ms = GetNumber(argv[0], optarg, 86400) * 1000;
+        break;
+      case 'w':
+        flags->write_timeout_ms = GetNumber(argv[0], optarg, 86400) * 1000;
+        break;
+      case 'q':
+        flags->max_requests = GetNumber(argv[0], optarg, UINT32_MAX);
+        break;
+      case 'a':
+        flags->queue_target_ms = GetNumber(argv[0], optarg, 60 * 1000);
+        break;
+      case 'p':
+        GetThreadLimits(argv[0], optarg, &flags->min_threads,
+                        &flags->max_threads);
+        break;
+      case 'P':
+        if (strcmp(optarg, "cpu") == 0) {
+          flags->placement = searchserver::ThreadPool::kPinToCpu;
+        } else if (strcmp(optarg, "node") == 0) {
+          flags->placement = searchserver::ThreadPool::kPinToNode;
+        } else {
+          Usage(argv[0]);
+        }
+        break;
+      case 's':
+        GetSocketOptions(argv[0], optarg, &flags->socket_options);
+        break;
+      default:
+        Usage(argv[0]);
+    }
+  }
+  return optind;
+}
+
+static unsigned long GetNumber(char *prog_name, const char *arg,
+                               unsigned long max) {
+  char *end;
+  errno = 0;
+  unsigned long num = strtoul(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0' || errno != 0 || num > max) {
+    Usage(prog_name);
+  }
+  return num;
+}
+
+static void GetThreadLimits(char *prog_name, char *arg,
+                            uint32_t *min_threads, uint32_t *max_threads) {
+  char *colon = strchr(arg, ':');
+  if (colon == nullptr) {
+    Usage(prog_name);
+  }
+  *colon = '\0';
+  *min_threads = GetNumber(prog_name, arg, 4096);
+  *max_threads = GetNumber(prog_name, colon + 1, 4096);
+  if (*max_threads == 0 || *max_threads < *min_threads) {
+    Usage(prog_name);
+  }
+}
+
+static void GetSocketOptions(char *prog_name, char *arg,
+                             searchserver::SocketOptions *options) {
+  enum { kNoDelay, kDeferAccept, kFastOpen, kRcvBuf, kSndBuf, kBusyPoll,
+         kBacklog };
+  char nodelay[] = "nodelay", defer_accept[] = "defer_accept",
+       fastopen[] = "fastopen", rcvbuf[] = "rcvbuf", sndbuf[] = "sndbuf",
+       busy_poll[] = "busy_poll", backlog[] = "backlog";
+  char *const tokens[] = {nodelay, defer_accept, fastopen, rcvbuf, sndbuf,
+                          busy_poll, backlog, nullptr};
+  while (*arg != '\0') {
+    char *value;
+    int which = getsubopt(&arg, tokens, &value);
+    if (which == kNoDelay && value == nullptr) {
+      options->no_delay = true;
+      continue;
+    }
+    if (which < 0 || value == nullptr) {
+      Usage(prog_name);
+    }
+    int num = GetNumber(prog_name, value, INT32_MAX);
+    switch (which) {
+      case kNoDelay:
+        options->no_delay = (num != 0);
+        break;
+      case kDeferAccept:
+        options->defer_accept_secs = num;
+        break;
+      case kFastOpen:
+        options->fastopen_queue = num;
+        break;
+      case kRcvBuf:
+        options->rcvbuf_bytes = num;
+        break;
+      case kSndBuf:
+        options->sndbuf_bytes = num;
+        break;
+      case kBusyPoll:
+        options->busy_poll_usecs = num;
+        break;
+      case kBacklog:
+        options->backlog = (num > 0) ? num : SOMAXCONN;
+        break;
+    }
+  }
+}
+
 static void GetPortAndPath(int argc,
                     char **argv,
+                    int first_arg,
                     uint16_t *port,
                     string *path) {
   // Be sure to check a few things:
   //  (a) that you have a sane number of command line arguments
   //  (b) that the port number is reasonable
-  //  (c) that "path" (i.e., argv[2]) is a readable directory
+  //  (c) that "path" (i.e., the last argument) is a readable directory
 
   // STEP 1:
   // Do we have the right number of command line arguments?
-  if (argc != 3) {
+  if (argc - first_arg != 2) {
     cerr << endl;
     Usage(argv[0]);
   }
+  char *port_arg = argv[first_arg];
+  char *path_arg = argv[first_arg + 1];
 
   // Try to get the port number.
-  if (sscanf(argv[1], "%hu", port) != 1) {
-    cerr << endl << argv[1] << " isn't a valid port number." << endl;
+  if (sscanf(port_arg, "%hu", port) != 1) {
+    cerr << endl << port_arg << " isn't a valid port number." << endl;
     Usage(argv[0]);
   }
 
   // Test to see if "path" is a readable directory.
   struct stat fs;
-  if ((stat(argv[2], &fs) == -1) ||
+  if ((stat(path_arg, &fs) == -1) ||
       (!S_ISDIR(fs.st_mode))) {
-    cerr << endl << argv[2] << " isn't a directory." << endl;
+    cerr << endl << path_arg << " isn't a directory." << endl;
     Usage(argv[0]);
   }
 
-  DIR *d = opendir(argv[2]);
+  DIR *d = opendir(path_arg);
   if (d == nullptr) {
-    cerr << endl << argv[2] << " isn't a readable directory." << endl;
+    cerr << endl << path_arg << " isn't a readable directory." << endl;
     Usage(argv[0]);
   }
 
   closedir(d);
-  *path = argv[2];
+  *path = path_arg;
 }
 
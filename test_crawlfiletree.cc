@@ -9,11 +9,18 @@
  * author.
  */
 
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <map>
+
 #include "gtest/gtest.h"
 #include "./test_suite.h"
 
 #include "./CrawlFileTree.h"
 #include "./WordIndex.h"
+#include "./ThreadPool.h"
 
 namespace searchserver {
 
@@ -60,9 +67,11 @@ TEST(Test_CrawlFileTree, Integration) {
   auto it = res1_word.begin();
 
   ASSERT_EQ(2U, res1_word.size());
-  ASSERT_EQ("./test_tree/bash-4.2/support/texi2html", it->doc_name);
+  ASSERT_EQ("./test_tree/bash-4.2/support/texi2html",
+            idx.doc_name(it->doc_id));
   it++;
-  ASSERT_EQ("./test_tree/bash-4.2/support/man2html.c", it->doc_name);
+  ASSERT_EQ("./test_tree/bash-4.2/support/man2html.c",
+            idx.doc_name(it->doc_id));
 
   ProjectEnvironment::AddPoints(10);
 
@@ -71,10 +80,12 @@ TEST(Test_CrawlFileTree, Integration) {
   auto res1_query = idx.lookup_query(q1_query);
   it = res1_query.begin();
   ASSERT_EQ(2U, res1_query.size());
-  ASSERT_EQ("./test_tree/bash-4.2/support/texi2html", it->doc_name);
+  ASSERT_EQ("./test_tree/bash-4.2/support/texi2html",
+            idx.doc_name(it->doc_id));
   ASSERT_EQ(2, it->rank);
   it++;
-  ASSERT_EQ("./test_tree/bash-4.2/support/man2html.c", it->doc_name);
+  ASSERT_EQ("./test_tree/bash-4.2/support/man2html.c",
+            idx.doc_name(it->doc_id));
   ASSERT_EQ(1, it->rank);
   ProjectEnvironment::AddPoints(5);
 
@@ -82,10 +93,12 @@ TEST(Test_CrawlFileTree, Integration) {
   auto res2 = idx.lookup_query(q2);
   it = res2.begin();
   ASSERT_EQ(2U, res2.size());
-  ASSERT_EQ("./test_tree/bash-4.2/support/texi2html", it->doc_name);
+  ASSERT_EQ("./test_tree/bash-4.2/support/texi2html",
+            idx.doc_name(it->doc_id));
   ASSERT_EQ(12, it->rank);
   it++;
-  ASSERT_EQ("./test_tree/bash-4.2/support/man2html.c", it->doc_name);
+  ASSERT_EQ("./test_tree/bash-4.2/support/man2html.c",
+            idx.doc_name(it->doc_id));
   ASSERT_EQ(3, it->rank);
   ProjectEnvironment::AddPoints(10);
 
@@ -93,7 +106,8 @@ TEST(Test_CrawlFileTree, Integration) {
   auto res3 = idx.lookup_query(q3);
   it = res3.begin();
   ASSERT_EQ(1U, res3.size());
-  ASSERT_EQ("./test_tree/bash-4.2/support/texi2html", it->doc_name);
+  ASSERT_EQ("./test_tree/bash-4.2/support/texi2html",
+            idx.doc_name(it->doc_id));
   ASSERT_EQ(13, it->rank);
   ProjectEnvironment::AddPoints(10);
 
@@ -105,5 +119,68 @@ TEST(Test_CrawlFileTree, Integration) {
 
 }
 
-}  // namespace searchserver
+// Flattens a result list so two lookups can be compared regardless
+// of the order equally ranked documents come back in, or the IDs the
+// two indices gave them.
+static std::map<string, int> ResultMap(WordIndex* index,
+                                       const list<Result>& results) {
+  std::map<string, int> m;
+  for (const Result& r : results) {
+    m[index->doc_name(r.doc_id)] = r.rank;
+  }
+  return m;
+}
 
+TEST(Test_CrawlFileTree, ParallelMatchesSerial) {
+  // Build a small tree with nested directories in a temp dir.
+  char root[] = "/tmp/crawltestXXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(root));
+  string base(root);
+  const vector<string> dirs = {"/a", "/a/b", "/a/b/c", "/d", "/e"};
+  for (const string& dir : dirs) {
+    ASSERT_EQ(0, mkdir((base + dir).c_str(), 0700));
+  }
+  vector<string> files;
+  for (size_t i = 0; i < 20; i++) {
+    string fname = base + dirs[i % dirs.size()] + "/f" + std::to_string(i);
+    std::ofstream out(fname);
+    out << "common Shared word" << static_cast<char>('a' + i) << " apple"
+        << static_cast<char>('a' + i % 3) << " common\n";
+    for (size_t j = 0; j < i; j++) {
+      out << "repeat ";
+    }
+    out << "\n";
+    files.push_back(fname);
+  }
+
+  WordIndex serial, parallel;
+  ASSERT_TRUE(crawl_filetree(base, &serial));
+  ThreadPool pool(4);
+  pool.set_work_stealing(true);
+  ASSERT_TRUE(crawl_filetree(base, &parallel, &pool));
+  ASSERT_FALSE(crawl_filetree(base + "/missing", &parallel, &pool));
+
+  ASSERT_EQ(serial.num_words(), parallel.num_words());
+  for (const char *word : {"common", "shared", "wordh", "appleb",
+                             "repeat"}) {
+    auto expected = ResultMap(&serial, serial.lookup_word(word));
+    ASSERT_FALSE(expected.empty()) << word;
+    ASSERT_EQ(expected, ResultMap(&parallel, parallel.lookup_word(word)))
+        << word;
+  }
+  ASSERT_EQ(ResultMap(&serial, serial.lookup_query({"common", "applec"})),
+            ResultMap(&parallel,
+                      parallel.lookup_query({"common", "applec"})));
+  ASSERT_EQ(files.size(), serial.num_docs());
+  ASSERT_EQ(files.size(), parallel.num_docs());
+
+  for (const string& fname : files) {
+    unlink(fname.c_str());
+  }
+  for (auto it = dirs.rbegin(); it != dirs.rend(); it++) {
+    rmdir((base + *it).c_str());
+  }
+  rmdir(root);
+}
+
+}  // namespace searchserver
@@ -0,0 +1,75 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <unistd.h>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./DnsResolver.h"
+#include "./test_suite.h"
+
+using std::string;
+
+namespace searchserver {
+
+// Calls resolver->lookup(addr) until it hits the cache, giving up
+// after about two seconds.  Returns whether it ever did.
+static bool WaitForLookup(DnsResolver *resolver, const string &addr,
+                          string *name) {
+  for (int i = 0; i < 200; i++) {
+    if (resolver->lookup(addr, name)) {
+      return true;
+    }
+    usleep(10000);  // 10ms
+  }
+  return false;
+}
+
+TEST(Test_DnsResolver, Basic) {
+  // Things that aren't IP addresses never go anywhere near DNS.
+  string name;
+  ASSERT_FALSE(reverse_dns("not an address", &name));
+  ASSERT_EQ("not an address", name);
+
+  // The first lookup only queues the address; until the answer is in
+  // we get the address back.
+  DnsResolver resolver(16, 60);
+  ASSERT_FALSE(resolver.lookup("127.0.0.1", &name));
+  ASSERT_EQ("127.0.0.1", name);
+
+  // Once the background lookup is done, it comes from the cache.  An
+  // address that doesn't resolve is cached as itself.
+  ASSERT_TRUE(WaitForLookup(&resolver, "127.0.0.1", &name));
+  ASSERT_FALSE(name.empty());
+  ASSERT_TRUE(WaitForLookup(&resolver, "not an address", &name));
+  ASSERT_EQ("not an address", name);
+  ASSERT_EQ(2U, resolver.size());
+}
+
+TEST(Test_DnsResolver, Bounded) {
+  // Only the most recently resolved addresses stay in the cache.
+  DnsResolver resolver(2, 60);
+  string name;
+  ASSERT_TRUE(WaitForLookup(&resolver, "bogus-1", &name));
+  ASSERT_TRUE(WaitForLookup(&resolver, "bogus-2", &name));
+  ASSERT_TRUE(WaitForLookup(&resolver, "bogus-3", &name));
+  ASSERT_EQ(2U, resolver.size());
+  ASSERT_TRUE(resolver.lookup("bogus-3", &name));
+  ASSERT_FALSE(resolver.lookup("bogus-1", &name));
+
+  // With a zero TTL nothing is ever fresh, so we always get the
+  // address back without waiting.
+  DnsResolver uncached(2, 0);
+  ASSERT_FALSE(uncached.lookup("127.0.0.1", &name));
+  ASSERT_EQ("127.0.0.1", name);
+}
+
+}  // namespace searchserver
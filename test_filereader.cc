@@ -9,6 +9,8 @@
  * author.
  */
 
+#include <unistd.h>
+
 #include "./FileReader.h"
 
 #include "gtest/gtest.h"
@@ -45,6 +47,19 @@ TEST(Test_FileReader, Basic) {
   f = FileReader("./test_files/../cpplint.py");
   ASSERT_FALSE(f.read_file(&contents));
   ProjectEnvironment::AddPoints(5);
+
+  // Opening a file for sendfile() reports its size without reading it,
+  // and refuses anything that isn't a regular file.
+  int fd;
+  uint64_t size;
+  f = FileReader("./test_files/transparent.gif");
+  ASSERT_TRUE(f.open_file(&fd, &size));
+  ASSERT_EQ(43U, size);
+  close(fd);
+  f = FileReader("./non-existent");
+  ASSERT_FALSE(f.open_file(&fd, &size));
+  f = FileReader("./test_files");
+  ASSERT_FALSE(f.open_file(&fd, &size));
 }
 
 }  // namespace searchserver
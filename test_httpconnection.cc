@@ -13,11 +13,16 @@ extern "C" {
   #include <pthread.h>  // for the pthread threading/mutex functions
 }
 
+#include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <memory>
 #include <string>
+#include <thread>
 
+#include "./FileReader.h"
 #include "./HttpConnection.h"
 
 #include "gtest/gtest.h"
@@ -27,6 +32,7 @@ extern "C" {
 #include "./test_suite.h"
 
 using std::string;
+using std::vector;
 
 namespace searchserver {
 
@@ -371,4 +377,407 @@ TEST(Test_HttpConnection, write_response) {
   ProjectEnvironment::AddPoints(10);
 }
 
+TEST(Test_HttpConnection, Pipelining) {
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+  HttpConnection hc(spair[0]);
+
+  // The client sends three requests before waiting for any answers.
+  string reqs = "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n"
+                "GET /c HTTP/1.1\r\n\r\n";
+  ASSERT_EQ(static_cast<int>(reqs.size()), wrapped_write(spair[1], reqs));
+
+  // The requests are all buffered after the first read, so their
+  // responses go out together.
+  HttpRequest req;
+  ASSERT_TRUE(hc.next_request(&req));
+  ASSERT_EQ("/a", req.uri());
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.AppendToBody("hi!");
+  hc.queue_response(rep);
+  ASSERT_TRUE(hc.next_buffered_request(&req));
+  ASSERT_EQ("/b", req.uri());
+  hc.queue_response(rep);
+  ASSERT_TRUE(hc.write_pending_and_next_request(&req));
+  ASSERT_EQ("/c", req.uri());
+  ASSERT_FALSE(hc.has_pending_output());
+
+  string expected = rep.GenerateResponseString();
+  expected += expected;
+  string actual;
+  while (actual.size() < expected.size()) {
+    ASSERT_LT(0, wrapped_read(spair[1], &actual));
+  }
+  ASSERT_EQ(expected, actual);
+
+  // With nothing left buffered, we wait for the next request.
+  hc.queue_response(rep);
+  string req4 = "GET /d HTTP/1.1\r\n\r\n";
+  ASSERT_EQ(static_cast<int>(req4.size()), wrapped_write(spair[1], req4));
+  ASSERT_TRUE(hc.write_pending_and_next_request(&req));
+  ASSERT_EQ("/d", req.uri());
+  actual.clear();
+  ASSERT_LT(0, wrapped_read(spair[1], &actual));
+  ASSERT_EQ(rep.GenerateResponseString(), actual);
+  close(spair[1]);
+}
+
+TEST(Test_HttpConnection, ManyHeaders) {
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+  HttpConnection hc(spair[0]);
+
+  // More headers than fit in the request's inline array, odd spacing,
+  // mixed case and a repeated header.
+  string req = "  GET   /many  HTTP/1.1\r\nHost:h\r\n";
+  for (int i = 0; i < 20; i++) {
+    req += "X-Header-" + std::to_string(i) + ":   V" + std::to_string(i) +
+           "  \r\n";
+  }
+  req += "HOST: second\r\n\r\n";
+  ASSERT_EQ(static_cast<int>(req.size()), wrapped_write(spair[1], req));
+
+  HttpRequest htreq;
+  ASSERT_TRUE(hc.next_request(&htreq));
+  ASSERT_EQ("/many", htreq.uri());
+  ASSERT_EQ(21, htreq.GetHeaderCount());
+  ASSERT_EQ("second", htreq.GetHeaderValue("host"));
+  ASSERT_EQ("v0", htreq.GetHeaderValue("x-header-0"));
+  ASSERT_EQ("v19", htreq.GetHeaderValue("X-HEADER-19"));
+  ASSERT_EQ("", htreq.GetHeaderValue("missing"));
+
+  // A copy keeps its own storage, so it outlives the next parse.
+  HttpRequest copy(htreq);
+  string req2 = "GET /next HTTP/1.1\r\nOther: x\r\n\r\n";
+  ASSERT_EQ(static_cast<int>(req2.size()), wrapped_write(spair[1], req2));
+  ASSERT_TRUE(hc.next_request(&htreq));
+  ASSERT_EQ("/next", htreq.uri());
+  ASSERT_EQ(1, htreq.GetHeaderCount());
+  ASSERT_EQ("", htreq.GetHeaderValue("host"));
+  ASSERT_EQ("/many", copy.uri());
+  ASSERT_EQ("v7", copy.GetHeaderValue("x-header-7"));
+
+  // Headers added by hand work the same way.
+  HttpRequest built("/built");
+  built.AddHeader("Accept", "text/html");
+  ASSERT_EQ("/built", built.uri());
+  ASSERT_EQ("text/html", built.GetHeaderValue("accept"));
+  close(spair[1]);
+}
+
+TEST(Test_HttpConnection, MaxHeaderBytes) {
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+  int flags = fcntl(spair[0], F_GETFL, 0);
+  ASSERT_EQ(0, fcntl(spair[0], F_SETFL, flags | O_NONBLOCK));
+  HttpConnection hc(spair[0]);
+  hc.set_max_header_bytes(64);
+
+  // A header that is exactly at the limit, trickled in a byte at a
+  // time.
+  string req = "GET /fits HTTP/1.1\r\nHost: h\r\nX: ";
+  req += string(64 - req.size() - 4, 'a') + "\r\n\r\n";
+  ASSERT_EQ(64U, req.size());
+  HttpRequest htreq;
+  for (size_t i = 0; i < req.size(); i++) {
+    ASSERT_FALSE(hc.next_buffered_request(&htreq));
+    ASSERT_EQ(1, wrapped_write(spair[1], req.substr(i, 1)));
+    ASSERT_TRUE(hc.read_available());
+  }
+  ASSERT_TRUE(hc.next_buffered_request(&htreq));
+  ASSERT_EQ("/fits", htreq.uri());
+  ASSERT_EQ("h", htreq.GetHeaderValue("host"));
+  ASSERT_FALSE(hc.header_too_large());
+
+  // One byte more is too much, whether or not the header is complete.
+  string big = "GET /big HTTP/1.1\r\nX: " + string(64, 'b');
+  ASSERT_EQ(static_cast<int>(big.size()), wrapped_write(spair[1], big));
+  ASSERT_TRUE(hc.read_available());
+  ASSERT_FALSE(hc.next_buffered_request(&htreq));
+  ASSERT_TRUE(hc.header_too_large());
+  close(spair[1]);
+
+  int spair2[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair2));
+  HttpConnection hc2(spair2[0]);
+  hc2.set_max_header_bytes(64);
+  string ok = "GET /ok HTTP/1.1\r\n\r\n";
+  req = ok + "GET /big HTTP/1.1\r\nX: " + string(64, 'b') + "\r\n\r\n";
+  ASSERT_EQ(static_cast<int>(req.size()), wrapped_write(spair2[1], req));
+  ASSERT_TRUE(hc2.next_request(&htreq));
+  ASSERT_EQ("/ok", htreq.uri());
+  ASSERT_FALSE(hc2.next_request(&htreq));
+  ASSERT_TRUE(hc2.header_too_large());
+  close(spair2[1]);
+}
+
+// Returns how many milliseconds have passed since "start".
+static int64_t ElapsedMs(const struct timespec &start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) * 1000 +
+         (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+TEST(Test_HttpConnection, Timeouts) {
+  struct timespec start;
+  HttpRequest htreq;
+
+  // A client that never sends anything is dropped after the idle
+  // timeout.
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+  HttpConnection idle(spair[0]);
+  ASSERT_TRUE(idle.set_timeouts(5000, 100, 100));
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ASSERT_FALSE(idle.next_request(&htreq));
+  ASSERT_LE(90, ElapsedMs(start));
+  ASSERT_GT(2000, ElapsedMs(start));
+
+  // A response the client doesn't read gives up after the write
+  // timeout.
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.AppendToBody(string(8 << 20, 'x'));
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ASSERT_FALSE(idle.write_response(rep));
+  ASSERT_GT(2000, ElapsedMs(start));
+  close(spair[1]);
+
+  // A client that trickles its header in keeps making progress, but
+  // is dropped once the header timeout runs out.
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+  HttpConnection slow(spair[0]);
+  ASSERT_TRUE(slow.set_timeouts(300, 5000, 5000));
+  int client_fd = spair[1];
+  std::thread trickler([client_fd]() {
+    string req = "GET /slow HTTP/1.1\r\nHost: somehost.foo.bar\r\n\r\n";
+    for (char c : req) {
+      // MSG_NOSIGNAL, since the server end goes away partway through.
+      if (send(client_fd, &c, 1, MSG_NOSIGNAL) != 1) {
+        break;
+      }
+      usleep(50 * 1000);
+    }
+  });
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ASSERT_FALSE(slow.next_request(&htreq));
+  ASSERT_LE(290, ElapsedMs(start));
+  ASSERT_GT(2000, ElapsedMs(start));
+  shutdown(spair[0], SHUT_RDWR);
+  trickler.join();
+  close(spair[1]);
+}
+
+TEST(Test_HttpConnection, MaxRequests) {
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+  HttpConnection hc(spair[0]);
+  hc.set_max_requests(2);
+  string reqs = "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n";
+  ASSERT_EQ(static_cast<int>(reqs.size()), wrapped_write(spair[1], reqs));
+
+  HttpRequest htreq;
+  ASSERT_TRUE(hc.next_request(&htreq));
+  ASSERT_FALSE(hc.request_limit_reached());
+  ASSERT_TRUE(hc.next_request(&htreq));
+  ASSERT_EQ("/b", htreq.uri());
+  ASSERT_TRUE(hc.request_limit_reached());
+  close(spair[1]);
+}
+
+TEST(Test_HttpConnection, NonBlocking) {
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+  int flags = fcntl(spair[0], F_GETFL, 0);
+  ASSERT_EQ(0, fcntl(spair[0], F_SETFL, flags | O_NONBLOCK));
+  HttpConnection hc(spair[0]);
+
+  // Nothing has been sent yet, so reading must not block.
+  HttpRequest htreq1, htreq2;
+  ASSERT_TRUE(hc.read_available());
+  ASSERT_FALSE(hc.next_buffered_request(&htreq1));
+
+  // Half a request isn't enough to produce one.
+  string part1 = "GET /foo HTTP/1.1\r\nHost: somehost";
+  string part2 = ".foo.bar\r\n\r\nGET /bar HTTP/1.1\r\n\r\n";
+  ASSERT_EQ(static_cast<int>(part1.size()), wrapped_write(spair[1], part1));
+  ASSERT_TRUE(hc.read_available());
+  ASSERT_FALSE(hc.next_buffered_request(&htreq1));
+
+  // The rest completes the first request and carries a second one.
+  ASSERT_EQ(static_cast<int>(part2.size()), wrapped_write(spair[1], part2));
+  ASSERT_TRUE(hc.read_available());
+  ASSERT_TRUE(hc.next_buffered_request(&htreq1));
+  ASSERT_EQ("/foo", htreq1.uri());
+  ASSERT_EQ("somehost.foo.bar", htreq1.GetHeaderValue("host"));
+  ASSERT_TRUE(hc.next_buffered_request(&htreq2));
+  ASSERT_EQ("/bar", htreq2.uri());
+  ASSERT_FALSE(hc.next_buffered_request(&htreq2));
+
+  // Queued responses go out in order once flushed.
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.AppendToBody("hi!");
+  hc.queue_response(rep);
+  hc.queue_response(rep);
+  ASSERT_TRUE(hc.has_pending_output());
+  ASSERT_TRUE(hc.flush_pending());
+  ASSERT_FALSE(hc.has_pending_output());
+
+  string expected = rep.GenerateResponseString();
+  expected += expected;
+  string actual;
+  while (actual.size() < expected.size()) {
+    ASSERT_LT(0, wrapped_read(spair[1], &actual));
+  }
+  ASSERT_EQ(expected, actual);
+
+  // Once the client hangs up, read_available() reports it.
+  close(spair[1]);
+  ASSERT_FALSE(hc.read_available());
+}
+
+TEST(Test_HttpConnection, FileBody) {
+  string contents;
+  ASSERT_TRUE(FileReader("./test_files/hextext.txt").read_file(&contents));
+
+  // The body is a slice of the file, sent after the header.
+  int file_fd;
+  uint64_t file_size;
+  ASSERT_TRUE(FileReader("./test_files/hextext.txt").open_file(&file_fd,
+                                                               &file_size));
+  ASSERT_EQ(contents.size(), file_size);
+  HttpResponse frep;
+  frep.set_protocol("HTTP/1.1");
+  frep.set_response_code(200);
+  frep.set_message("OK");
+  frep.set_content_type("text/plain");
+  frep.set_body_file(file_fd, 100, 1000);
+  string expected = "HTTP/1.1 200 OK\r\nContent-type: text/plain\r\n";
+  expected += "Content-length: 1000\r\n\r\n" + contents.substr(100, 1000);
+  ASSERT_EQ(expected, frep.GenerateResponseString());
+
+  // The iovecs cover the status line and headers, but not the file.
+  string status_line, headers;
+  struct iovec iov[HttpResponse::kMaxIovecs];
+  ASSERT_EQ(2, frep.GenerateIovecs(&status_line, &headers, iov));
+  ASSERT_EQ("HTTP/1.1 200 OK\r\n", status_line);
+  ASSERT_EQ(expected.substr(0, expected.size() - 1000),
+            status_line + headers);
+
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+  HttpConnection hc(spair[0]);
+  ASSERT_TRUE(hc.write_response(frep));
+  string actual;
+  while (actual.size() < expected.size()) {
+    ASSERT_LT(0, wrapped_read(spair[1], &actual));
+  }
+  ASSERT_EQ(expected, actual);
+
+  // A body made of several windows of the file, with bytes in
+  // between, comes out in order.
+  ASSERT_TRUE(FileReader("./test_files/hextext.txt").open_file(&file_fd,
+                                                               &file_size));
+  HttpResponse mrep;
+  mrep.set_protocol("HTTP/1.1");
+  mrep.set_response_code(206);
+  mrep.set_message("Partial Content");
+  mrep.AddHeader("X-test", "yes");
+  vector<BodyFilePart> parts(3);
+  parts[0].prefix = "<";
+  parts[0].offset = 10;
+  parts[0].length = 5;
+  parts[1].prefix = "><";
+  parts[1].offset = 3000;
+  parts[1].length = 7;
+  parts[2].prefix = ">";
+  parts[2].offset = 0;
+  parts[2].length = 0;
+  mrep.set_body_file_parts(file_fd, parts);
+  string mexpected = "HTTP/1.1 206 Partial Content\r\nX-test: yes\r\n"
+                     "Content-length: 16\r\n\r\n<" +
+                     contents.substr(10, 5) + "><" +
+                     contents.substr(3000, 7) + ">";
+  ASSERT_EQ(mexpected, mrep.GenerateResponseString());
+  ASSERT_TRUE(hc.write_response(mrep));
+  actual.clear();
+  while (actual.size() < mexpected.size()) {
+    ASSERT_LT(0, wrapped_read(spair[1], &actual));
+  }
+  ASSERT_EQ(mexpected, actual);
+
+  // Queued file bodies stay in order with the responses around them.
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  rep.AppendToBody("hi!");
+  int flags = fcntl(spair[0], F_GETFL, 0);
+  ASSERT_EQ(0, fcntl(spair[0], F_SETFL, flags | O_NONBLOCK));
+  hc.queue_response(rep);
+  hc.queue_response(frep);
+  hc.queue_response(rep);
+  hc.queue_response(mrep);
+  expected = rep.GenerateResponseString() + expected +
+             rep.GenerateResponseString() + mexpected;
+  actual.clear();
+  while (hc.has_pending_output()) {
+    ASSERT_TRUE(hc.flush_pending());
+    ASSERT_LT(0, wrapped_read(spair[1], &actual));
+  }
+  while (actual.size() < expected.size()) {
+    ASSERT_LT(0, wrapped_read(spair[1], &actual));
+  }
+  ASSERT_EQ(expected, actual);
+  close(spair[1]);
+}
+
+TEST(Test_HttpConnection, QueuedOutput) {
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+  int flags = fcntl(spair[0], F_GETFL, 0);
+  ASSERT_EQ(0, fcntl(spair[0], F_SETFL, flags | O_NONBLOCK));
+  HttpConnection hc(spair[0]);
+
+  // More responses than go out in one writev(), big enough that the
+  // socket only takes part of them at a time, mixed in with a
+  // prebuilt one, all come out whole and in order.
+  HttpResponse rep;
+  rep.set_protocol("HTTP/1.1");
+  rep.set_response_code(200);
+  rep.set_message("OK");
+  HttpResponse prebuilt;
+  prebuilt.set_serialized(std::make_shared<const string>(
+      "HTTP/1.1 204 No Content\r\n\r\n"));
+  string expected;
+  for (int i = 0; i < 40; i++) {
+    rep.AppendToBody(string(1000 + i, 'a' + i % 26));
+    hc.queue_response(rep);
+    expected += rep.GenerateResponseString();
+    if (i % 3 == 0) {
+      hc.queue_response(prebuilt);
+      expected += prebuilt.GenerateResponseString();
+    }
+  }
+  string actual;
+  while (hc.has_pending_output()) {
+    ASSERT_TRUE(hc.flush_pending());
+    ASSERT_LT(0, wrapped_read(spair[1], &actual));
+  }
+  while (actual.size() < expected.size()) {
+    ASSERT_LT(0, wrapped_read(spair[1], &actual));
+  }
+  ASSERT_EQ(expected, actual);
+  close(spair[1]);
+}
+
 }  // namespace searchserver
@@ -10,10 +10,15 @@
  */
 
 #include <fcntl.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
 
 #include "./HttpUtils.h"
 #include "./FileReader.h"
@@ -22,6 +27,7 @@
 #include "./test_suite.h"
 
 using std::string;
+using std::vector;
 
 namespace searchserver {
 
@@ -119,6 +125,17 @@ TEST(Test_HttpUtils, decode_URI) {
   ASSERT_EQ(string("  blah blah"), decode_URI(spacey));
 }
 
+TEST(Test_HttpUtils, encode_URI) {
+  ASSERT_EQ(string(""), encode_URI(""));
+  ASSERT_EQ(string("Plain-text_1.0~"), encode_URI("Plain-text_1.0~"));
+  ASSERT_EQ(string("two+words"), encode_URI("two words"));
+  ASSERT_EQ(string("a%26b%3Dc%3F%25%2B"), encode_URI("a&b=c?%+"));
+
+  // Whatever gets encoded decodes back to itself.
+  string tricky("\"quoted\" <b>&amp; 100% + more");
+  ASSERT_EQ(tricky, decode_URI(encode_URI(tricky)));
+}
+
 TEST(Test_HttpUtils, URLParser) {
   // Test out URL parsing.
   string easy("/foo/bar");
@@ -154,4 +171,200 @@ TEST(Test_HttpUtils, URLParser) {
   ASSERT_EQ("baz", p.args()["bam"]);
 }
 
+TEST(Test_HttpUtils, parse_range_header) {
+  vector<ByteRange> r;
+  ASSERT_EQ(kRangeSatisfiable, parse_range_header("bytes=0-99", 1000, &r));
+  ASSERT_EQ(1U, r.size());
+  ASSERT_EQ(0U, r[0].first);
+  ASSERT_EQ(99U, r[0].last);
+
+  // Open-ended and suffix ranges, cut short at the end of the file.
+  ASSERT_EQ(kRangeSatisfiable,
+            parse_range_header("bytes=900-, -50, 990-2000", 1000, &r));
+  ASSERT_EQ(3U, r.size());
+  ASSERT_EQ(900U, r[0].first);
+  ASSERT_EQ(999U, r[0].last);
+  ASSERT_EQ(950U, r[1].first);
+  ASSERT_EQ(999U, r[1].last);
+  ASSERT_EQ(990U, r[2].first);
+  ASSERT_EQ(999U, r[2].last);
+  ASSERT_EQ(kRangeSatisfiable, parse_range_header("bytes=-5000", 1000, &r));
+  ASSERT_EQ(0U, r[0].first);
+  ASSERT_EQ(999U, r[0].last);
+
+  // Offsets past 4GB.
+  ASSERT_EQ(kRangeSatisfiable,
+            parse_range_header("bytes=5000000000-", 6000000000ULL, &r));
+  ASSERT_EQ(5000000000ULL, r[0].first);
+  ASSERT_EQ(5999999999ULL, r[0].last);
+
+  // Ranges that start past the end are dropped.
+  ASSERT_EQ(kRangeSatisfiable,
+            parse_range_header("bytes=1000-1001,5-6", 1000, &r));
+  ASSERT_EQ(1U, r.size());
+  ASSERT_EQ(kRangeUnsatisfiable,
+            parse_range_header("bytes=1000-1001", 1000, &r));
+  ASSERT_EQ(kRangeUnsatisfiable, parse_range_header("bytes=-0", 1000, &r));
+
+  // Anything malformed is ignored.
+  ASSERT_EQ(kRangeIgnored, parse_range_header("", 1000, &r));
+  ASSERT_EQ(kRangeIgnored, parse_range_header("lines=1-2", 1000, &r));
+  ASSERT_EQ(kRangeIgnored, parse_range_header("bytes=5-1", 1000, &r));
+  ASSERT_EQ(kRangeIgnored, parse_range_header("bytes=x-1", 1000, &r));
+  ASSERT_EQ(kRangeIgnored, parse_range_header("bytes=12", 1000, &r));
+  string many = "bytes=0-0";
+  for (int i = 0; i < 20; i++) {
+    many += ",0-0";
+  }
+  ASSERT_EQ(kRangeIgnored, parse_range_header(many, 1000, &r));
+}
+
+TEST(Test_HttpUtils, validators) {
+  // HTTP-dates round trip, whatever their case.
+  ASSERT_EQ("Sun, 06 Nov 1994 08:49:37 GMT", format_http_date(784111777));
+  time_t t;
+  ASSERT_TRUE(parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT", &t));
+  ASSERT_EQ(784111777, t);
+  ASSERT_TRUE(parse_http_date("sun, 06 nov 1994 08:49:37 gmt", &t));
+  ASSERT_EQ(784111777, t);
+  ASSERT_FALSE(parse_http_date("yesterday", &t));
+  ASSERT_FALSE(parse_http_date("Sun, 06 Nov 1994 08:49:37 PST", &t));
+
+  // The ETag changes along with the file.
+  struct stat st;
+  ASSERT_EQ(0, stat("./test_files/hextext.txt", &st));
+  string etag = make_etag(st);
+  ASSERT_EQ('"', etag.front());
+  ASSERT_EQ('"', etag.back());
+  ASSERT_EQ(boost::algorithm::to_lower_copy(etag), etag);
+  st.st_mtim.tv_nsec++;
+  ASSERT_NE(etag, make_etag(st));
+
+  ASSERT_TRUE(etag_matches(etag, etag));
+  ASSERT_TRUE(etag_matches("\"x\", w/" + etag, etag));
+  ASSERT_TRUE(etag_matches("*", etag));
+  ASSERT_FALSE(etag_matches("\"x\", \"y\"", etag));
+}
+
+TEST(Test_HttpUtils, find_header_end) {
+  ASSERT_EQ(string::npos, find_header_end("", 0, 0));
+  string req = "GET / HTTP/1.1\r\nHost: a\r\n\r\n";
+  ASSERT_EQ(req.size() - 4, find_header_end(req.data(), req.size(), 0));
+
+  // A terminator at every position, so that it lands on either side of
+  // and across the 16-byte chunks the search looks at.
+  for (size_t at = 0; at < 70; at++) {
+    string buf(at, 'x');
+    buf += "\r\n\r\nGET";
+    buf += string(40, '\n');
+    ASSERT_EQ(at, find_header_end(buf.data(), buf.size(), 0));
+    ASSERT_EQ(at, find_header_end(buf.data(), buf.size(), at));
+    ASSERT_EQ(string::npos, find_header_end(buf.data(), buf.size(), at + 1));
+  }
+
+  // Near misses don't count.
+  string misses = "a\n\n\r\n\nb\r\r\n\nc\r\n\rd";
+  ASSERT_EQ(string::npos,
+            find_header_end(misses.data(), misses.size(), 0));
+
+  // Resuming at len - 3 finds a terminator split across two reads.
+  string trickle = "GET / HTTP/1.1\r\nHost: a\r\n\r";
+  size_t from = trickle.size() - 3;
+  ASSERT_EQ(string::npos,
+            find_header_end(trickle.data(), trickle.size(), 0));
+  trickle += "\n";
+  ASSERT_EQ(from, find_header_end(trickle.data(), trickle.size(), from));
+}
+
+TEST(Test_HttpUtils, io_uring_backend) {
+  // Whichever backend we end up with, wrapped_read(), wrapped_write()
+  // and wrapped_write_read() have to behave the same.
+  IoBackend backend = set_io_backend(kIoUringIo);
+  ASSERT_TRUE(backend == kIoUringIo || backend == kBlockingIo);
+  ASSERT_EQ(backend, io_backend());
+
+  int spair[2] = {-1, -1};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+
+  string ping = "ping";
+  string pong = "pong!";
+  string got;
+  ASSERT_EQ(static_cast<int>(pong.size()), wrapped_write(spair[1], pong));
+  ASSERT_EQ(static_cast<int>(pong.size()),
+            wrapped_write_read(spair[0], ping, &got));
+  ASSERT_EQ(pong, got);
+
+  got.clear();
+  ASSERT_EQ(static_cast<int>(ping.size()), wrapped_read(spair[1], &got));
+  ASSERT_EQ(ping, got);
+
+  // A gathered write sends the buffers back to back, even when it is
+  // too big for the socket buffer and goes out in pieces.
+  string big(1 << 20, 'x');
+  struct iovec iov[3];
+  iov[0].iov_base = const_cast<char *>(ping.data());
+  iov[0].iov_len = ping.size();
+  iov[1].iov_base = const_cast<char *>(big.data());
+  iov[1].iov_len = big.size();
+  iov[2].iov_base = const_cast<char *>(pong.data());
+  iov[2].iov_len = pong.size();
+  string expected = ping + big + pong;
+  std::thread reader([&]() {
+    got.clear();
+    while (got.size() < expected.size()) {
+      if (wrapped_read(spair[1], &got) <= 0) {
+        break;
+      }
+    }
+  });
+  ASSERT_EQ(static_cast<int64_t>(expected.size()),
+            wrapped_writev(spair[0], iov, 3));
+  reader.join();
+  ASSERT_EQ(expected, got);
+
+  // So do more buffers than get written out at once.
+  struct iovec many[20];
+  expected.clear();
+  for (int i = 0; i < 20; i++) {
+    many[i] = iov[i % 3];
+    expected += (i % 3 == 0) ? ping : (i % 3 == 1) ? big : pong;
+  }
+  std::thread many_reader([&]() {
+    got.clear();
+    while (got.size() < expected.size()) {
+      if (wrapped_read(spair[1], &got) <= 0) {
+        break;
+      }
+    }
+  });
+  ASSERT_EQ(static_cast<int64_t>(expected.size()),
+            wrapped_writev(spair[0], many, 20));
+  many_reader.join();
+  ASSERT_EQ(expected, got);
+
+  // The linked read sees EOF once the other end stops writing.
+  ASSERT_EQ(0, shutdown(spair[1], SHUT_WR));
+  got.clear();
+  ASSERT_EQ(0, wrapped_write_read(spair[0], ping, &got));
+  ASSERT_EQ("", got);
+  close(spair[0]);
+  close(spair[1]);
+
+  // Socket timeouts hold under either backend, for plain and linked
+  // reads and for writes that the peer never drains.
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, spair));
+  ASSERT_TRUE(set_socket_timeouts(spair[0], 50, 50));
+  ASSERT_EQ(-1, wrapped_read(spair[0], &got));
+  ASSERT_EQ(EAGAIN, errno);
+  ASSERT_EQ(-1, wrapped_write_read(spair[0], ping, &got));
+  ASSERT_EQ(EAGAIN, errno);
+  string huge(8 << 20, 'x');
+  ASSERT_GT(static_cast<int>(huge.size()), wrapped_write(spair[0], huge));
+  ASSERT_EQ(static_cast<int>(pong.size()), wrapped_write(spair[1], pong));
+  close(spair[0]);
+  close(spair[1]);
+
+  ASSERT_EQ(kBlockingIo, set_io_backend(kBlockingIo));
+}
+
 }  // namespace searchserver
@@ -0,0 +1,195 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "./PostingList.h"
+#include "./WordIndex.h"
+#include "./test_suite.h"
+
+using std::vector;
+
+namespace searchserver {
+
+// Returns "n" postings with random gaps of up to "max_gap" and random
+// counts of up to "max_count".
+static vector<Posting> RandomPostings(size_t n, uint32_t max_gap,
+                                      uint32_t max_count, uint32_t seed) {
+  std::mt19937 rng(seed);
+  vector<Posting> postings;
+  DocID doc_id = rng() % max_gap;
+  for (size_t i = 0; i < n; i++) {
+    postings.push_back(
+        Posting{doc_id, static_cast<uint32_t>(1 + rng() % max_count)});
+    doc_id += 1 + rng() % max_gap;
+  }
+  return postings;
+}
+
+static void ExpectSame(const vector<Posting>& expected,
+                       const vector<Posting>& actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    ASSERT_EQ(expected[i].doc_id, actual[i].doc_id) << i;
+    ASSERT_EQ(expected[i].count, actual[i].count) << i;
+  }
+}
+
+TEST(Test_PostingList, RoundTrip) {
+  // Empty, partial blocks only, exact blocks, and a partial block
+  // after full ones, with gaps and counts of every width.
+  for (size_t n : {0, 1, 5, 127, 128, 129, 256, 1000}) {
+    for (uint32_t max_gap : {1u, 3u, 1000u, 1u << 20}) {
+      vector<Posting> postings = RandomPostings(n, max_gap, 50, n + max_gap);
+      PostingList list(postings);
+      ASSERT_EQ(n, list.size());
+      ASSERT_EQ((n + PostingList::kBlockSize - 1) / PostingList::kBlockSize,
+                list.num_blocks());
+      vector<Posting> decoded;
+      list.decode(&decoded);
+      ExpectSame(postings, decoded);
+      for (size_t b = 0; b < list.num_blocks(); b++) {
+        size_t last = std::min(n, (b + 1) * PostingList::kBlockSize) - 1;
+        ASSERT_EQ(postings[last].doc_id, list.block_last(b));
+      }
+    }
+  }
+
+  // The extremes: DocID 0, 32-bit gaps and counts, and a block of
+  // consecutive DocIDs that all have a count of 1, which packs into
+  // nothing at all.
+  vector<Posting> postings;
+  for (uint32_t i = 0; i < PostingList::kBlockSize; i++) {
+    postings.push_back(Posting{i, 1});
+  }
+  postings.push_back(Posting{UINT32_MAX - 1, UINT32_MAX});
+  postings.push_back(Posting{UINT32_MAX, 7});
+  PostingList list(postings);
+  vector<Posting> decoded;
+  list.decode(&decoded);
+  ExpectSame(postings, decoded);
+
+  vector<Posting> wide;
+  for (uint32_t i = 0; i < PostingList::kBlockSize - 1; i++) {
+    wide.push_back(Posting{i, i % 2 == 0 ? UINT32_MAX : 1});
+  }
+  wide.push_back(Posting{UINT32_MAX, 1});
+  PostingList wide_list(wide);
+  wide_list.decode(&decoded);
+  ExpectSame(wide, decoded);
+
+  // Dense lists are a lot smaller than the postings themselves.
+  vector<Posting> dense = RandomPostings(100000, 8, 4, 1);
+  ASSERT_LT(PostingList(dense).memory_bytes() * 4,
+            dense.size() * sizeof(Posting));
+}
+
+TEST(Test_PostingList, Cursor) {
+  vector<Posting> postings = RandomPostings(1000, 100, 10, 7);
+  PostingList list(postings);
+
+  // Walking a cursor gives every posting, whatever it walks.
+  PostingCursor plain(postings);
+  PostingCursor packed(list);
+  ASSERT_EQ(postings.size(), plain.size());
+  ASSERT_EQ(postings.size(), packed.size());
+  for (const Posting& p : postings) {
+    ASSERT_FALSE(plain.done());
+    ASSERT_FALSE(packed.done());
+    ASSERT_EQ(p.doc_id, plain->doc_id);
+    ASSERT_EQ(p.doc_id, packed->doc_id);
+    ASSERT_EQ(p.count, packed->count);
+    plain.next();
+    packed.next();
+  }
+  ASSERT_TRUE(plain.done());
+  ASSERT_TRUE(packed.done());
+
+  // seek() lands on the first DocID at or after the target, within a
+  // block or blocks ahead, and never moves backwards.
+  PostingCursor a(postings), b(list);
+  size_t expected = 0;
+  for (DocID target = 0; target < postings.back().doc_id + 10;
+       target += 1 + target % 300) {
+    while (expected < postings.size() &&
+           postings[expected].doc_id < target) {
+      expected++;
+    }
+    a.seek(target);
+    b.seek(target);
+    if (expected == postings.size()) {
+      ASSERT_TRUE(a.done());
+      ASSERT_TRUE(b.done());
+      break;
+    }
+    ASSERT_EQ(postings[expected].doc_id, a->doc_id);
+    ASSERT_EQ(postings[expected].doc_id, b->doc_id);
+    a.seek(0);
+    b.seek(0);
+    ASSERT_EQ(postings[expected].doc_id, b->doc_id);
+  }
+
+  PostingList empty;
+  PostingCursor none(empty);
+  ASSERT_TRUE(none.done());
+  none.seek(5);
+  ASSERT_TRUE(none.done());
+}
+
+TEST(Test_PostingList, CompactedIndex) {
+  WordIndex index;
+  for (DocID doc = 0; doc < 1000; doc++) {
+    DocID id = index.add_document("doc" + std::to_string(doc));
+    index.record("every", id);
+    if (doc % 2 == 0) {
+      index.record("even", id);
+      index.record("even", id);
+    }
+    if (doc % 3 == 0) {
+      index.record("third", id);
+    }
+  }
+  auto every = index.lookup_word("every");
+  auto query = index.lookup_query({"even", "third", "every"});
+  size_t before = index.postings_bytes();
+
+  // Compacting shrinks the index without changing any answer.
+  index.compact();
+  ASSERT_EQ(3U, index.num_words());
+  ASSERT_LT(index.postings_bytes() * 4, before);
+  auto compact_every = index.lookup_word("every");
+  ASSERT_EQ(every.size(), compact_every.size());
+  auto compact_query = index.lookup_query({"even", "third", "every"});
+  ASSERT_EQ(167U, compact_query.size());
+  ASSERT_EQ(query.size(), compact_query.size());
+  for (auto it = query.begin(), jt = compact_query.begin();
+       it != query.end(); it++, jt++) {
+    ASSERT_EQ(it->doc_id, jt->doc_id);
+    ASSERT_EQ(4, jt->rank);
+  }
+
+  // Words can still be recorded afterwards, and compacted again.
+  index.record("third", 1);
+  index.record("brand", 2);
+  ASSERT_EQ(4U, index.num_words());
+  ASSERT_EQ(335U, index.lookup_word("third").size());
+  index.compact();
+  ASSERT_EQ(4U, index.num_words());
+  ASSERT_EQ(335U, index.lookup_word("third").size());
+  ASSERT_EQ(1U, index.lookup_query({"brand", "every", "even"}).size());
+}
+
+}  // namespace searchserver
@@ -9,6 +9,10 @@
  * author.
  */
 
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <iostream>
@@ -134,4 +138,72 @@ TEST(Test_ServerSocket, Basic) {
   ProjectEnvironment::AddPoints(15);
 }
 
+TEST(Test_ServerSocket, ReusePort) {
+  // Several SO_REUSEPORT sockets can listen on the same port...
+  uint16_t port = rand_port();
+  ServerSocket ss1(port), ss2(port), ss3(port);
+  ss1.set_reuse_port(true);
+  ss2.set_reuse_port(true);
+  int fd1, fd2, fd3;
+  ASSERT_TRUE(ss1.bind_and_listen(AF_INET6, &fd1));
+  ASSERT_TRUE(ss2.bind_and_listen(AF_INET6, &fd2));
+  ASSERT_NE(fd1, fd2);
+
+  // ...but a socket without it can't join them.
+  ASSERT_FALSE(ss3.bind_and_listen(AF_INET6, &fd3));
+
+  // Connections to the port get accepted by one of the listeners.
+  int cfd = -1;
+  ASSERT_TRUE(connect_to_server("127.0.0.1", port, &cfd));
+  struct pollfd pfds[2] = {{fd1, POLLIN, 0}, {fd2, POLLIN, 0}};
+  ASSERT_EQ(1, poll(pfds, 2, 5000));
+  ServerSocket *ready = (pfds[0].revents & POLLIN) ? &ss1 : &ss2;
+  int accept_fd;
+  uint16_t cport;
+  string caddr, cdns, saddr, sdns;
+  ASSERT_TRUE(ready->accept_client(&accept_fd, &caddr, &cport,
+                                   &cdns, &saddr, &sdns));
+  close(accept_fd);
+  close(cfd);
+}
+
+TEST(Test_ServerSocket, SocketOptions) {
+  uint16_t port = rand_port();
+  ServerSocket ss(port);
+  SocketOptions options;
+  options.no_delay = true;
+  options.defer_accept_secs = 5;
+  options.rcvbuf_bytes = 64 * 1024;
+  options.backlog = 16;
+  ss.set_socket_options(options);
+  int listen_fd;
+  ASSERT_TRUE(ss.bind_and_listen(AF_INET6, &listen_fd));
+  ASSERT_NE(0, fcntl(listen_fd, F_GETFD) & FD_CLOEXEC);
+
+  // With TCP_DEFER_ACCEPT, a connection isn't ready to accept until
+  // the client sends something.
+  int cfd = -1;
+  ASSERT_TRUE(connect_to_server("127.0.0.1", port, &cfd));
+  struct pollfd pfd = {listen_fd, POLLIN, 0};
+  ASSERT_EQ(0, poll(&pfd, 1, 200));
+  ASSERT_EQ(1, write(cfd, "x", 1));
+  ASSERT_EQ(1, poll(&pfd, 1, 5000));
+
+  // The accepted socket is close-on-exec and inherits the tuning.
+  int accept_fd;
+  uint16_t cport;
+  string caddr, saddr;
+  ASSERT_TRUE(ss.accept_client(&accept_fd, &caddr, &cport, &saddr));
+  ASSERT_NE(0, fcntl(accept_fd, F_GETFD) & FD_CLOEXEC);
+  int value;
+  socklen_t len = sizeof(value);
+  ASSERT_EQ(0, getsockopt(accept_fd, IPPROTO_TCP, TCP_NODELAY, &value, &len));
+  ASSERT_NE(0, value);
+  len = sizeof(value);
+  ASSERT_EQ(0, getsockopt(accept_fd, SOL_SOCKET, SO_RCVBUF, &value, &len));
+  ASSERT_LE(options.rcvbuf_bytes, value);
+  close(accept_fd);
+  close(cfd);
+}
+
 }  // namespace searchserver
@@ -0,0 +1,137 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "./FileReader.h"
+#include "./HttpUtils.h"
+#include "./StaticFileCache.h"
+#include "./test_suite.h"
+
+using std::shared_ptr;
+using std::string;
+
+namespace searchserver {
+
+// Builds a 200 response whose body is the file "file_name", and
+// returns what fstat() said about the file through "st".
+static HttpResponse FileResponse(const string &file_name, struct stat *st) {
+  HttpResponse rep;
+  int fd;
+  if (FileReader(file_name).open_file(&fd, st)) {
+    rep.set_protocol("HTTP/1.1");
+    rep.set_response_code(200);
+    rep.set_message("OK");
+    rep.set_content_type("text/plain");
+    rep.set_body_file(fd, 0, st->st_size);
+  }
+  return rep;
+}
+
+TEST(Test_StaticFileCache, Basic) {
+  StaticFileCache cache(1 << 20, 1 << 20);
+  StaticFileCache::CachedFile got;
+  struct stat st;
+  ASSERT_FALSE(cache.lookup("/static/test_files/hextext.txt", &got));
+
+  // Inserting hands back the whole response, which then comes out
+  // of the cache.
+  HttpResponse rep = FileResponse("./test_files/hextext.txt", &st);
+  shared_ptr<const string> bytes =
+    cache.insert("/static/test_files/hextext.txt",
+                 "./test_files/hextext.txt", st, rep);
+  ASSERT_NE(nullptr, bytes);
+  ASSERT_EQ(rep.GenerateResponseString(), *bytes);
+  ASSERT_TRUE(cache.lookup("/static/test_files/hextext.txt", &got));
+  ASSERT_EQ(*bytes, *got.response);
+  ASSERT_EQ(make_etag(st), got.etag);
+  ASSERT_EQ(st.st_mtime, got.last_modified);
+  ASSERT_EQ(1U, cache.size());
+  ASSERT_EQ(bytes->size(), cache.bytes());
+
+  // A prebuilt response is written out as is.
+  HttpResponse prebuilt;
+  prebuilt.set_serialized(got.response);
+  ASSERT_EQ(*bytes, prebuilt.GenerateResponseString());
+
+  // So is the response the bytes were built from, without its file
+  // going out again behind them.
+  HttpResponse inserted = rep;
+  inserted.set_serialized(bytes);
+  ASSERT_FALSE(inserted.has_body_file());
+  ASSERT_EQ(*bytes, inserted.GenerateResponseString());
+
+  // Responses that are too big are never cached.
+  StaticFileCache tiny(1 << 20, 100);
+  ASSERT_EQ(nullptr, tiny.insert("/static/test_files/hextext.txt",
+                                 "./test_files/hextext.txt", st, rep));
+  ASSERT_FALSE(tiny.lookup("/static/test_files/hextext.txt", &got));
+}
+
+TEST(Test_StaticFileCache, Eviction) {
+  // There is room for two copies of the gif, so caching a third path
+  // drops the least recently used one.
+  struct stat st;
+  HttpResponse rep = FileResponse("./test_files/transparent.gif", &st);
+  size_t size = rep.GenerateResponseString().size();
+  StaticFileCache cache(2 * size, 2 * size);
+  StaticFileCache::CachedFile got;
+  ASSERT_NE(nullptr, cache.insert("/a", "./test_files/transparent.gif", st, rep));
+  ASSERT_NE(nullptr, cache.insert("/b", "./test_files/transparent.gif", st, rep));
+  ASSERT_TRUE(cache.lookup("/a", &got));
+  ASSERT_NE(nullptr, cache.insert("/c", "./test_files/transparent.gif", st, rep));
+  ASSERT_EQ(2U, cache.size());
+  ASSERT_EQ(2 * size, cache.bytes());
+  ASSERT_TRUE(cache.lookup("/a", &got));
+  ASSERT_FALSE(cache.lookup("/b", &got));
+  ASSERT_TRUE(cache.lookup("/c", &got));
+
+  // A zero budget turns the cache off.
+  StaticFileCache off(0, 1 << 20);
+  ASSERT_EQ(nullptr, off.insert("/a", "./test_files/transparent.gif", st, rep));
+}
+
+TEST(Test_StaticFileCache, Invalidation) {
+  char file_name[] = "/tmp/test_staticfilecache.XXXXXX";
+  int fd = mkstemp(file_name);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(5, write(fd, "hello", 5));
+  close(fd);
+
+  StaticFileCache cache(1 << 20, 1 << 20);
+  StaticFileCache::CachedFile got;
+  struct stat st;
+  ASSERT_NE(nullptr, cache.insert("/f", file_name, st,
+                                 FileResponse(file_name, &st)));
+  ASSERT_TRUE(cache.lookup("/f", &got));
+
+  // Once the file changes on disk, the cached response is dropped.
+  fd = open(file_name, O_WRONLY | O_APPEND);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(1, write(fd, "!", 1));
+  close(fd);
+  ASSERT_FALSE(cache.lookup("/f", &got));
+  ASSERT_EQ(0U, cache.size());
+  ASSERT_EQ(0U, cache.bytes());
+
+  // So is a file that has gone away.
+  ASSERT_NE(nullptr, cache.insert("/f", file_name, st,
+                                 FileResponse(file_name, &st)));
+  unlink(file_name);
+  ASSERT_FALSE(cache.lookup("/f", &got));
+}
+
+}  // namespace searchserver
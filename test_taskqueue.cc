@@ -0,0 +1,221 @@
+/*
+ * Copyright ©2022 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 595 for use solely during Spring Semester 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "./TaskQueue.h"
+#include "./test_suite.h"
+
+namespace searchserver {
+
+TEST(Test_TaskQueue, Basic) {
+  // The capacity gets rounded up to a power of two.
+  TaskQueue q(5);
+  ASSERT_EQ(8U, q.capacity());
+  ASSERT_EQ(nullptr, q.pop(nullptr));
+  ASSERT_EQ(-1, q.oldest_pushed_ns());
+
+  // Items come out in the order they went in, with their stamps, and
+  // the queue keeps working as it wraps around the ring.
+  intptr_t next_in = 1, next_out = 1;
+  for (int lap = 0; lap < 3; lap++) {
+    while (q.push(reinterpret_cast<void *>(next_in), next_in * 10)) {
+      next_in++;
+    }
+    ASSERT_EQ(next_out + 8, next_in);
+    ASSERT_EQ(next_out * 10, q.oldest_pushed_ns());
+    for (int i = 0; i < 5; i++) {
+      int64_t pushed_ns;
+      ASSERT_EQ(reinterpret_cast<void *>(next_out), q.pop(&pushed_ns));
+      ASSERT_EQ(next_out * 10, pushed_ns);
+      next_out++;
+    }
+  }
+  while (next_out < next_in) {
+    ASSERT_EQ(reinterpret_cast<void *>(next_out), q.pop(nullptr));
+    next_out++;
+  }
+  ASSERT_EQ(nullptr, q.pop(nullptr));
+  ASSERT_EQ(-1, q.oldest_pushed_ns());
+}
+
+// Each producer pushes kItemsPerProducer distinct items; consumers
+// pop until they have collectively seen all of them.
+static const int kProducers = 4;
+static const int kConsumers = 4;
+static const intptr_t kItemsPerProducer = 100000;
+
+struct StressState {
+  TaskQueue *q;
+  int id;
+  std::vector<int> *seen;
+  std::atomic<intptr_t> *num_popped;
+};
+
+static void *StressProducer(void *arg) {
+  StressState *st = static_cast<StressState *>(arg);
+  for (intptr_t i = 0; i < kItemsPerProducer; i++) {
+    intptr_t item = st->id * kItemsPerProducer + i + 1;
+    while (!st->q->push(reinterpret_cast<void *>(item), 0)) {
+      sched_yield();
+    }
+  }
+  return nullptr;
+}
+
+static void *StressConsumer(void *arg) {
+  StressState *st = static_cast<StressState *>(arg);
+  while (st->num_popped->load() < kProducers * kItemsPerProducer) {
+    void *item = st->q->pop(nullptr);
+    if (item == nullptr) {
+      sched_yield();
+      continue;
+    }
+    (*st->seen)[reinterpret_cast<intptr_t>(item) - 1]++;
+    (*st->num_popped)++;
+  }
+  return nullptr;
+}
+
+TEST(Test_TaskQueue, ManyProducersAndConsumers) {
+  // A small ring, so that producers keep finding it full.
+  TaskQueue q(64);
+  std::vector<std::vector<int>> seen(
+    kConsumers, std::vector<int>(kProducers * kItemsPerProducer, 0));
+  std::atomic<intptr_t> num_popped(0);
+  pthread_t threads[kProducers + kConsumers];
+  StressState states[kProducers + kConsumers];
+  for (int i = 0; i < kProducers + kConsumers; i++) {
+    states[i].q = &q;
+    states[i].id = i;
+    states[i].seen = &seen[i % kConsumers];
+    states[i].num_popped = &num_popped;
+    pthread_create(&threads[i], nullptr,
+                   (i < kProducers) ? &StressProducer : &StressConsumer,
+                   &states[i]);
+  }
+  for (int i = 0; i < kProducers + kConsumers; i++) {
+    pthread_join(threads[i], nullptr);
+  }
+
+  // Every item came out exactly once.
+  ASSERT_EQ(kProducers * kItemsPerProducer, num_popped.load());
+  for (intptr_t item = 0; item < kProducers * kItemsPerProducer; item++) {
+    int count = 0;
+    for (int c = 0; c < kConsumers; c++) {
+      count += seen[c][item];
+    }
+    ASSERT_EQ(1, count) << "item " << item + 1;
+  }
+  ASSERT_EQ(nullptr, q.pop(nullptr));
+}
+
+TEST(Test_TaskQueue, DequeBasic) {
+  TaskDeque d(4);
+  ASSERT_TRUE(d.empty());
+  ASSERT_EQ(nullptr, d.pop());
+  ASSERT_EQ(nullptr, d.steal());
+
+  // The owner gets the newest item, thieves the oldest.
+  for (intptr_t i = 1; i <= 4; i++) {
+    ASSERT_TRUE(d.push(reinterpret_cast<void *>(i)));
+  }
+  ASSERT_FALSE(d.push(reinterpret_cast<void *>(5)));
+  ASSERT_EQ(reinterpret_cast<void *>(4), d.pop());
+  ASSERT_EQ(reinterpret_cast<void *>(1), d.steal());
+  ASSERT_EQ(reinterpret_cast<void *>(3), d.pop());
+  ASSERT_EQ(reinterpret_cast<void *>(2), d.steal());
+  ASSERT_TRUE(d.empty());
+
+  // Space freed at either end can be reused.
+  for (intptr_t i = 6; i <= 9; i++) {
+    ASSERT_TRUE(d.push(reinterpret_cast<void *>(i)));
+  }
+  ASSERT_EQ(reinterpret_cast<void *>(6), d.steal());
+  ASSERT_EQ(reinterpret_cast<void *>(9), d.pop());
+  ASSERT_EQ(reinterpret_cast<void *>(8), d.pop());
+  ASSERT_EQ(reinterpret_cast<void *>(7), d.pop());
+  ASSERT_EQ(nullptr, d.pop());
+}
+
+// The owner pushes kDequeItems items, popping some of them itself,
+// while kThieves threads steal the rest.
+static const int kThieves = 3;
+static const intptr_t kDequeItems = 200000;
+
+struct ThiefState {
+  TaskDeque *d;
+  std::vector<int> seen;
+  std::atomic<bool> *owner_done;
+};
+
+static void *ThiefFn(void *arg) {
+  ThiefState *st = static_cast<ThiefState *>(arg);
+  while (1) {
+    bool done = st->owner_done->load();
+    void *item = st->d->steal();
+    if (item != nullptr) {
+      st->seen[reinterpret_cast<intptr_t>(item) - 1]++;
+    } else if (done && st->d->empty()) {
+      break;
+    }
+  }
+  return nullptr;
+}
+
+TEST(Test_TaskQueue, DequeStealing) {
+  TaskDeque d(256);
+  std::atomic<bool> owner_done(false);
+  pthread_t threads[kThieves];
+  ThiefState states[kThieves];
+  for (int i = 0; i < kThieves; i++) {
+    states[i].d = &d;
+    states[i].seen.assign(kDequeItems, 0);
+    states[i].owner_done = &owner_done;
+    pthread_create(&threads[i], nullptr, &ThiefFn, &states[i]);
+  }
+
+  std::vector<int> seen(kDequeItems, 0);
+  intptr_t next = 1;
+  while (next <= kDequeItems) {
+    if (!d.push(reinterpret_cast<void *>(next))) {
+      sched_yield();
+      continue;
+    }
+    next++;
+    if (next % 3 == 0) {
+      void *item = d.pop();
+      if (item != nullptr) {
+        seen[reinterpret_cast<intptr_t>(item) - 1]++;
+      }
+    }
+  }
+  owner_done = true;
+  for (int i = 0; i < kThieves; i++) {
+    pthread_join(threads[i], nullptr);
+  }
+
+  // Every item was taken exactly once, by the owner or by a thief.
+  for (intptr_t item = 0; item < kDequeItems; item++) {
+    int count = seen[item];
+    for (int i = 0; i < kThieves; i++) {
+      count += states[i].seen[item];
+    }
+    ASSERT_EQ(1, count) << "item " << item + 1;
+  }
+}
+
+}  // namespace searchserver
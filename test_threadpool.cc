@@ -9,7 +9,17 @@
  * author.
  */
 
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "./ThreadPool.h"
@@ -59,4 +69,429 @@ TEST(Test_ThreadPool, Basic) {
   ASSERT_EQ((uint32_t) 300, workcount);
 }
 
+// A task that holds its worker for 0.2s.
+static void SlowTaskFn(ThreadPool::Task *t) {
+  usleep(200000);
+  delete t;
+}
+
+TEST(Test_ThreadPool, AdmissionControl) {
+  ThreadPool *tp = new ThreadPool(1);
+  tp->set_admission_control(20, 100);
+  ASSERT_FALSE(tp->overloaded());
+
+  // With the only worker busy, the queue stops draining.  A short
+  // wait is tolerated, but one that lasts a whole interval isn't.
+  for (int i = 0; i < 4; i++) {
+    tp->dispatch(new ThreadPool::Task(SlowTaskFn));
+  }
+  usleep(50000);
+  ASSERT_FALSE(tp->overloaded());
+  usleep(150000);
+  ASSERT_TRUE(tp->overloaded());
+
+  // Once the queue has drained, tasks get through quickly again.
+  usleep(800000);
+  tp->dispatch(new ThreadPool::Task(SlowTaskFn));
+  usleep(50000);
+  ASSERT_FALSE(tp->overloaded());
+
+  // Admission control is off unless asked for.
+  tp->set_admission_control(0, 0);
+  for (int i = 0; i < 4; i++) {
+    tp->dispatch(new ThreadPool::Task(SlowTaskFn));
+  }
+  usleep(300000);
+  ASSERT_FALSE(tp->overloaded());
+  delete tp;
+}
+
+static std::atomic<int> num_ordered;
+static std::atomic<bool> out_of_order;
+
+// A task that records whether tasks run in the order dispatched.
+class OrderedTask : public ThreadPool::Task {
+ public:
+  OrderedTask(ThreadPool::thread_task_fn f, int seq)
+    : ThreadPool::Task(f), seq(seq) { }
+  int seq;
+};
+
+static void OrderedTaskFn(ThreadPool::Task *t) {
+  OrderedTask *task = static_cast<OrderedTask *>(t);
+  if (task->seq == 0) {
+    usleep(100000);  // let the others pile up behind us
+  }
+  if (num_ordered.fetch_add(1) != task->seq) {
+    out_of_order = true;
+  }
+  delete task;
+}
+
+TEST(Test_ThreadPool, Overflow) {
+  // With one worker held up, more tasks are dispatched than the queue
+  // holds.  None are lost, and they still run in order.
+  num_ordered = 0;
+  out_of_order = false;
+  ThreadPool *tp = new ThreadPool(1, 8);
+  for (int i = 0; i < 100; i++) {
+    tp->dispatch(new OrderedTask(OrderedTaskFn, i));
+  }
+  for (int i = 0; i < 50 && num_ordered < 100; i++) {
+    usleep(20000);
+  }
+  ASSERT_EQ(100, num_ordered.load());
+  ASSERT_FALSE(out_of_order.load());
+
+  // The queue keeps working once the overflow has drained.
+  tp->dispatch(new OrderedTask(OrderedTaskFn, 100));
+  for (int i = 0; i < 50 && num_ordered < 101; i++) {
+    usleep(20000);
+  }
+  ASSERT_EQ(101, num_ordered.load());
+  ASSERT_FALSE(out_of_order.load());
+  delete tp;
+}
+
+// A task that, until "depth" reaches 0, dispatches two children from
+// the worker running it.
+class FanOutTask : public ThreadPool::Task {
+ public:
+  FanOutTask(ThreadPool::thread_task_fn f, ThreadPool *tp, int depth)
+    : ThreadPool::Task(f), tp(tp), depth(depth) { }
+  ThreadPool *tp;
+  int depth;
+};
+
+static std::atomic<int> num_fanned_out;
+
+static void FanOutTaskFn(ThreadPool::Task *t) {
+  FanOutTask *task = static_cast<FanOutTask *>(t);
+  if (task->depth > 0) {
+    for (int i = 0; i < 2; i++) {
+      task->tp->dispatch(new FanOutTask(FanOutTaskFn, task->tp,
+                                        task->depth - 1));
+    }
+  }
+  num_fanned_out++;
+  delete task;
+}
+
+TEST(Test_ThreadPool, WorkStealing) {
+  // A tree of tasks that spawn more tasks all gets run, both from the
+  // workers' own deques and from the ones they steal from.
+  num_fanned_out = 0;
+  ThreadPool *tp = new ThreadPool(4);
+  tp->set_work_stealing(true);
+  tp->dispatch(new FanOutTask(FanOutTaskFn, tp, 14));
+  const int kTotal = (1 << 15) - 1;
+  for (int i = 0; i < 500 && num_fanned_out < kTotal; i++) {
+    usleep(10000);
+  }
+  ASSERT_EQ(kTotal, num_fanned_out.load());
+
+  // Tasks still queued when the pool goes away are run, wherever they
+  // were queued.
+  num_fanned_out = 0;
+  tp->dispatch(new FanOutTask(FanOutTaskFn, tp, 10));
+  delete tp;
+  ASSERT_EQ((1 << 11) - 1, num_fanned_out.load());
+}
+
+static std::atomic<int> num_blocked;
+static std::atomic<bool> release_blocked;
+
+// A task that holds its worker until release_blocked is set.
+static void BlockedTaskFn(ThreadPool::Task *t) {
+  num_blocked++;
+  while (!release_blocked) {
+    usleep(1000);
+  }
+  num_blocked--;
+  delete t;
+}
+
+TEST(Test_ThreadPool, Elastic) {
+  // Starting up doesn't take long.
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ThreadPool *tp = new ThreadPool(2, 6, 200);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  ASSERT_LT(end.tv_sec - start.tv_sec, 1);
+  ASSERT_EQ(2U, tp->num_threads());
+
+  // With every worker busy, each new task gets a new worker, up to
+  // the maximum.
+  num_blocked = 0;
+  release_blocked = false;
+  for (int i = 0; i < 8; i++) {
+    tp->dispatch(new ThreadPool::Task(BlockedTaskFn));
+  }
+  for (int i = 0; i < 100 && num_blocked < 6; i++) {
+    usleep(10000);
+  }
+  ASSERT_EQ(6, num_blocked.load());
+  ASSERT_EQ(6U, tp->num_threads());
+
+  // Once the work is done, the extra workers exit after sitting idle
+  // for the timeout, but the pool keeps its minimum.
+  release_blocked = true;
+  for (int i = 0; i < 200 && tp->num_threads() > 2; i++) {
+    usleep(10000);
+  }
+  ASSERT_EQ(0, num_blocked.load());
+  ASSERT_EQ(2U, tp->num_threads());
+
+  // It grows again when needed.
+  release_blocked = false;
+  for (int i = 0; i < 4; i++) {
+    tp->dispatch(new ThreadPool::Task(BlockedTaskFn));
+  }
+  for (int i = 0; i < 100 && num_blocked < 4; i++) {
+    usleep(10000);
+  }
+  ASSERT_EQ(4, num_blocked.load());
+  release_blocked = true;
+  delete tp;
+
+  // A task dispatched just as the last idle worker times out is still
+  // run, by that worker or a new one, rather than left queued with no
+  // worker to run it.  Threads spinning alongside keep a worker whose
+  // wait has timed out from running straight away, which widens the
+  // window for the race.
+  tp = new ThreadPool(0, 1, 1);
+  std::atomic<bool> stop_spinning(false);
+  std::vector<std::thread> spinners;
+  for (int i = 0; i < 2; i++) {
+    spinners.emplace_back([&stop_spinning] {
+      while (!stop_spinning) { }
+    });
+  }
+  std::atomic<int> num_run(0);
+  bool stranded = false;
+  for (int i = 0; i < 500 && !stranded; i++) {
+    usleep(500 + (i % 20) * 50);
+    tp->post([&num_run] { num_run++; });
+    for (int j = 0; j < 1000 && num_run <= i; j++) {
+      usleep(1000);
+    }
+    stranded = num_run <= i;
+  }
+  stop_spinning = true;
+  for (std::thread &spinner : spinners) {
+    spinner.join();
+  }
+  ASSERT_FALSE(stranded);
+  delete tp;
+}
+
+static std::atomic<int> num_affinity_checked;
+static std::atomic<int> max_affinity_cpus;
+
+// Records how many CPUs the worker running it may use.
+static void AffinityTaskFn(ThreadPool::Task *t) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+  int count = CPU_COUNT(&set);
+  int prev = max_affinity_cpus;
+  while (count > prev && !max_affinity_cpus.compare_exchange_weak(prev,
+                                                                  count)) {
+  }
+  num_affinity_checked++;
+  delete t;
+}
+
+// Dispatches "n" AffinityTaskFn tasks, waits for them to run, and
+// returns the most CPUs any of them could use.
+static int MaxAffinityCpus(ThreadPool *tp, int n) {
+  num_affinity_checked = 0;
+  max_affinity_cpus = 0;
+  for (int i = 0; i < n; i++) {
+    tp->dispatch(new ThreadPool::Task(AffinityTaskFn));
+  }
+  for (int i = 0; i < 100 && num_affinity_checked < n; i++) {
+    usleep(10000);
+  }
+  EXPECT_EQ(n, num_affinity_checked.load());
+  return max_affinity_cpus;
+}
+
+TEST(Test_ThreadPool, CpuAffinity) {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+  int num_allowed = CPU_COUNT(&allowed);
+  int first_allowed = 0;
+  while (!CPU_ISSET(first_allowed, &allowed)) {
+    first_allowed++;
+  }
+
+  // CPUs we can't run on are refused.
+  ThreadPool *tp = new ThreadPool(1, 4, 1000);
+  ASSERT_FALSE(tp->set_cpu_affinity({-1, CPU_SETSIZE},
+                                    ThreadPool::kPinToCpu));
+  ASSERT_EQ(num_allowed, MaxAffinityCpus(tp, 8));
+
+  // Pinned to a CPU each, including workers added later.
+  ASSERT_TRUE(tp->set_cpu_affinity({}, ThreadPool::kPinToCpu));
+  ASSERT_EQ(1, MaxAffinityCpus(tp, 8));
+  num_blocked = 0;
+  release_blocked = false;
+  for (int i = 0; i < 4; i++) {
+    tp->dispatch(new ThreadPool::Task(BlockedTaskFn));
+  }
+  for (int i = 0; i < 100 && num_blocked < 4; i++) {
+    usleep(10000);
+  }
+  ASSERT_EQ(4U, tp->num_threads());
+  release_blocked = true;
+  ASSERT_EQ(1, MaxAffinityCpus(tp, 8));
+
+  // Pinned to a node, a worker may use any of the node's CPUs that
+  // we asked for.
+  ASSERT_TRUE(tp->set_cpu_affinity({first_allowed},
+                                   ThreadPool::kPinToNode));
+  ASSERT_EQ(1, MaxAffinityCpus(tp, 8));
+  ASSERT_TRUE(tp->set_cpu_affinity({}, ThreadPool::kPinToNode));
+  ASSERT_LE(1, MaxAffinityCpus(tp, 8));
+
+  // And unpinned again.
+  ASSERT_TRUE(tp->set_cpu_affinity({}, ThreadPool::kUnpinned));
+  ASSERT_EQ(num_allowed, MaxAffinityCpus(tp, 8));
+  delete tp;
+
+  // Pinning to nodes has each worker rebuild its deque, including the
+  // ones asleep, and the rebuilt deques can be stolen from.
+  tp = new ThreadPool(2, 4, 50);
+  ASSERT_TRUE(tp->set_cpu_affinity({}, ThreadPool::kPinToNode));
+  tp->set_work_stealing(true);
+  num_fanned_out = 0;
+  tp->dispatch(new FanOutTask(FanOutTaskFn, tp, 10));
+  for (int i = 0; i < 500 && num_fanned_out < (1 << 11) - 1; i++) {
+    usleep(10000);
+  }
+  ASSERT_EQ((1 << 11) - 1, num_fanned_out.load());
+  delete tp;
+}
+
+static pthread_mutex_t lane_mtx = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<uint32_t> lane_order;
+
+// Records which lane it was in.
+static void LaneTaskFn(ThreadPool::Task *t) {
+  pthread_mutex_lock(&lane_mtx);
+  lane_order.push_back(t->lane_);
+  pthread_mutex_unlock(&lane_mtx);
+  delete t;
+}
+
+TEST(Test_ThreadPool, Lanes) {
+  ThreadPool::LaneOptions fast, slow;
+  fast.weight = 3;
+  slow.max_workers = 1;
+
+  ThreadPool *tp = new ThreadPool(2);
+  ASSERT_FALSE(tp->set_lanes({}));
+  ThreadPool::LaneOptions zero;
+  zero.weight = 0;
+  ASSERT_FALSE(tp->set_lanes({fast, zero}));
+  ASSERT_TRUE(tp->set_lanes({fast, slow}));
+
+  // The slow lane only gets one of the two workers, so with it
+  // backed up, the fast lane still gets through.
+  num_blocked = 0;
+  release_blocked = false;
+  for (int i = 0; i < 3; i++) {
+    ThreadPool::Task *t = new ThreadPool::Task(BlockedTaskFn);
+    t->lane_ = 1;
+    tp->dispatch(t);
+  }
+  usleep(50000);
+  ASSERT_EQ(1, num_blocked.load());
+  lane_order.clear();
+  for (int i = 0; i < 5; i++) {
+    tp->dispatch(new ThreadPool::Task(LaneTaskFn));
+  }
+  for (int i = 0; i < 100 && lane_order.size() < 5; i++) {
+    usleep(10000);
+  }
+  ASSERT_EQ(5U, lane_order.size());
+  ASSERT_EQ(1, num_blocked.load());
+  release_blocked = true;
+  for (int i = 0; i < 100 && num_blocked > 0; i++) {
+    usleep(10000);
+  }
+  delete tp;
+
+  // With both lanes backed up behind a single busy worker, the fast
+  // lane gets about three turns for each of the slow lane's, and
+  // tasks past the last lane go in the last one.
+  tp = new ThreadPool(1);
+  ASSERT_TRUE(tp->set_lanes({fast, slow}));
+  num_blocked = 0;
+  release_blocked = false;
+  tp->dispatch(new ThreadPool::Task(BlockedTaskFn));
+  for (int i = 0; i < 100 && num_blocked < 1; i++) {
+    usleep(10000);
+  }
+  lane_order.clear();
+  for (int i = 0; i < 12; i++) {
+    ThreadPool::Task *t = new ThreadPool::Task(LaneTaskFn);
+    t->lane_ = (i < 6) ? 0 : 7;
+    tp->dispatch(t);
+  }
+  release_blocked = true;
+  for (int i = 0; i < 100 && lane_order.size() < 12; i++) {
+    usleep(10000);
+  }
+  ASSERT_EQ(12U, lane_order.size());
+  int fast_first = 0;
+  for (int i = 0; i < 6; i++) {
+    fast_first += (lane_order[i] == 0);
+  }
+  ASSERT_GE(fast_first, 4);
+  ASSERT_LE(fast_first, 5);
+  ASSERT_EQ(6, std::count(lane_order.begin(), lane_order.end(), 1U));
+  delete tp;
+}
+
+TEST(Test_ThreadPool, Submit) {
+  ThreadPool *tp = new ThreadPool(2);
+
+  // Results, including none at all, and exceptions come back through
+  // the future.
+  std::future<int> sum = tp->submit([]() { return 2 + 3; });
+  std::atomic<bool> ran(false);
+  std::future<void> done = tp->submit([&ran]() { ran = true; });
+  std::future<int> fails = tp->submit([]() -> int {
+    throw std::runtime_error("oops");
+  });
+  ASSERT_EQ(5, sum.get());
+  done.get();
+  ASSERT_TRUE(ran.load());
+  ASSERT_THROW(fails.get(), std::runtime_error);
+
+  // Move-only callables, and ones too big to be stored inline, work
+  // too.
+  std::unique_ptr<int> p(new int(42));
+  std::future<int> moved = tp->submit([p = std::move(p)]() { return *p; });
+  ASSERT_EQ(42, moved.get());
+  std::array<int, 64> big;
+  big.fill(1);
+  std::future<int> counted = tp->submit([big]() {
+    return std::accumulate(big.begin(), big.end(), 0);
+  });
+  ASSERT_EQ(64, counted.get());
+
+  // Posted tasks are recycled as they run.  Every one of them still
+  // runs, whether from a worker or when the pool is destroyed.
+  std::atomic<int> num_posted(0);
+  for (int i = 0; i < 10000; i++) {
+    tp->post([&num_posted]() { num_posted++; });
+  }
+  delete tp;
+  ASSERT_EQ(10000, num_posted.load());
+}
+
 }  // namespace searchserver
@@ -10,6 +10,8 @@
  */
 
 #include <cstdlib>
+#include <map>
+#include <random>
 #include <vector>
 #include <iostream>
 
@@ -66,7 +68,7 @@ TEST(Test_WordIndex, Simple) {
   auto res2 = index.lookup_query(q2);
   ASSERT_EQ(1U, res2.size());
   auto it = res2.begin();
-  ASSERT_EQ(doc_name1, it->doc_name);
+  ASSERT_EQ(doc_name1, index.doc_name(it->doc_id));
   ASSERT_EQ(1, it->rank);
 
   ProjectEnvironment::AddPoints(5);
@@ -76,10 +78,10 @@ TEST(Test_WordIndex, Simple) {
   auto res3 = index.lookup_query(q3);
   ASSERT_EQ(2U, res3.size());
   it = res3.begin();
-  ASSERT_EQ(doc_name1, it->doc_name);
+  ASSERT_EQ(doc_name1, index.doc_name(it->doc_id));
   ASSERT_EQ(3, it->rank);
   it++;
-  ASSERT_EQ(doc_name2, it->doc_name);
+  ASSERT_EQ(doc_name2, index.doc_name(it->doc_id));
   ASSERT_EQ(1, it->rank);
 
   ProjectEnvironment::AddPoints(10);
@@ -89,10 +91,10 @@ TEST(Test_WordIndex, Simple) {
   auto res4 = index.lookup_query(q4);
   ASSERT_EQ(2U, res4.size());
   it = res4.begin();
-  ASSERT_EQ(doc_name1, it->doc_name);
+  ASSERT_EQ(doc_name1, index.doc_name(it->doc_id));
   ASSERT_EQ(5, it->rank);
   it++;
-  ASSERT_EQ(doc_name2, it->doc_name);
+  ASSERT_EQ(doc_name2, index.doc_name(it->doc_id));
   ASSERT_EQ(2, it->rank);
   ProjectEnvironment::AddPoints(10);
 
@@ -101,10 +103,10 @@ TEST(Test_WordIndex, Simple) {
   auto res5 = index.lookup_query(q5);
   ASSERT_EQ(2U, res5.size());
   it = res5.begin();
-  ASSERT_EQ(doc_name1, it->doc_name);
+  ASSERT_EQ(doc_name1, index.doc_name(it->doc_id));
   ASSERT_EQ(5, it->rank);
   it++;
-  ASSERT_EQ(doc_name2, it->doc_name);
+  ASSERT_EQ(doc_name2, index.doc_name(it->doc_id));
   ASSERT_EQ(2, it->rank);
   ProjectEnvironment::AddPoints(5);
 
@@ -113,10 +115,185 @@ TEST(Test_WordIndex, Simple) {
   auto res6 = index.lookup_query(q6);
   ASSERT_EQ(1U, res6.size());
   it = res6.begin();
-  ASSERT_EQ(doc_name1, it->doc_name);
+  ASSERT_EQ(doc_name1, index.doc_name(it->doc_id));
   ASSERT_EQ(1, it->rank);
 
   ProjectEnvironment::AddPoints(10);
 }
 
+TEST(Test_WordIndex, DocIds) {
+  WordIndex index;
+
+  // Documents are numbered in the order they are first seen, and
+  // recording one again reuses its ID.
+  ASSERT_EQ(0U, index.add_document("zero"));
+  index.record("apples", "one");
+  ASSERT_EQ(1U, index.add_document("one"));
+  ASSERT_EQ(0U, index.add_document("zero"));
+  ASSERT_EQ(2U, index.num_docs());
+  ASSERT_EQ("zero", index.doc_name(0));
+  ASSERT_EQ("one", index.doc_name(1));
+
+  // Words can be recorded for documents in any order.
+  DocID two = index.add_document("two");
+  index.record("apples", two);
+  index.record("apples", 0);
+  index.record("pears", two);
+  index.record("apples", 1);
+  index.record("pears", 0);
+  index.record("pears", 0);
+  index.record("plums", 1);
+
+  auto apples = index.lookup_word("apples");
+  ASSERT_EQ(3U, apples.size());
+  auto it = apples.begin();
+  ASSERT_EQ(1U, it->doc_id);
+  ASSERT_EQ(2, it->rank);
+  it++;
+  // Equal ranks come back in ID order.
+  ASSERT_EQ(0U, it->doc_id);
+  it++;
+  ASSERT_EQ(2U, it->doc_id);
+
+  // Only documents with every word match, however long each word's
+  // list is.
+  auto res = index.lookup_query({"apples", "pears"});
+  ASSERT_EQ(2U, res.size());
+  it = res.begin();
+  ASSERT_EQ(0U, it->doc_id);
+  ASSERT_EQ(3, it->rank);
+  it++;
+  ASSERT_EQ(2U, it->doc_id);
+  ASSERT_EQ(2, it->rank);
+  ASSERT_EQ(0U, index.lookup_query({"pears", "plums"}).size());
+  ASSERT_EQ(0U, index.lookup_query({"apples", "grapes"}).size());
+}
+
+TEST(Test_WordIndex, QueryMatchesBruteForce) {
+  // Words that are in every 1, 2, 3, ... 500th document, with counts
+  // that depend on the document, so that the lists to intersect range
+  // from dense to sparse.
+  const DocID kNumDocs = 20000;
+  const vector<int> strides = {1, 2, 3, 7, 64, 129, 500};
+  std::mt19937 rng(42);
+  std::map<string, std::map<DocID, int>> truth;
+  WordIndex index;
+  for (DocID doc = 0; doc < kNumDocs; doc++) {
+    DocID id = index.add_document("doc" + std::to_string(doc));
+    for (int stride : strides) {
+      if (doc % stride == 0 || rng() % 1000 == 0) {
+        string word = "every" + std::to_string(stride);
+        int count = 1 + (doc + stride) % 5;
+        for (int i = 0; i < count; i++) {
+          index.record(word, id);
+        }
+        truth[word][doc] += count;
+      }
+    }
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t a = 0; a < strides.size(); a++) {
+      for (size_t b = a; b < strides.size(); b++) {
+        for (size_t c = b; c < strides.size(); c++) {
+          vector<string> query = {"every" + std::to_string(strides[c]),
+                                  "every" + std::to_string(strides[a])};
+          if (b != a) {
+            query.push_back("every" + std::to_string(strides[b]));
+          }
+          std::map<DocID, int> expected;
+          for (auto& entry : truth[query[0]]) {
+            int rank = 0;
+            bool everywhere = true;
+            for (const string& word : query) {
+              auto found = truth[word].find(entry.first);
+              if (found == truth[word].end()) {
+                everywhere = false;
+                break;
+              }
+              rank += found->second;
+            }
+            if (everywhere) {
+              expected[entry.first] = rank;
+            }
+          }
+
+          std::map<DocID, int> actual;
+          int last_rank = INT32_MAX;
+          for (const Result& r : index.lookup_query(query)) {
+            ASSERT_LE(r.rank, last_rank);
+            last_rank = r.rank;
+            actual[r.doc_id] = r.rank;
+          }
+          ASSERT_EQ(expected, actual) << query[0] << " " << query[1];
+        }
+      }
+    }
+    // Then again, compressed.
+    index.compact();
+  }
+}
+
+TEST(Test_WordIndex, Paging) {
+  // Lots of documents with few distinct ranks, so that ties have to be
+  // broken by DocID.
+  std::mt19937 rng(7);
+  WordIndex index;
+  for (DocID doc = 0; doc < 3000; doc++) {
+    DocID id = index.add_document("doc" + std::to_string(doc));
+    int count = 1 + rng() % 20;
+    for (int i = 0; i < count; i++) {
+      index.record("common", id);
+    }
+    if (doc % 4 != 0) {
+      index.record("most", id);
+    }
+  }
+  vector<string> query = {"most", "common"};
+  auto all_list = index.lookup_query(query);
+  vector<Result> all(all_list.begin(), all_list.end());
+  ASSERT_EQ(2250U, all.size());
+  for (size_t i = 1; i < all.size(); i++) {
+    ASSERT_TRUE(all[i - 1].rank > all[i].rank ||
+                (all[i - 1].rank == all[i].rank &&
+                 all[i - 1].doc_id < all[i].doc_id)) << i;
+  }
+
+  // Every page is the matching slice of the full, sorted results.
+  vector<Result> page;
+  for (size_t k : {7, 100, 2250}) {
+    for (size_t offset = 0; offset < all.size(); offset += k) {
+      ASSERT_EQ(all.size(), index.lookup_query(query, offset, k, &page));
+      ASSERT_EQ(std::min(k, all.size() - offset), page.size());
+      for (size_t i = 0; i < page.size(); i++) {
+        ASSERT_EQ(all[offset + i].doc_id, page[i].doc_id);
+        ASSERT_EQ(all[offset + i].rank, page[i].rank);
+      }
+    }
+  }
+
+  // Including pages nearer the end than the start, which are picked
+  // out from the worst results, and pages that run to the end.
+  for (size_t k : {size_t(1), size_t(13), SIZE_MAX}) {
+    for (size_t offset : {1, 1124, 1125, 1126, 2000, 2249}) {
+      ASSERT_EQ(all.size(), index.lookup_query(query, offset, k, &page));
+      ASSERT_EQ(std::min(k, all.size() - offset), page.size());
+      for (size_t i = 0; i < page.size(); i++) {
+        ASSERT_EQ(all[offset + i].doc_id, page[i].doc_id);
+        ASSERT_EQ(all[offset + i].rank, page[i].rank);
+      }
+    }
+  }
+
+  // Empty pages still count the hits.
+  ASSERT_EQ(all.size(), index.lookup_query(query, 0, 0, &page));
+  ASSERT_EQ(0U, page.size());
+  ASSERT_EQ(all.size(), index.lookup_query(query, 5000, 10, &page));
+  ASSERT_EQ(0U, page.size());
+  ASSERT_EQ(all.size(), index.lookup_query(query, SIZE_MAX, 10, &page));
+  ASSERT_EQ(0U, page.size());
+  ASSERT_EQ(0U, index.lookup_query({"most", "nothing"}, 0, 10, &page));
+  ASSERT_EQ(0U, page.size());
+}
+
 }  // namespace searchserver